@@ -21,7 +21,7 @@ URL: https://abrt.readthedocs.org/
 Source: https://github.com/abrt/%{name}/archive/%{version}/%{name}-%{version}.tar.gz
 BuildRequires: %{dbus_devel}
 BuildRequires: gtk3-devel
-BuildRequires: curl-devel
+BuildRequires: curl-devel >= 7.66.0
 BuildRequires: desktop-file-utils
 BuildRequires: python3-devel
 BuildRequires: gettext
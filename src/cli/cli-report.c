@@ -239,8 +239,7 @@ static int read_crash_report_field(const char *text, problem_data_t *report,
     if (strcmp(newvalue, oldvalue) == 0)
         return 0;
 
-    g_free(value->content);
-    value->content = g_strdup(newvalue);
+    problem_item_set_content(value, newvalue);
     return 1;
 }
 
@@ -172,18 +172,17 @@ problem_details_widget_add_multi_line(ProblemDetailsWidget *self, const char *na
 }
 
 static void
-problem_details_widget_add_binary(ProblemDetailsWidget *self, const char *label, const char *path)
+problem_details_widget_add_binary(ProblemDetailsWidget *self, const char *label, problem_item *item)
 {
-    struct stat statbuf;
-    statbuf.st_size = 0;
+    unsigned long item_size = 0;
 
-    if (stat(path, &statbuf) != 0)
+    if (problem_item_get_size(item, &item_size) != 0)
     {
-        log_warning("File '%s' does not exist", path);
+        log_warning("File '%s' does not exist", item->content);
         return;
     }
 
-    g_autofree gchar *size = g_format_size_full((long long)statbuf.st_size, G_FORMAT_SIZE_IEC_UNITS);
+    g_autofree gchar *size = g_format_size_full((long long)item_size, G_FORMAT_SIZE_IEC_UNITS);
     g_autofree char *msg = g_strdup_printf(_("$DATA_DIRECTORY/%s (binary file, %s)"), label, size);
     problem_details_widget_add_single_line(self, label, msg);
 }
@@ -216,7 +215,7 @@ problem_details_widget_add_problem_item(ProblemDetailsWidget *self, const char *
             problem_details_widget_add_multi_line(self, name, item->content);
     }
     else if (item->flags & CD_FLAG_BIN)
-        problem_details_widget_add_binary(self, name, item->content);
+        problem_details_widget_add_binary(self, name, item);
     else
         log_warning("Unsupported file type");
 }
@@ -243,7 +242,7 @@ problem_data_entry_to_grid_row_binary(const char *item_name, problem_item *item,
 {
     if ((item->flags & CD_FLAG_BIN)
             && !libreport_is_in_string_list(item_name, items_auto_blacklist))
-        problem_details_widget_add_binary(self, item_name, item->content);
+        problem_details_widget_add_binary(self, item_name, item);
 }
 
 static void
@@ -33,7 +33,7 @@ void problem_data_reload_from_dump_dir(void)
 {
     free(g_events);
 
-    struct dump_dir *dd = dd_opendir(g_dump_dir_name, DD_OPEN_READONLY);
+    struct dump_dir *dd = dd_opendir(g_dump_dir_name, DD_OPEN_READONLY | DD_OPEN_SHARED_LOCK);
     if (!dd)
         libreport_xfunc_die(); /* dd_opendir already logged error msg */
 
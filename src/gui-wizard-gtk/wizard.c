@@ -1013,13 +1013,12 @@ static void append_item_to_ls_details(gpointer name, gpointer value, gpointer da
     }
     else if (item->flags & CD_FLAG_BIN)
     {
-        struct stat statbuf;
-        statbuf.st_size = 0;
-        if (stat(item->content, &statbuf) == 0)
+        unsigned long size = 0;
+        if (problem_item_get_size(item, &size) == 0)
         {
-            stats->filesize += statbuf.st_size;
+            stats->filesize += size;
             g_autofree char *msg = g_strdup_printf(
-                    _("(binary file, %llu bytes)"), (long long)statbuf.st_size);
+                    _("(binary file, %llu bytes)"), (unsigned long long)size);
             gtk_list_store_set(g_ls_details, &iter,
                                   DETAIL_COLUMN_NAME, (char *)name,
                                   DETAIL_COLUMN_VALUE, msg,
@@ -2871,8 +2870,7 @@ static void save_edited_one_liner(GtkCellRendererText *renderer,
         if (dd)
         {
             dd_save_text(dd, item_name, new_text);
-            free(item->content);
-            item->content = g_strdup(new_text);
+            problem_item_set_content(item, new_text);
             gtk_list_store_set(g_ls_details, &iter,
                     DETAIL_COLUMN_VALUE, new_text,
                     -1);
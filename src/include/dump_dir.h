@@ -92,6 +92,15 @@ enum dump_dir_flags {
      * exists and to perform stat operations.
      */
     DD_OPEN_FD_ONLY = (1 << 7),
+    /* Lock for reading only: readers do not wait for each other, but
+     * the dump dir can't be modified.
+     *
+     * Readers hold only a flock() of the directory and do not create .lock.
+     * Processes using a libreport without this flag don't know the flock()
+     * and may modify the dump dir while it is being read; only writers using
+     * this libreport wait for the readers. Don't use the flag for data which
+     * must be consistent across elements if such processes can write them. */
+    DD_OPEN_SHARED_LOCK = (1 << 8),
 };
 
 struct dump_dir {
@@ -115,6 +124,8 @@ struct dump_dir {
      * dd_get_meta_data_dir_fd()
      */
     int dd_md_fd;
+    /* Opened with DD_OPEN_SHARED_LOCK, locked is 0 then */
+    int shared_lock;
 };
 
 void dd_close(struct dump_dir *dd);
@@ -123,6 +134,27 @@ void dd_close(struct dump_dir *dd);
  */
 struct dump_dir *dd_opendir(const char *dir, int flags);
 
+/* Like dd_opendir(), but waits at most timeout_ms milliseconds for other
+ * process to unlock the directory. Returns NULL if the directory remains
+ * locked; -1 means wait forever and 0 do not wait at all.
+ */
+struct dump_dir *dd_opendir_timeout(const char *dir, int flags, int timeout_ms);
+
+/* Process wide statistics of waiting for locks of dump directories */
+struct dd_lock_wait_stats
+{
+    /* Number of locking attempts which found the directory locked */
+    unsigned long waits;
+    /* Number of those which gave up because of a timeout */
+    unsigned long timeouts;
+    /* Total and longest time spent waiting in microseconds */
+    unsigned long long wait_usec;
+    unsigned long long max_wait_usec;
+};
+
+void dd_get_lock_wait_stats(struct dd_lock_wait_stats *stats);
+void dd_reset_lock_wait_stats(void);
+
 /* Re-opens a dump_dir opened with DD_OPEN_FD_ONLY.
  *
  * The passed dump_dir must not be used any more and the return value must be
@@ -231,6 +263,34 @@ int dd_copy_file(struct dump_dir *dd, const char *name, const char *source_path)
 int dd_copy_file_unpack(struct dump_dir *dd, const char *name, const char *source_path);
 int dd_unpack_coredump(struct dump_dir *dd, const char *coredump_archive_filename);
 
+/* Stores an element compressed by zstd
+ *
+ * The element keeps its name and is marked by an extended attribute, the
+ * functions reading elements (dd_load_text_ext(), dd_open_item(),
+ * dd_get_item_size(), the problem_data loaders and archives) return its
+ * uncompressed content. Tools reading the file directly see compressed data,
+ * they need the element decompressed by dd_decompress_item() first.
+ * Rewriting the element stores it uncompressed again.
+ *
+ * Data which don't shrink are left as they are.
+ *
+ * @param dd Dump directory opened for writing
+ * @param name The name of the element
+ * @return 0 on success, -ENOTSUP if the file system doesn't support extended
+ *  attributes, or other negative value if an error occurred. The element is
+ *  not changed on errors.
+ */
+int dd_compress_item(struct dump_dir *dd, const char *name);
+
+/* Stores a compressed element uncompressed again
+ *
+ * @param dd Dump directory opened for writing
+ * @param name The name of the element
+ * @return 0 on success (also for elements which are not compressed), or
+ *  negative value if an error occurred.
+ */
+int dd_decompress_item(struct dump_dir *dd, const char *name);
+
 /* Create an item of the given name with contents of the given file (see man openat)
  *
  * @param dd Dump directory
@@ -265,8 +325,8 @@ off_t dd_copy_fd(struct dump_dir *dd, const char *name, int fd, int copy_flags,
 int dd_item_stat(struct dump_dir *dd, const char *name, struct stat *statbuf);
 
 /* Returns value less than 0 if any error occured; otherwise returns size of an
- * item in Bytes. If an item does not exist returns 0 instead of an error
- * value.
+ * item in Bytes (uncompressed size of compressed items). If an item does not
+ * exist returns 0 instead of an error value.
  */
 long dd_get_item_size(struct dump_dir *dd, const char *name);
 
@@ -323,6 +383,8 @@ int dd_rename(struct dump_dir *dd, const char *new_path);
 int dd_chown(struct dump_dir *dd, uid_t new_uid);
 
 /* Returns the number of Bytes consumed by the dump directory.
+ *
+ * Compressed elements are counted by their stored size.
  *
  * @param flags For the future needs (count also meta-data, ...).
  * @return Negative number on errors (-errno). Otherwise size in Bytes.
@@ -474,29 +536,61 @@ struct dump_dir *create_dump_dir(const char *base_dir_name, const char *type,
 struct dump_dir *create_dump_dir_ext(const char *base_dir_name, const char *type,
         pid_t pid, uid_t uid, save_data_call_back save_data, void *args);
 
+/* Compression of archives created from dump directories */
+enum {
+    DD_ARCHIVE_TAR_GZ,
+    DD_ARCHIVE_TAR_XZ,
+    DD_ARCHIVE_TAR_ZST,
+};
+
+/* Flags of dd_create_archive() and dd_create_archive_fd() */
+enum {
+    /* Unlock dd as soon as all elements are opened. The archive is written
+     * from the opened files while other processes can use the directory,
+     * dd must be only closed then.
+     */
+    DD_ARCHIVE_UNLOCK = (1 << 0),
+};
+
+/* Returns the archive type for the suffix of archive_name ('.tar.gz',
+ * '.tar.xz' or '.tar.zst') or -ENOSYS if it is not supported.
+ */
+int dd_archive_type_for_name(const char *archive_name);
+
 /* Creates a new archive from the dump directory contents
  *
  * The dd argument must be opened for reading.
  *
  * The archive_name must not exist. The file will be created with 0600 mode.
  *
- * The archive type is deduced from archive_name suffix. The supported archive
- * suffixes are the following:
- *   - '.tag.gz' (note: the implementation uses child gzip process)
+ * The archive type is deduced from archive_name suffix, see
+ * dd_archive_type_for_name(). The xz and zstd archives are compressed in as
+ * many threads as there are online CPUs if libarchive supports that.
  *
  * The archive will include only the files that are not in the exclude_elements
  * list. See libreport_get_global_always_excluded_elements().
  *
- * The argument "flags" is currently unused.
+ * The flags are 0 or DD_ARCHIVE_UNLOCK.
  *
  * @return 0 on success; otherwise non-0 value. -ENOSYS if archive type is not
- * supported. -EEXIST if the archive file already exists. -ECHILD if child
- * process fails. Other negative values can be converted to errno values by
- * turning them positive.
+ * supported. -EEXIST if the archive file already exists. Other negative values
+ * can be converted to errno values by turning them positive. The archive file
+ * is removed on failure.
  */
 int dd_create_archive(struct dump_dir *dd, const char *archive_name,
         const_string_vector_const_ptr_t exclude_elements, int flags);
 
+/* Writes an archive of the given DD_ARCHIVE_* type to archive_fd
+ *
+ * The archive is written sequentially, so archive_fd can be a pipe or
+ * a socket and the data can be consumed while they are being compressed.
+ * The file descriptor is not closed.
+ *
+ * Otherwise the same as dd_create_archive().
+ */
+int dd_create_archive_fd(struct dump_dir *dd, int archive_fd, int type,
+        const_string_vector_const_ptr_t exclude_elements, int flags);
+
 #ifdef __cplusplus
 }
 #endif
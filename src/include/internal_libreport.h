@@ -139,6 +139,12 @@ typedef enum {
         COPYFD_SPARSE = 1 << 0,
 } libreport_copyfd_flags;
 
+/* Granularity of holes created in sparse files */
+#define LIBREPORT_SPARSE_BLOCK_SIZE 4096
+
+/* Returns true if all size Bytes of the buffer are zeros */
+bool libreport_is_zero_block(const char *buffer, size_t size);
+
 /* Writes up to 'size' Bytes from a file descriptor to a file in a directory
  *
  * If you need to write all Bytes of the file descriptor, pass 0 as the size.
@@ -171,10 +177,29 @@ off_t libreport_copy_file_at(const char *src_name, int dir_fd, const char *name,
 int libreport_copy_file_recursive(const char *source, const char *dest);
 
 int libreport_decompress_fd(int fdi, int fdo);
+/* Fails if the decompressed data are not exactly size Bytes, stops writing
+ * them as soon as they exceed it. Negative size means no limit.
+ */
+int libreport_decompress_fd_ext(int fdi, int fdo, off_t size);
+/* Decompresses at most size Bytes from the beginning of the input.
+ * Returns the number of decompressed Bytes or -1 on errors.
+ */
+ssize_t libreport_decompress_head(int fdi, void *buf, size_t size);
 int libreport_decompress_file(const char *path_in, const char *path_out, mode_t mode_out);
 int libreport_decompress_file_ext_at(const char *path_in, int dir_fd, const char *path_out,
         mode_t mode_out, uid_t uid, gid_t gid, int src_flags, int dst_flags);
 
+/* Returns the uncompressed size of a compressed dump dir element (see
+ * dd_compress_item()), or -1 for plain elements.
+ */
+off_t libreport_compressed_element_size(int fd);
+
+/* Returns fd of a plain dump dir element, or a new fd of the uncompressed
+ * content of a compressed element (see dd_compress_item()). The passed fd is
+ * closed in the latter case and on errors (-errno).
+ */
+int libreport_uncompressed_element_fd(int fd);
+
 // NB: will return short read on error, not -1,
 // if some data was read before error occurred
 void libreport_xread(int fd, void *buf, size_t count);
@@ -198,6 +223,26 @@ char *libreport_encode_base64(const void *src, int length);
  * If Nth bit is set, Nth control char will be sanitized (replaced by [XX]).
  */
 char *libreport_sanitize_utf8(const char *src, uint32_t control_chars_to_sanitize);
+
+/* Counters of the "does it look like text" heuristics */
+struct libreport_text_stats
+{
+    /* Control chars other than white space */
+    unsigned control_chars;
+    /* DEL chars and Bytes breaking the order of unicode start and
+     * continuation Bytes
+     */
+    unsigned bad_chars;
+};
+
+/* Like libreport_sanitize_utf8() but sanitizes len Bytes of src.
+ *
+ * If stats is not NULL, it gathers the text heuristics in the same pass.
+ * Scanning stops at the first control char which is not white space and
+ * NULL is returned, because such data are not text anyway.
+ */
+char *libreport_sanitize_utf8_ext(const char *src, size_t len,
+        uint32_t control_chars_to_sanitize, struct libreport_text_stats *stats);
 enum {
     SANITIZE_ALL = 0xffffffff,
     SANITIZE_TAB = (1 << 9),
@@ -671,6 +716,62 @@ file_obj_t *libreport_new_file_obj(const char* fullpath, const char* filename);
 void libreport_free_file_obj(file_obj_t *f);
 GList *libreport_parse_delimited_list(const char *string, const char *delimiter);
 
+/* File or directory a cached configuration depends on */
+struct libreport_config_source
+{
+    char *path;
+    bool exists;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+};
+
+/* Returns an array freeing its struct libreport_config_source elements */
+GPtrArray *libreport_new_config_sources(void);
+/* Records the current state of path, does nothing if sources is NULL */
+void libreport_add_config_source(GPtrArray *sources, const char *path);
+/* Returns true if any of the sources was created, removed or modified
+ * since it had been recorded.
+ */
+bool libreport_config_sources_changed(GPtrArray *sources);
+
+/* Returns the payload of the cache file name in $XDG_CACHE_HOME/libreport,
+ * if it was saved for key with a payload of type and none of its sources
+ * changed since then. The sources are stored to *sources then.
+ *
+ * A cache saved without sources is used until libreport is upgraded, its
+ * payload must be validated by the caller.
+ *
+ * Returns NULL if there is no usable cache. Caches are not persisted for
+ * system users and without a real $HOME, see config_cache.c.
+ */
+GVariant *libreport_load_config_cache(const char *name, const char *key,
+        const GVariantType *type, GPtrArray **sources);
+/* Replaces the cache file name atomically, failures are only logged.
+ * A floating payload is consumed.
+ */
+void libreport_save_config_cache(const char *name, const char *key,
+        GPtrArray *sources, GVariant *payload);
+/* Removes the cache file name if there is one */
+void libreport_remove_config_cache(const char *name);
+
+/* Returns the result of a query to a remote server saved for key in group,
+ * if it is of type and was saved less than ttl_secs ago. An empty container,
+ * a negative result, expires after negative_ttl_secs instead.
+ *
+ * Returns NULL if there is no usable result.
+ */
+GVariant *libreport_load_query_cache(const char *group, const char *key,
+        const GVariantType *type, unsigned ttl_secs, unsigned negative_ttl_secs);
+/* Stores the result with the current time in the cache file of group, which
+ * is replaced atomically, failures are only logged. A floating result is
+ * consumed.
+ */
+void libreport_save_query_cache(const char *group, const char *key, GVariant *result);
+/* Forgets all results in group, e.g. after the data on the server changed */
+void libreport_drop_query_cache(const char *group);
+
 /* Connect to abrtd over unix domain socket, issue DELETE command */
 int delete_dump_dir_possibly_using_abrtd(const char *dump_dir_name);
 
@@ -20,6 +20,8 @@
 #define LIBREPORT_CURL_H_
 
 #include <curl/curl.h>
+#include <glib.h>
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -30,6 +32,74 @@ CURL* xcurl_easy_init();
 /* Set proxy according to the url and call curl_easy_perform */
 CURLcode curl_easy_perform_with_proxy(CURL *handle, const char *url);
 
+/* Retrying failed requests
+ *
+ * A request which failed for a transient reason, before it reached the server
+ * or with a response saying the server can't handle it now, is sent again
+ * after a delay. The delay doubles with every attempt, a random part of it
+ * spreads the attempts of many clients, and a Retry-After header of the
+ * response overrides it. Requests are retried by post() and the post queue,
+ * their callers shouldn't retry them again.
+ */
+typedef struct post_retry_stats {
+    /* Updated atomically, the policy can be shared by threads */
+    guint requests;
+    guint attempts;
+    guint retries;
+    /* Retries which waited for Retry-After */
+    guint throttled;
+    /* Requests which failed after all attempts or by the deadline */
+    guint exhausted;
+    guint waited_ms;
+} post_retry_stats_t;
+
+typedef struct post_retry_policy {
+    /* Including the first attempt, 1 turns retrying off */
+    unsigned    max_attempts;
+    unsigned    initial_delay_ms;
+    unsigned    max_delay_ms;
+    /* No attempt starts later after the first one, 0 for no limit */
+    unsigned    deadline_ms;
+    /* Terminated by 0, NULL for 429 and 503. The server didn't process the
+     * request then, 502 and 504 of a proxy are safe to add only for requests
+     * which can be processed twice.
+     */
+    const int   *retry_http_codes;
+    /* Terminated by CURLE_OK, NULL for errors of resolving names and
+     * connecting, the request was not sent then.
+     */
+    const CURLcode *retry_curl_results;
+    post_retry_stats_t stats;
+} post_retry_policy_t;
+
+/* The policy of requests whose post_state has no policy. Its settings can be
+ * changed before the first request.
+ */
+post_retry_policy_t *post_retry_default_policy(void);
+/* Logs the counters of policy, NULL for the default one */
+void post_retry_log_stats(const post_retry_policy_t *policy);
+
+/* The attempts of one request */
+typedef struct post_retry {
+    post_retry_policy_t *policy;
+    unsigned    attempt;
+    gint64      start_time;
+} post_retry_t;
+
+/* Starts the first attempt of a request, NULL for the default policy */
+void post_retry_start(post_retry_t *retry, post_retry_policy_t *policy);
+/* Returns the number of milliseconds to wait before the next attempt after
+ * a failed one or -1 if there should be none. retry_after_secs is what the
+ * server asked for, 0 if nothing. The next attempt is counted as started.
+ */
+long post_retry_delay(post_retry_t *retry, bool transient, long retry_after_secs);
+/* Like post_retry_delay(), but waits and returns true if there should be the
+ * next attempt.
+ */
+bool post_retry_next(post_retry_t *retry, bool transient, long retry_after_secs);
+/* Returns true if the HTTP response code is worth retrying under policy */
+bool post_retry_http_code(const post_retry_policy_t *policy, int http_resp_code);
+
 typedef struct post_state {
     /* Supplied by caller: */
     int         flags;
@@ -55,6 +125,21 @@ typedef struct post_state {
     char        *body;
     size_t      body_size;
     char        errmsg[CURL_ERROR_SIZE];
+    /* The fields below were added later, they are at the end to keep
+     * the layout of the fields above for the existing users.
+     */
+    /* Supplied by caller: */
+    /* NULL for post_retry_default_policy() */
+    post_retry_policy_t *retry_policy;
+    /* A response whose body contains it is retried too, e.g. a fault of a call
+     * which conflicted with another one. Needs POST_WANT_BODY.
+     */
+    const char  *retry_body_substring;
+    /* Results of POST transaction: */
+    /* Seconds from the Retry-After header of the response or 0 */
+    long        retry_after;
+    /* Attempts made to send the request */
+    unsigned    attempts;
 } post_state_t;
 
 post_state_t *new_post_state(int flags);
@@ -76,6 +161,10 @@ enum {
     POST_DATA_STRING_AS_FORM_DATA = -5,
     POST_DATA_GET = -6,
 };
+/* Connections are kept open after the transfer and reused by following
+ * requests to the same server. Transient failures are retried according to
+ * the retry policy of state.
+ */
 int
 post(post_state_t *state,
                 const char *url,
@@ -83,6 +172,39 @@ post(post_state_t *state,
                 const char **additional_headers,
                 const char *data,
                 off_t data_size);
+
+/* Reads at most size bytes of the posted data into buf. Returns the number of
+ * bytes read, 0 at the end of the data or -1 on errors.
+ */
+typedef ssize_t (*post_read_fn)(void *buf, size_t size, void *user_data);
+
+/* Posts the data produced by read_fn, they are never in memory as a whole.
+ * data_size must be their exact size, if it is negative, the data are sent in
+ * chunks of HTTP/1.1 chunked transfer encoding. The data can't be read again,
+ * so the request is retried only if it failed before read_fn was called.
+ */
+int
+post_stream(post_state_t *state,
+                const char *url,
+                const char *content_type,
+                const char **additional_headers,
+                post_read_fn read_fn,
+                void *user_data,
+                off_t data_size);
+
+/* Posts prefix, the content of the regular file fd encoded in base64 and
+ * suffix. The file is read from the beginning and encoded while it is being
+ * sent, so the used memory doesn't depend on its size.
+ */
+int
+post_base64_fd(post_state_t *state,
+                const char *url,
+                const char *content_type,
+                const char **additional_headers,
+                const char *prefix,
+                int fd,
+                const char *suffix);
+
 static inline int
 get(post_state_t *state,
                 const char *url,
@@ -133,6 +255,49 @@ post_file_as_form(post_state_t *state,
                      filename, POST_DATA_FROMFILE_AS_FORM_DATA);
 }
 
+/* Concurrent transfers
+ *
+ * Requests added to a queue are transferred at the same time, in a single
+ * thread, while post_queue_perform() or post_queue_run() is being called.
+ */
+typedef struct post_queue post_queue_t;
+
+/* Called once the request is finished, state contains its results as after
+ * post().
+ */
+typedef void (*post_queue_done_fn)(post_state_t *state, void *user_data);
+
+post_queue_t *new_post_queue(void);
+/* Aborts unfinished requests without calling their callbacks */
+void free_post_queue(post_queue_t *queue);
+
+/* Adds a request like post() without waiting for its completion. state must
+ * be kept until the request is finished, retries included.
+ *
+ * @param timeout Maximum number of seconds the request can take, 0 for no limit
+ * @return 0 on success; -1 if data can't be read (see state)
+ */
+int post_queue_add(post_queue_t *queue,
+                post_state_t *state,
+                const char *url,
+                const char *content_type,
+                const char **additional_headers,
+                const char *data,
+                off_t data_size,
+                long timeout,
+                post_queue_done_fn done,
+                void *user_data);
+
+/* Transfers data of the queued requests, waits at most timeout_ms for any
+ * progress, and calls the callbacks of the finished requests.
+ *
+ * @return Number of unfinished requests
+ */
+unsigned post_queue_perform(post_queue_t *queue, int timeout_ms);
+
+/* Waits until all queued requests are finished */
+void post_queue_run(post_queue_t *queue);
+
 enum {
     UPLOAD_FILE_NOFLAGS = 0,
     UPLOAD_FILE_HANDLE_ACCESS_DENIALS = 1 << 0,
@@ -154,6 +319,22 @@ char *libreport_upload_file_ext(post_state_t *post_state,
                 const char *filename,
                 int flags);
 
+/* Uploads data read from fd until EOF to url.
+ *
+ * The data are sent while they are being read, so fd can be a pipe. Their
+ * size is not known in advance, which HTTP(S) servers must accept as chunked
+ * transfer encoding. Servers which don't, answer 411 or 501 and the upload
+ * fails. SCP can't upload data of unknown size.
+ *
+ * Works like libreport_upload_file_ext() with filename used only to name the
+ * uploaded file. Access denials are not handled, the data can't be read
+ * again.
+ */
+char *libreport_upload_fd(post_state_t *post_state,
+                const char *url,
+                const char *filename,
+                int fd);
+
 #ifdef __cplusplus
 }
 #endif
@@ -46,6 +46,8 @@ enum {
 
 #define PROBLEM_ITEM_UNINITIALIZED_SIZE ((unsigned long)-1)
 
+struct problem_item_source;
+
 struct problem_item {
     char    *content;
     unsigned flags;
@@ -55,6 +57,15 @@ struct problem_item {
     int      allowed_by_reporter;  /* 0 "no", 1 "yes" */
     int      default_by_reporter;  /* 0 "no", 1 "yes" */
     int      required_by_reporter; /* 0 "no", 1 "yes" */
+    /* Size of the read-only mapping backing content, 0 if content is
+     * allocated on heap. Never free or modify content of mapped items,
+     * use problem_item_set_content() instead.
+     */
+    size_t   mapped_size;
+    /* Element file the content is loaded from on first access, NULL if
+     * content is loaded. See PD_LOAD_LAZY.
+     */
+    struct problem_item_source *source;
 };
 typedef struct problem_item problem_item;
 
@@ -62,6 +73,25 @@ char *problem_item_format(struct problem_item *item);
 
 int problem_item_get_size(struct problem_item *item, unsigned long *size);
 
+/* Opens the file of a CD_FLAG_BIN item for reading. Elements stored
+ * compressed (see dd_compress_item()) are decompressed, so don't open
+ * item->content directly.
+ *
+ * @return fd, or negative errno
+ */
+int problem_item_open_file(struct problem_item *item);
+
+/* Returns the item's content, loads it from the dump directory first if
+ * the item has been loaded lazily. Use it instead of item->content where the
+ * item is not obtained by problem_data_get_item_or_NULL().
+ */
+char *problem_item_get_content(struct problem_item *item);
+
+/* Replaces the item's content by a copy of the given string and releases
+ * the previous content (heap or mapping).
+ */
+void problem_item_set_content(struct problem_item *item, const char *content);
+
 /* In-memory problem data structure and accessors */
 
 typedef GHashTable problem_data_t;
@@ -99,10 +129,8 @@ void problem_data_add_text_editable(problem_data_t *problem_data,
 /* "name" can be NULL: */
 void problem_data_add_file(problem_data_t *pd, const char *name, const char *path);
 
-static inline struct problem_item *problem_data_get_item_or_NULL(problem_data_t *problem_data, const char *key)
-{
-    return (struct problem_item *)g_hash_table_lookup(problem_data, key);
-}
+/* Loads content of lazily loaded items, see PD_LOAD_LAZY */
+struct problem_item *problem_data_get_item_or_NULL(problem_data_t *problem_data, const char *key);
 char *problem_data_get_content_or_NULL(problem_data_t *problem_data, const char *key);
 /* Aborts if key is not found: */
 char *problem_data_get_content_or_die(problem_data_t *problem_data, const char *key);
@@ -148,9 +176,53 @@ int problem_data_load_dump_dir_element(struct dump_dir *dd, const char *name, ch
 
 void problem_data_load_from_dump_dir(problem_data_t *problem_data, struct dump_dir *dd, char **excluding);
 
+enum {
+    /* Do not copy big text elements to heap, back their content by
+     * a read-only mapping of the element file instead. Content is sanitized
+     * (copied) only if it contains invalid bytes.
+     *
+     * Use it only if the elements are not going to be truncated while the
+     * problem data exist (e.g. the dump directory remains locked), because
+     * accessing a truncated mapping kills the process with SIGBUS. libreport
+     * itself never truncates elements, it replaces them by new files.
+     *
+     * Together with PD_LOAD_LAZY, elements are mapped and validated on first
+     * access only.
+     */
+    PD_LOAD_MAP_BIG_TEXT = (1 << 0),
+    /* Record only names, types and sizes of text elements which do not fit
+     * into a single probe read and load their content on first access via
+     * problem_data_get_item_or_NULL(), problem_data_get_content_or_NULL() or
+     * problem_item_get_content(). The problem data keep a duplicate of
+     * the dump directory fd, so the dump directory can be closed.
+     *
+     * Content of not yet loaded items is NULL, don't access item->content
+     * of items obtained by iterating over the hash table directly.
+     */
+    PD_LOAD_LAZY = (1 << 1),
+};
+
+/* Like problem_data_load_from_dump_dir()
+ *
+ * @param flags PD_LOAD_* flags
+ */
+void problem_data_load_from_dump_dir_ext(problem_data_t *problem_data, struct dump_dir *dd,
+                char **excluding, int flags);
+
 problem_data_t *create_problem_data_from_dump_dir(struct dump_dir *dd);
 /* Helper for typical operation in reporters: */
 problem_data_t *create_problem_data_for_reporting(const char *dump_dir_name);
+/* Like create_problem_data_for_reporting()
+ *
+ * The dump directory is unlocked before the function returns, so with
+ * PD_LOAD_LAZY, items hold what their elements contain on first access,
+ * which is "" for removed elements. PD_LOAD_MAP_BIG_TEXT is safe only if no
+ * one truncates the elements in the meantime. Use it only in callers which
+ * access items through problem_data_get_item_or_NULL() and friends.
+ *
+ * @param flags PD_LOAD_* flags
+ */
+problem_data_t *create_problem_data_for_reporting_ext(const char *dump_dir_name, int flags);
 
 /**
   @brief Saves the problem data object
@@ -145,6 +145,24 @@ struct run_event_state {
     int command_in_fd;
     int process_status;
     GString *command_output;
+    /* Compiled rules the rules in rule_list belong to */
+    struct rule_set *rule_set;
+    /* Event the rules in rule_list have been selected for */
+    char *rule_list_event;
+
+    /* Commands of rules annotated by PARALLEL=yes are run concurrently by
+     * run_event_on_dir_name(), at most this many at once. Values lower
+     * than 2 mean all commands run one by one, which is the default unless
+     * the environment variable LIBREPORT_MAX_PARALLEL_COMMANDS says
+     * otherwise.
+     */
+    unsigned max_parallel_commands;
+
+    /* Commands which consist only of a program name and plain arguments,
+     * without any quoting, expansion or redirection, are executed directly
+     * instead of through /bin/sh. Off by default.
+     */
+    bool exec_plain_commands;
 };
 struct run_event_state *new_run_event_state(void);
 void free_run_event_state(struct run_event_state *state);
@@ -190,6 +208,30 @@ GList *load_rule_list(GList *rule_list, const char *conf_file_name, unsigned rec
 /* Cleans up rule list created by load_rule_list */
 void free_rule_list(GList *rule_list);
 
+/* Rules of a configuration file compiled for fast matching: conditions are
+ * parsed, regular expressions compiled and rules indexed by EVENT.
+ */
+struct rule_set;
+
+/* Returns compiled rules of a configuration file and the files it includes.
+ * The rules are cached and shared with other callers until one of the files,
+ * or a directory searched by an include, is modified.
+ *
+ * Never returns NULL; if the file can't be read or has no rules, the set is
+ * empty.
+ * @param conf_file_name path to configuration file
+ */
+struct rule_set *load_rule_set(const char *conf_file_name);
+
+/* Releases the reference obtained by load_rule_set() */
+void unref_rule_set(struct rule_set *set);
+
+/* Returns a new list of rules (struct rule) which can match the event, in the
+ * configuration order. The rules belong to the rule set, free only the list.
+ * @param event exact event name or NULL for all rules
+ */
+GList *get_rule_set_rules(struct rule_set *set, const char *event);
+
 /* Synchronous command execution */
 
 /* The function believes that a state param value is fully initialized and
@@ -204,8 +246,57 @@ void free_rule_list(GList *rule_list);
  */
 int consume_event_command_output(struct run_event_state *state, const char *dump_dir_name);
 
+/* Asynchronous execution of several events from one thread
+ *
+ * The loop waits for output of the running commands of all added events,
+ * starts next commands of an event when the previous one succeeds and calls
+ * the event's done callback when the event finishes. A single thread can thus
+ * drive any number of run_event_states, each with its own callbacks.
+ */
+struct run_event_loop;
+
+/* retval is the same as the return value of run_event_on_dir_name() */
+typedef void (*run_event_loop_done_callback)(struct run_event_state *state, int retval, void *param);
+
+/* Returns NULL on error */
+struct run_event_loop *new_run_event_loop(void);
+
+/* Stops watching unfinished events. Their running commands are not killed
+ * and their done callbacks are not called.
+ */
+void free_run_event_loop(struct run_event_loop *loop);
+
+/* Starts the first command of the event. The state must not be used by
+ * anything else until done is called.
+ *
+ * Returns -1 if there is no command to run, done is not called then.
+ * Otherwise returns 0.
+ */
+int run_event_loop_add(struct run_event_loop *loop,
+                struct run_event_state *state,
+                const char *dump_dir_name,
+                const char *event,
+                run_event_loop_done_callback done,
+                void *param);
+
+/* Returns a file descriptor which becomes readable when
+ * run_event_loop_dispatch() has something to do, for integration with
+ * other main loops.
+ */
+int run_event_loop_get_fd(struct run_event_loop *loop);
+
+/* Waits up to timeout milliseconds (-1 means forever) for output of the
+ * commands, processes it and starts next commands.
+ *
+ * Returns the number of events which have not finished yet.
+ */
+int run_event_loop_dispatch(struct run_event_loop *loop, int timeout);
+
 /* Returns exit code of first failed action, or first nonzero return value
  * of post_run_callback. If all actions are successful, returns 0.
+ *
+ * See max_parallel_commands of struct run_event_state for concurrent
+ * execution.
  */
 int run_event_on_dir_name(struct run_event_state *state, const char *dump_dir_name, const char *event);
 int run_event_on_problem_data(struct run_event_state *state, problem_data_t *data, const char *event);
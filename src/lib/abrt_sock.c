@@ -111,7 +111,7 @@ int problem_data_send_to_abrt(problem_data_t* problem_data)
                 continue;
             }
 
-            g_autofree char *msg = g_strdup_printf("%s=%s", name, value->content);
+            g_autofree char *msg = g_strdup_printf("%s=%s", name, problem_item_get_content(value));
             libreport_full_write(socketfd, msg, strlen(msg)+1 /* yes, +1 coz we want to send the trailing 0 */);
         }
         shutdown(socketfd, SHUT_WR);
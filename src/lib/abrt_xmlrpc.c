@@ -19,6 +19,7 @@
 #include <unistd.h>
 #include "internal_libreport.h"
 #include "abrt_xmlrpc.h"
+#include "libreport_curl.h"
 #include "proxies.h"
 
 struct abrt_xmlrpc_param_pair
@@ -52,6 +53,9 @@ struct abrt_xmlrpc *abrt_xmlrpc_new_redhat_client(const char *url, int ssl_verif
     xmlrpc_env_init(&env);
 
     struct abrt_xmlrpc *ax = g_new0(struct abrt_xmlrpc, 1);
+    ax->ax_url = g_strdup(url);
+    ax->ax_ssl_verify = ssl_verify;
+    ax->ax_api_key = g_strdup(api_key);
 
     /* This should be done at program startup, once. We do it in main */
     /* xmlrpc_client_setup_global_const(&env); */
@@ -152,6 +156,8 @@ void abrt_xmlrpc_free_client(struct abrt_xmlrpc *ax)
 
     g_list_free(ax->ax_session_params);
 
+    g_free(ax->ax_url);
+    g_free(ax->ax_api_key);
     g_free(ax);
 }
 
@@ -168,8 +174,61 @@ void abrt_xmlrpc_client_add_session_param_string(xmlrpc_env *env, struct abrt_xm
     ax->ax_session_params = g_list_append(ax->ax_session_params, new_ses_param);
 }
 
-/* internal helper function */
-static xmlrpc_value *abrt_xmlrpc_call_params_internal(xmlrpc_env *env, struct abrt_xmlrpc *ax, const char *method, xmlrpc_value *params)
+char *abrt_xmlrpc_client_get_session_param_string(struct abrt_xmlrpc *ax, const char *name)
+{
+    for (GList *iter = ax->ax_session_params; iter; iter = g_list_next(iter))
+    {
+        struct abrt_xmlrpc_param_pair *param_pair = (struct abrt_xmlrpc_param_pair *)iter->data;
+        if (strcmp(param_pair->name, name) != 0)
+            continue;
+
+        xmlrpc_env env;
+        xmlrpc_env_init(&env);
+
+        const char *value = NULL;
+        xmlrpc_read_string(&env, param_pair->value, &value);
+        if (env.fault_occurred)
+            abrt_xmlrpc_die(&env);
+
+        char *result = g_strdup(value);
+        xmlrpc_strfree(value);
+        return result;
+    }
+
+    return NULL;
+}
+
+static void abrt_xmlrpc_params_add_session_params(xmlrpc_env *env, struct abrt_xmlrpc *ax, xmlrpc_value *params)
+{
+    for (GList *iter = ax->ax_session_params; iter; iter = g_list_next(iter))
+    {
+        struct abrt_xmlrpc_param_pair *param_pair = (struct abrt_xmlrpc_param_pair *)iter->data;
+
+        xmlrpc_struct_set_value(env, params, param_pair->name, param_pair->value);
+        if (env->fault_occurred)
+            abrt_xmlrpc_die(env);
+    }
+}
+
+/* Returns true if the call failed with an HTTP response code worth retrying,
+ * xmlrpc-c reports them only in the fault string.
+ */
+static bool abrt_xmlrpc_fault_is_transient(const xmlrpc_env *env, const post_retry_policy_t *policy)
+{
+    static const char prefix[] = "HTTP response code is ";
+
+    if (env->fault_code != XMLRPC_NETWORK_ERROR || env->fault_string == NULL)
+        return false;
+
+    const char *code = strstr(env->fault_string, prefix);
+    return code != NULL && post_retry_http_code(policy, atoi(code + strlen(prefix)));
+}
+
+/* internal helper function, faults containing fault_substring are retried
+ * like transient failures if it isn't NULL
+ */
+static xmlrpc_value *abrt_xmlrpc_call_params_internal(xmlrpc_env *env, struct abrt_xmlrpc *ax, const char *method, xmlrpc_value *params,
+                                                      const char *fault_substring)
 {
     xmlrpc_value *array = xmlrpc_array_new(env);
     if (env->fault_occurred)
@@ -183,16 +242,7 @@ static xmlrpc_value *abrt_xmlrpc_call_params_internal(xmlrpc_env *env, struct ab
     }
 
     if (xmlrpc_value_type(params) == XMLRPC_TYPE_STRUCT)
-    {
-        for (GList *iter = ax->ax_session_params; iter; iter = g_list_next(iter))
-        {
-            struct abrt_xmlrpc_param_pair *param_pair = (struct abrt_xmlrpc_param_pair *)iter->data;
-
-            xmlrpc_struct_set_value(env, params, param_pair->name, param_pair->value);
-            if (env->fault_occurred)
-                abrt_xmlrpc_die(env);
-        }
-    }
+        abrt_xmlrpc_params_add_session_params(env, ax, params);
     else
     {
         log_warning("Bug: not yet supported XML RPC call type.");
@@ -203,8 +253,23 @@ static xmlrpc_value *abrt_xmlrpc_call_params_internal(xmlrpc_env *env, struct ab
         abrt_xmlrpc_die(env);
 
     xmlrpc_value *result = NULL;
-    xmlrpc_client_call2(env, ax->ax_client, ax->ax_server_info, method,
-                        array, &result);
+    post_retry_t retry;
+    post_retry_start(&retry, NULL);
+    for (;;)
+    {
+        xmlrpc_client_call2(env, ax->ax_client, ax->ax_server_info, method,
+                            array, &result);
+        if (!env->fault_occurred)
+            break;
+
+        const bool transient = abrt_xmlrpc_fault_is_transient(env, retry.policy)
+            || (fault_substring && env->fault_string && strstr(env->fault_string, fault_substring));
+        if (!post_retry_next(&retry, transient, 0))
+            break;
+
+        xmlrpc_env_clean(env);
+        xmlrpc_env_init(env);
+    }
 
     if (destroy_params)
         xmlrpc_DECREF(params);
@@ -216,6 +281,7 @@ static xmlrpc_value *abrt_xmlrpc_call_params_internal(xmlrpc_env *env, struct ab
 /* internal helper function */
 static
 xmlrpc_value *abrt_xmlrpc_call_full_va(xmlrpc_env *env, struct abrt_xmlrpc *ax,
+                                       const char *fault_substring,
                                        const char *method, const char *format,
                                        va_list args)
 {
@@ -237,7 +303,7 @@ xmlrpc_value *abrt_xmlrpc_call_full_va(xmlrpc_env *env, struct abrt_xmlrpc *ax,
             suffix);
     }
     else
-        result = abrt_xmlrpc_call_params_internal(env, ax, method, param);
+        result = abrt_xmlrpc_call_params_internal(env, ax, method, param, fault_substring);
 
     xmlrpc_DECREF(param);
 
@@ -296,7 +362,7 @@ void abrt_xmlrpc_params_set_value(xmlrpc_env *env, xmlrpc_value *params, const c
 }
 xmlrpc_value *abrt_xmlrpc_call_params(xmlrpc_env *env, struct abrt_xmlrpc *ax, const char *method, xmlrpc_value *params)
 {
-    xmlrpc_value *result = abrt_xmlrpc_call_params_internal(env, ax, method, params);
+    xmlrpc_value *result = abrt_xmlrpc_call_params_internal(env, ax, method, params, /*fault_substring*/NULL);
 
     if (env->fault_occurred)
         abrt_xmlrpc_die(env);
@@ -309,12 +375,135 @@ xmlrpc_value *abrt_xmlrpc_call_full(xmlrpc_env *env, struct abrt_xmlrpc *ax,
 {
     va_list args;
     va_start(args, format);
-    xmlrpc_value *result = abrt_xmlrpc_call_full_va(env, ax, method, format, args);
+    xmlrpc_value *result = abrt_xmlrpc_call_full_va(env, ax, /*fault_substring*/NULL, method, format, args);
     va_end(args);
 
     return result;
 }
 
+/* Returns the serialized call of method with params, which are extended by the
+ * session params
+ */
+static char *abrt_xmlrpc_serialize_call(xmlrpc_env *env, struct abrt_xmlrpc *ax,
+                                        const char *method, xmlrpc_value *params)
+{
+    abrt_xmlrpc_params_add_session_params(env, ax, params);
+
+    xmlrpc_value *array = abrt_xmlrpc_array_new(env);
+    xmlrpc_array_append_item(env, array, params);
+    if (env->fault_occurred)
+        abrt_xmlrpc_die(env);
+
+    xmlrpc_mem_block *xml = XMLRPC_MEMBLOCK_NEW(char, env, 0);
+    if (env->fault_occurred)
+        abrt_xmlrpc_die(env);
+
+    xmlrpc_serialize_call(env, xml, method, array);
+    xmlrpc_DECREF(array);
+    if (env->fault_occurred)
+        abrt_xmlrpc_die(env);
+
+    char *call = g_strndup(XMLRPC_MEMBLOCK_CONTENTS(char, xml), XMLRPC_MEMBLOCK_SIZE(char, xml));
+    XMLRPC_MEMBLOCK_FREE(char, xml);
+
+    return call;
+}
+
+/* xmlrpc-c can send only values in memory, so the call is serialized with
+ * a placeholder string in place of the data and sent in parts around it.
+ *
+ * Returns false and sets the fault in env on errors.
+ */
+static bool abrt_xmlrpc_serialize_call_with_fd(xmlrpc_env *env, struct abrt_xmlrpc *ax,
+                                               const char *method, xmlrpc_value *params,
+                                               const char *name, char **prefix, char **suffix)
+{
+    g_autofree char *placeholder = g_strdup_printf("abrt-xmlrpc-data-%08x%08x", g_random_int(), g_random_int());
+    abrt_xmlrpc_params_set_value_str(env, params, name, placeholder);
+
+    g_autofree char *call = abrt_xmlrpc_serialize_call(env, ax, method, params);
+
+    g_autofree char *value = g_strdup_printf("<string>%s</string>", placeholder);
+    char *value_start = strstr(call, value);
+    if (value_start == NULL)
+    {
+        xmlrpc_env_set_fault(env, XMLRPC_INTERNAL_ERROR, "Can't find the attached data in the serialized call");
+        return false;
+    }
+    *value_start = '\0';
+
+    *prefix = g_strconcat(call, "<base64>", NULL);
+    *suffix = g_strconcat("</base64>", value_start + strlen(value), NULL);
+    return true;
+}
+
+/* The state of a call sent without xmlrpc-c, authorization is the header
+ * xmlrpc-c sends. Faults containing fault_substring are retried like transient
+ * failures if it isn't NULL.
+ */
+static post_state_t *abrt_xmlrpc_new_post_state(struct abrt_xmlrpc *ax, const char *fault_substring,
+                                                char **authorization)
+{
+    *authorization = NULL;
+    if (ax->ax_api_key)
+        *authorization = g_strdup_printf("Authorization: Bearer %s", ax->ax_api_key);
+
+    post_state_t *state = new_post_state(POST_WANT_BODY | POST_WANT_ERROR_MSG
+                                         | (ax->ax_ssl_verify ? POST_WANT_SSL_VERIFY : 0));
+    state->retry_body_substring = fault_substring;
+    return state;
+}
+
+static xmlrpc_value *abrt_xmlrpc_parse_post_response(xmlrpc_env *env, post_state_t *state)
+{
+    xmlrpc_value *result = NULL;
+    if (state->curl_result != 0)
+    {
+        xmlrpc_env_set_fault_formatted(env, XMLRPC_NETWORK_ERROR, "Can't send the call: %s",
+                                       state->curl_error_msg ? state->curl_error_msg : "unknown error");
+    }
+    else if (state->http_resp_code != 200)
+    {
+        xmlrpc_env_set_fault_formatted(env, XMLRPC_NETWORK_ERROR, "HTTP response code is %d, not 200",
+                                       state->http_resp_code);
+    }
+    else
+    {
+        int fault_code = 0;
+        const char *fault_string = NULL;
+        xmlrpc_parse_response2(env, state->body, state->body_size, &result, &fault_code, &fault_string);
+        if (!env->fault_occurred && fault_string)
+        {
+            xmlrpc_env_set_fault(env, fault_code, fault_string);
+            xmlrpc_strfree(fault_string);
+        }
+    }
+
+    return result;
+}
+
+xmlrpc_value *abrt_xmlrpc_call_with_fd(xmlrpc_env *env, struct abrt_xmlrpc *ax,
+                                       const char *method, xmlrpc_value *params,
+                                       const char *name, int fd,
+                                       const char *fault_substring)
+{
+    xmlrpc_env_init(env);
+
+    g_autofree char *prefix = NULL;
+    g_autofree char *suffix = NULL;
+    if (!abrt_xmlrpc_serialize_call_with_fd(env, ax, method, params, name, &prefix, &suffix))
+        return NULL;
+
+    g_autofree char *authorization = NULL;
+    post_state_t *state = abrt_xmlrpc_new_post_state(ax, fault_substring, &authorization);
+    const char *headers[] = { authorization, NULL };
+    post_base64_fd(state, ax->ax_url, "text/xml", headers, prefix, fd, suffix);
+
+    xmlrpc_value *result = abrt_xmlrpc_parse_post_response(env, state);
+    free_post_state(state);
+    return result;
+}
+
 /* die or return expected results */
 xmlrpc_value *abrt_xmlrpc_call(struct abrt_xmlrpc *ax,
                                const char *method, const char *format, ...)
@@ -323,7 +512,7 @@ xmlrpc_value *abrt_xmlrpc_call(struct abrt_xmlrpc *ax,
 
     va_list args;
     va_start(args, format);
-    xmlrpc_value *result = abrt_xmlrpc_call_full_va(&env, ax, method, format, args);
+    xmlrpc_value *result = abrt_xmlrpc_call_full_va(&env, ax, /*fault_substring*/NULL, method, format, args);
     va_end(args);
 
     if (env.fault_occurred)
@@ -332,35 +521,22 @@ xmlrpc_value *abrt_xmlrpc_call(struct abrt_xmlrpc *ax,
     return result;
 }
 
-/* die eventually or return expected results; retry up to 5 times if the error is known */
+/* die or return expected results; faults containing fault_substring are
+ * retried like transient failures */
 xmlrpc_value *abrt_xmlrpc_call_with_retry(const char *fault_substring,
                                           struct abrt_xmlrpc *ax,
                                           const char *method,
                                           const char *format, ...)
 {
-    int retry_counter = 0;
     xmlrpc_env env;
 
     va_list args;
+    va_start(args, format);
+    xmlrpc_value *result = abrt_xmlrpc_call_full_va(&env, ax, fault_substring, method, format, args);
+    va_end(args);
 
-    do {
-        // sleep, if this is not the first try;
-        // sleep() can be interrupted, but that's not a big deal here
-        if (retry_counter)
-            sleep(retry_counter);
-
-        va_start(args, format);
-        xmlrpc_value *result = abrt_xmlrpc_call_full_va(&env, ax, method, format, args);
-        va_end(args);
-
-        if (!env.fault_occurred)
-            return result;  // success!
-
-        if (env.fault_string && !strstr(env.fault_string, fault_substring)) {
-            // unknown error, don't bother retrying...
-            abrt_xmlrpc_die(&env);
-        }
-    } while (++retry_counter <= 5);
+    if (env.fault_occurred)
+        abrt_xmlrpc_die(&env);
 
-    abrt_xmlrpc_die(&env);
+    return result;
 }
@@ -38,6 +38,10 @@ struct abrt_xmlrpc {
     xmlrpc_server_info *ax_server_info;
     GList *ax_session_params;
     const char *libreport_user_agent;
+    /* For requests sent without xmlrpc-c */
+    char *ax_url;
+    int ax_ssl_verify;
+    char *ax_api_key;
 };
 
 xmlrpc_value *abrt_xmlrpc_array_new(xmlrpc_env *env);
@@ -52,6 +56,8 @@ struct abrt_xmlrpc *abrt_xmlrpc_new_client(const char *url, int ssl_verify);
 struct abrt_xmlrpc *abrt_xmlrpc_new_redhat_client(const char *url, int ssl_verify, const char *api_key);
 void abrt_xmlrpc_free_client(struct abrt_xmlrpc *ax);
 void abrt_xmlrpc_client_add_session_param_string(xmlrpc_env *env, struct abrt_xmlrpc *ax, const char *name, const char *value);
+/* Returns a malloced value of the session parameter or NULL */
+char *abrt_xmlrpc_client_get_session_param_string(struct abrt_xmlrpc *ax, const char *name);
 void abrt_xmlrpc_die(xmlrpc_env *env) __attribute__((noreturn));
 void abrt_xmlrpc_error(xmlrpc_env *env);
 
@@ -65,6 +71,20 @@ xmlrpc_value *abrt_xmlrpc_call_params(xmlrpc_env *env, struct abrt_xmlrpc *ax,
 xmlrpc_value *abrt_xmlrpc_call_full(xmlrpc_env *enf, struct abrt_xmlrpc *ax,
                                    const char *method, const char *format, ...);
 
+/* Like abrt_xmlrpc_call_params(), but the member name of params is set to the
+ * content of the regular file fd in base64. The content is encoded while it is
+ * being sent, so it is never in memory as a whole. Faults containing
+ * fault_substring are retried like transient failures if it isn't NULL.
+ * Returns NULL and sets the fault in env on errors.
+ */
+xmlrpc_value *abrt_xmlrpc_call_with_fd(xmlrpc_env *env, struct abrt_xmlrpc *ax,
+                                       const char *method, xmlrpc_value *params,
+                                       const char *name, int fd,
+                                       const char *fault_substring);
+
+/* die or return expected results, faults containing fault_substring are
+ * retried like transient failures
+ */
 xmlrpc_value *abrt_xmlrpc_call_with_retry(const char *fault_substring,
                                           struct abrt_xmlrpc *ax,
                                           const char *method,
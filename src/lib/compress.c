@@ -20,14 +20,110 @@
 
 #include <archive.h>
 
+/* libarchive reads the compressed input in chunks of this size */
+#define INPUT_BUFFER_SIZE (1024 * 1024)
+
+struct decompress_output
+{
+    int fd;
+    /* Blocks of zeros are skipped instead of written */
+    bool sparse;
+    /* Bytes of decompressed data */
+    off_t size;
+    /* Bytes of zeros skipped since the last write */
+    off_t hole;
+};
+
+/* Seeking creates holes only in a regular file which is not opened for
+ * appending and has no data past the current offset.
+ */
+static bool can_write_sparse(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+
+    const int fl = fcntl(fd, F_GETFL);
+    if (fl < 0 || (fl & O_APPEND))
+        return false;
+
+    const off_t offset = lseek(fd, 0, SEEK_CUR);
+    return offset >= 0 && offset >= st.st_size;
+}
+
+static int write_decompressed(struct decompress_output *out, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        /* Blocks are aligned to the output offset, skipped blocks become holes */
+        size_t len = MIN(size, LIBREPORT_SPARSE_BLOCK_SIZE - out->size % LIBREPORT_SPARSE_BLOCK_SIZE);
+        const bool zeros = out->sparse && libreport_is_zero_block(data, len);
+        while (len < size)
+        {
+            const size_t block = MIN(size - len, LIBREPORT_SPARSE_BLOCK_SIZE);
+            if (zeros != (out->sparse && libreport_is_zero_block(data + len, block)))
+                break;
+            len += block;
+        }
+
+        if (zeros)
+            out->hole += len;
+        else
+        {
+            if (out->hole > 0 && lseek(out->fd, out->hole, SEEK_CUR) < 0)
+            {
+                perror_msg("Failed to write out decompressed data");
+                return -1;
+            }
+            out->hole = 0;
+
+            if (libreport_full_write(out->fd, data, len) != (ssize_t)len)
+            {
+                perror_msg("Failed to write out decompressed data");
+                return -1;
+            }
+        }
+
+        out->size += len;
+        data += len;
+        size -= len;
+    }
+
+    return 0;
+}
+
+/* Extends the file over the trailing hole */
+static int finish_decompressed(struct decompress_output *out)
+{
+    if (out->hole == 0)
+        return 0;
+
+    const off_t end = lseek(out->fd, out->hole, SEEK_CUR);
+    if (end < 0 || ftruncate(out->fd, end) != 0)
+    {
+        perror_msg("Failed to write out decompressed data");
+        return -1;
+    }
+
+    return 0;
+}
+
 int libreport_decompress_fd(int fdi, int fdo)
 {
-#define kiB * 1024
-#define BUFFER_SIZE 16 kiB
+    return libreport_decompress_fd_ext(fdi, fdo, -1);
+}
+
+int libreport_decompress_fd_ext(int fdi, int fdo, off_t size)
+{
     int retval;
     struct archive *archive;
     struct archive_entry *entry;
     int r;
+    struct decompress_output out = {
+        .fd = fdo,
+        .sparse = can_write_sparse(fdo),
+    };
+    const gint64 start = g_get_monotonic_time();
 
     retval = 0;
     archive = archive_read_new();
@@ -35,7 +131,9 @@ int libreport_decompress_fd(int fdi, int fdo)
     archive_read_support_filter_all(archive);
     archive_read_support_format_raw(archive);
 
-    r = archive_read_open_fd(archive, fdi, BUFFER_SIZE);
+    posix_fadvise(fdi, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    r = archive_read_open_fd(archive, fdi, INPUT_BUFFER_SIZE);
     if (r != ARCHIVE_OK)
     {
         const char *error_string;
@@ -64,11 +162,17 @@ int libreport_decompress_fd(int fdi, int fdo)
 
     for (; ; )
     {
-        uint8_t buffer[BUFFER_SIZE] = { 0 };
-        ssize_t size;
+        /* The data are written directly from the buffers of the decompressor */
+        const void *buffer;
+        size_t block_size;
+        la_int64_t offset;
 
-        size = archive_read_data(archive, buffer, sizeof(buffer));
-        if (size < 0)
+        r = archive_read_data_block(archive, &buffer, &block_size, &offset);
+        if (r == ARCHIVE_EOF)
+        {
+            break;
+        }
+        if (r < ARCHIVE_OK)
         {
             const char *error_string;
 
@@ -80,19 +184,94 @@ int libreport_decompress_fd(int fdi, int fdo)
 
             break;
         }
-        if (size == 0)
+
+        if (size >= 0 && (off_t)block_size > size - out.size)
         {
+            log_error("Decompressed data are larger than %llu Bytes", (unsigned long long)size);
+
+            retval = -1;
+
             break;
         }
 
-        if (libreport_safe_write(fdo, buffer, size) < 0)
+        if (write_decompressed(&out, buffer, block_size) != 0)
         {
             retval = -1;
 
-            log_error("Failed to write out decompressed data");
+            break;
+        }
+    }
+
+    if (retval == 0 && size >= 0 && out.size != size)
+    {
+        log_error("Decompressed %llu Bytes instead of %llu", (unsigned long long)out.size,
+                  (unsigned long long)size);
+
+        retval = -1;
+    }
+
+    if (retval == 0)
+    {
+        retval = finish_decompressed(&out);
+    }
+
+    if (retval == 0)
+    {
+        const double secs = (g_get_monotonic_time() - start) / (double)G_USEC_PER_SEC;
+
+        log_info("Decompressed %llu kB in %.2f s (%.1f MB/s)",
+                 (unsigned long long)out.size / 1024, secs,
+                 secs > 0 ? out.size / secs / (1024 * 1024) : 0.0);
+    }
+
+cleanup:
+    archive_read_free(archive);
+
+    return retval;
+}
+
+/* Enough compressed input for the head of a file, the block size of the
+ * input buffer limits the read-ahead.
+ */
+#define HEAD_INPUT_BUFFER_SIZE (64 * 1024)
+
+ssize_t libreport_decompress_head(int fdi, void *buf, size_t size)
+{
+    struct archive *archive;
+    struct archive_entry *entry;
+    ssize_t retval = -1;
+
+    archive = archive_read_new();
+
+    archive_read_support_filter_all(archive);
+    archive_read_support_format_raw(archive);
+
+    if (archive_read_open_fd(archive, fdi, HEAD_INPUT_BUFFER_SIZE) != ARCHIVE_OK
+        || archive_read_next_header(archive, &entry) != ARCHIVE_OK)
+    {
+        log_error("Reading archive failed: %s", archive_error_string(archive));
+
+        goto cleanup;
+    }
+
+    retval = 0;
+    while ((size_t)retval < size)
+    {
+        const la_ssize_t r = archive_read_data(archive, (char *)buf + retval, size - retval);
+        if (r == 0)
+        {
+            break;
+        }
+        if (r < 0)
+        {
+            log_error("Reading compressed data failed: %s", archive_error_string(archive));
+
+            retval = -1;
 
             break;
         }
+
+        retval += r;
     }
 
 cleanup:
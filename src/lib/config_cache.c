@@ -0,0 +1,311 @@
+/*
+    Copyright (C) 2024  ABRT Team
+    Copyright (C) 2024  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* Persistent cache of parsed configuration
+ *
+ * Parsing the event rules and the event definitions is the bulk of the start
+ * up time of the reporting tools. The parsed data are stored in serialized
+ * GVariants in $XDG_CACHE_HOME/libreport/, the files are mapped on load, so a
+ * warm start reads only the pages it needs.
+ *
+ * Every cache file carries a manifest of the files and directories the data
+ * were loaded from. A cache is used only if none of them changed since.
+ *
+ * Nothing is persisted for root and the other system users unless
+ * $XDG_CACHE_HOME is set, they don't have a cache directory of their own and
+ * a cache in e.g. /root/.cache or in the home of a daemon would be left
+ * behind by services and shared by unrelated processes. The same holds for
+ * processes without a real $HOME, i.e. an absolute path to a directory owned
+ * by the user, and for set-user-ID processes. The data are simply parsed
+ * again in all these cases.
+ */
+#include "internal_libreport.h"
+
+#ifndef VERSION
+# define VERSION ""
+#endif
+
+/* Bump when the layout of any payload changes */
+#define CONFIG_CACHE_FORMAT 1
+
+/* format, libreport version, key, manifest, payload */
+#define CONFIG_CACHE_TYPE "(ussa(sbttxxx)v)"
+
+static void free_config_source(void *ptr)
+{
+    struct libreport_config_source *source = ptr;
+    g_free(source->path);
+    g_free(source);
+}
+
+static void stat_config_source(struct libreport_config_source *source)
+{
+    struct stat st;
+    source->exists = stat(source->path, &st) == 0;
+    if (!source->exists)
+        return;
+
+    source->dev = st.st_dev;
+    source->ino = st.st_ino;
+    source->size = st.st_size;
+    source->mtime = st.st_mtim;
+}
+
+GPtrArray *libreport_new_config_sources(void)
+{
+    return g_ptr_array_new_with_free_func(free_config_source);
+}
+
+void libreport_add_config_source(GPtrArray *sources, const char *path)
+{
+    if (sources == NULL)
+        return;
+
+    struct libreport_config_source *source = g_new0(struct libreport_config_source, 1);
+    source->path = g_strdup(path);
+    stat_config_source(source);
+    g_ptr_array_add(sources, source);
+}
+
+static bool config_source_changed(const struct libreport_config_source *source)
+{
+    struct libreport_config_source current = { .path = source->path };
+    stat_config_source(&current);
+
+    if (current.exists != source->exists)
+        return true;
+
+    return current.exists
+        && (current.dev != source->dev
+         || current.ino != source->ino
+         || current.size != source->size
+         || current.mtime.tv_sec != source->mtime.tv_sec
+         || current.mtime.tv_nsec != source->mtime.tv_nsec);
+}
+
+bool libreport_config_sources_changed(GPtrArray *sources)
+{
+    for (unsigned i = 0; i < sources->len; ++i)
+    {
+        const struct libreport_config_source *source = g_ptr_array_index(sources, i);
+        if (config_source_changed(source))
+        {
+            log_info("'%s' changed", source->path);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Returns NULL if the cache must not be persisted, see the top of the file */
+static char *config_cache_path(const char *name)
+{
+    if (getuid() != geteuid())
+        return NULL;
+
+    const char *cache_home = getenv("XDG_CACHE_HOME");
+    if (cache_home != NULL && g_path_is_absolute(cache_home))
+        return g_build_filename(cache_home, "libreport", name, NULL);
+
+    if (geteuid() == 0)
+        return NULL;
+
+    const char *home = getenv("HOME");
+    struct stat st;
+    if (home == NULL || !g_path_is_absolute(home)
+        || stat(home, &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != geteuid())
+    {
+        log_debug("Not caching configuration, $HOME is not a directory of the user");
+        return NULL;
+    }
+
+    return g_build_filename(home, ".cache", "libreport", name, NULL);
+}
+
+/* The cached data are trusted as much as the configuration, so the file
+ * must not be writable by anybody else.
+ */
+static GMappedFile *map_config_cache(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0)
+    {
+        if (errno != ENOENT)
+            perror_msg("Can't open '%s'", path);
+        return NULL;
+    }
+
+    GMappedFile *mapped = NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        perror_msg("Can't stat '%s'", path);
+    else if (!S_ISREG(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)))
+        log_notice("Ignoring '%s', it is not a private file", path);
+    else
+    {
+        g_autoptr(GError) error = NULL;
+        mapped = g_mapped_file_new_from_fd(fd, /*writable*/FALSE, &error);
+        if (mapped == NULL)
+            error_msg("Can't map '%s': %s", path, error->message);
+    }
+
+    close(fd);
+    return mapped;
+}
+
+GVariant *libreport_load_config_cache(const char *name, const char *key,
+        const GVariantType *type, GPtrArray **sources)
+{
+    g_autofree char *path = config_cache_path(name);
+    if (path == NULL)
+        return NULL;
+
+    GMappedFile *mapped = map_config_cache(path);
+    if (mapped == NULL)
+        return NULL;
+
+    GBytes *bytes = g_mapped_file_get_bytes(mapped);
+    g_mapped_file_unref(mapped);
+
+    /* Trusted is FALSE, serialized data of a wrong shape are safely read
+     * as default values.
+     */
+    GVariant *cache = g_variant_new_from_bytes(G_VARIANT_TYPE(CONFIG_CACHE_TYPE), bytes, /*trusted*/FALSE);
+    g_variant_ref_sink(cache);
+    g_bytes_unref(bytes);
+
+    guint32 format;
+    const char *version;
+    const char *cache_key;
+    GVariantIter *manifest;
+    GVariant *payload;
+    g_variant_get(cache, "(u&s&sa(sbttxxx)v)", &format, &version, &cache_key, &manifest, &payload);
+
+    GPtrArray *cached_sources = libreport_new_config_sources();
+    const char *source_path;
+    gboolean exists;
+    guint64 dev, ino;
+    gint64 size, mtime_sec, mtime_nsec;
+    while (g_variant_iter_next(manifest, "(&sbttxxx)", &source_path, &exists, &dev, &ino, &size, &mtime_sec, &mtime_nsec))
+    {
+        struct libreport_config_source *source = g_new0(struct libreport_config_source, 1);
+        source->path = g_strdup(source_path);
+        source->exists = exists;
+        source->dev = dev;
+        source->ino = ino;
+        source->size = size;
+        source->mtime.tv_sec = mtime_sec;
+        source->mtime.tv_nsec = mtime_nsec;
+        g_ptr_array_add(cached_sources, source);
+    }
+    g_variant_iter_free(manifest);
+
+    const bool valid = format == CONFIG_CACHE_FORMAT
+                    && strcmp(version, VERSION) == 0
+                    && strcmp(cache_key, key) == 0
+                    && g_variant_is_of_type(payload, type)
+                    && !libreport_config_sources_changed(cached_sources);
+    g_variant_unref(cache);
+
+    if (!valid)
+    {
+        log_info("Cache '%s' is out of date", path);
+        g_variant_unref(payload);
+        g_ptr_array_free(cached_sources, TRUE);
+        return NULL;
+    }
+
+    log_debug("Using cache '%s'", path);
+    *sources = cached_sources;
+    return payload;
+}
+
+void libreport_save_config_cache(const char *name, const char *key,
+        GPtrArray *sources, GVariant *payload)
+{
+    g_autofree char *path = config_cache_path(name);
+    if (path == NULL)
+    {
+        g_variant_unref(g_variant_ref_sink(payload));
+        return;
+    }
+
+    GVariantBuilder manifest;
+    g_variant_builder_init(&manifest, G_VARIANT_TYPE("a(sbttxxx)"));
+    for (unsigned i = 0; i < sources->len; ++i)
+    {
+        const struct libreport_config_source *source = g_ptr_array_index(sources, i);
+        g_variant_builder_add(&manifest, "(sbttxxx)", source->path, (gboolean)source->exists,
+                (guint64)source->dev, (guint64)source->ino, (gint64)source->size,
+                (gint64)source->mtime.tv_sec, (gint64)source->mtime.tv_nsec);
+    }
+
+    GVariant *cache = g_variant_new("(ussa(sbttxxx)v)", CONFIG_CACHE_FORMAT, VERSION, key, &manifest, payload);
+    g_variant_ref_sink(cache);
+
+    g_autofree char *dir = g_path_get_dirname(path);
+    g_autofree char *tmp_path = g_strdup_printf("%s.XXXXXX", path);
+
+    if (g_mkdir_with_parents(dir, 0700) != 0)
+    {
+        log_info("Can't create '%s': %s", dir, strerror(errno));
+        goto finito;
+    }
+
+    /* Written aside and renamed, readers see either the old or the new file */
+    int fd = g_mkstemp_full(tmp_path, O_RDWR | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        log_info("Can't create '%s': %s", tmp_path, strerror(errno));
+        goto finito;
+    }
+
+    const gsize size = g_variant_get_size(cache);
+    const bool written = libreport_full_write(fd, g_variant_get_data(cache), size) == (ssize_t)size;
+    if (close(fd) != 0 || !written)
+    {
+        log_info("Can't write '%s': %s", tmp_path, strerror(errno));
+        unlink(tmp_path);
+        goto finito;
+    }
+
+    if (rename(tmp_path, path) != 0)
+    {
+        log_info("Can't rename '%s' to '%s': %s", tmp_path, path, strerror(errno));
+        unlink(tmp_path);
+    }
+    else
+        log_debug("Saved cache '%s'", path);
+
+ finito:
+    g_variant_unref(cache);
+}
+
+void libreport_remove_config_cache(const char *name)
+{
+    g_autofree char *path = config_cache_path(name);
+    if (path == NULL)
+        return;
+
+    if (unlink(path) != 0 && errno != ENOENT)
+        log_info("Can't remove '%s': %s", path, strerror(errno));
+    else
+        log_debug("Removed cache '%s'", path);
+}
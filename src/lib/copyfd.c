@@ -23,20 +23,192 @@
  */
 #include "internal_libreport.h"
 
-#define CONFIG_FEATURE_COPYBUF_KB 4
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+
+/* Large enough to make the per-call overhead negligible */
+#define CONFIG_FEATURE_COPYBUF_KB 128
+
+/* Upper limit of a single splice() or copy_file_range() call */
+#define KERNEL_COPY_CHUNK (16 * 1024 * 1024)
 
 static const char msg_write_error[] = "write error";
 static const char msg_read_error[] = "read error";
 
+bool libreport_is_zero_block(const char *buffer, size_t size)
+{
+	return size == 0 || (buffer[0] == 0 && memcmp(buffer, buffer + 1, size - 1) == 0);
+}
+
+/* Writes the buffer, skipping blocks of zeros in COPYFD_SPARSE mode.
+ * Returns 0 on success.
+ */
+static int write_buffer(int dst_fd, const char *buffer, size_t size, int *flags, int *last_was_seek)
+{
+	while (size > 0) {
+		size_t towrite = size;
+		if (*flags & COPYFD_SPARSE) {
+			size_t zeros = 0;
+			while (zeros < size) {
+				size_t block = MIN(size - zeros, LIBREPORT_SPARSE_BLOCK_SIZE);
+				if (!libreport_is_zero_block(buffer + zeros, block))
+					break;
+				zeros += block;
+			}
+			if (zeros > 0) {
+				if (lseek(dst_fd, zeros, SEEK_CUR) >= 0) {
+					*last_was_seek = 1;
+					buffer += zeros;
+					size -= zeros;
+					continue;
+				}
+				*flags &= ~COPYFD_SPARSE;
+			} else {
+				/* Write up to the next block of zeros */
+				towrite = MIN(size, LIBREPORT_SPARSE_BLOCK_SIZE);
+				while (towrite < size) {
+					size_t block = MIN(size - towrite, LIBREPORT_SPARSE_BLOCK_SIZE);
+					if (libreport_is_zero_block(buffer + towrite, block))
+						break;
+					towrite += block;
+				}
+			}
+		}
+
+		if (libreport_full_write(dst_fd, buffer, towrite) < (ssize_t)towrite) {
+			perror_msg("%s", msg_write_error);
+			return -1;
+		}
+		*last_was_seek = 0;
+		buffer += towrite;
+		size -= towrite;
+	}
+	return 0;
+}
+
+/* Moves data from a regular file by copy_file_range(), which lets
+ * the file system share or copy the extents without passing the data
+ * through user space. In COPYFD_SPARSE mode, holes of the source are
+ * found by SEEK_DATA/SEEK_HOLE and skipped in the destination.
+ */
+static void copy_file_in_kernel(int src_fd, int dst_fd, off_t limit, int flags,
+		off_t *copied, int *last_was_seek)
+{
+	off_t pos = lseek(src_fd, 0, SEEK_CUR);
+	if (pos < 0)
+		return;
+
+	while (limit < 0 || *copied < limit) {
+		off_t data_end = -1;
+		if (flags & COPYFD_SPARSE) {
+			off_t data = lseek(src_fd, pos, SEEK_DATA);
+			if (data < 0 && errno == ENXIO)
+				/* Only a hole up to the end of the file */
+				data = data_end = lseek(src_fd, 0, SEEK_END);
+			else if (data >= 0)
+				data_end = lseek(src_fd, data, SEEK_HOLE);
+			if (data < 0 || data_end < 0) {
+				/* The holes can't be found, the caller scans for them */
+				lseek(src_fd, pos, SEEK_SET);
+				break;
+			}
+			if (limit >= 0)
+				data = MIN(data, pos + (limit - *copied));
+			if (data > pos) {
+				if (lseek(dst_fd, data - pos, SEEK_CUR) < 0) {
+					lseek(src_fd, pos, SEEK_SET);
+					break;
+				}
+				*last_was_seek = 1;
+				*copied += data - pos;
+				pos = data;
+			}
+			lseek(src_fd, pos, SEEK_SET);
+			if (pos == data_end)
+				/* EOF */
+				break;
+		}
+
+		size_t chunk = KERNEL_COPY_CHUNK;
+		if (limit >= 0)
+			chunk = MIN(chunk, limit - *copied);
+		if (data_end >= 0)
+			chunk = MIN(chunk, data_end - pos);
+		if (chunk == 0)
+			continue;
+
+		ssize_t r = copy_file_range(src_fd, NULL, dst_fd, NULL, chunk, 0);
+		if (r <= 0)
+			/* EOF, or not supported for these files (EXDEV, EINVAL, ...).
+			 * Errors are reported by read() or write() of the caller.
+			 */
+			break;
+		*last_was_seek = 0;
+		*copied += r;
+		pos += r;
+	}
+}
+
+/* Moves data from a pipe to the destination by splice(), without copying
+ * them to user space.
+ */
+static void splice_in_kernel(int src_fd, int dst_fd, off_t limit, off_t *copied)
+{
+	while (limit < 0 || *copied < limit) {
+		size_t chunk = KERNEL_COPY_CHUNK;
+		if (limit >= 0)
+			chunk = MIN(chunk, limit - *copied);
+
+		ssize_t r = splice(src_fd, NULL, dst_fd, NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			/* EOF or not supported, the caller finds out */
+			break;
+		*copied += r;
+	}
+}
+
+/* Copies as much as possible in kernel: clones the whole file if the file
+ * system supports reflinks, or moves the data by copy_file_range() or
+ * splice(). Returns the number of bytes consumed from src_fd, which
+ * includes skipped holes. The rest is left to read() and write().
+ */
+static off_t copy_in_kernel(int src_fd, int dst_fd, off_t limit, int flags, int *last_was_seek)
+{
+	struct stat src_st, dst_st;
+	if (fstat(src_fd, &src_st) != 0 || fstat(dst_fd, &dst_st) != 0)
+		return 0;
+
+	off_t copied = 0;
+	if (S_ISREG(src_st.st_mode) && S_ISREG(dst_st.st_mode)) {
+		/* A clone copies all the file, holes included */
+		if (limit < 0
+		 && dst_st.st_size == 0
+		 && lseek(src_fd, 0, SEEK_CUR) == 0
+		 && lseek(dst_fd, 0, SEEK_CUR) == 0
+		 && ioctl(dst_fd, FICLONE, src_fd) == 0
+		) {
+			lseek(src_fd, src_st.st_size, SEEK_SET);
+			lseek(dst_fd, src_st.st_size, SEEK_SET);
+			return src_st.st_size;
+		}
+		copy_file_in_kernel(src_fd, dst_fd, limit, flags, &copied, last_was_seek);
+	}
+	/* Zeros in a pipe can only be found by reading */
+	else if (S_ISFIFO(src_st.st_mode) && !(flags & COPYFD_SPARSE))
+		splice_in_kernel(src_fd, dst_fd, limit, &copied);
+
+	return copied;
+}
+
 static off_t full_fd_action(int src_fd, int dst_fd, off_t size, int flags)
 {
 	int status = -1;
 	off_t total = 0;
 	int last_was_seek = 0;
-#if CONFIG_FEATURE_COPYBUF_KB <= 4
-	char buffer[CONFIG_FEATURE_COPYBUF_KB * 1024];
-	enum { buffer_size = sizeof(buffer) };
-#else
+	/* copy until eof if size is 0 */
+	const bool till_eof = !size;
 	char *buffer;
 	int buffer_size;
 
@@ -51,30 +223,26 @@ static off_t full_fd_action(int src_fd, int dst_fd, off_t size, int flags)
 		buffer = alloca(4 * 1024);
 		buffer_size = 4 * 1024;
 	}
-#endif
 
 	if (src_fd < 0)
 		goto out;
 
-	if (!size) {
-		size = buffer_size;
-		status = 1; /* copy until eof */
+	/* dst_fd == -1 is a fake, the data are only counted */
+	if (dst_fd >= 0) {
+		total = copy_in_kernel(src_fd, dst_fd, till_eof ? -1 : size, flags, &last_was_seek);
+		size -= total;
 	}
 
+	/* The rest, or everything the kernel could not do. The last read
+	 * either finds EOF, or more data than the size, which the caller
+	 * detects by the return value being greater than the size.
+	 */
 	while (1) {
 		ssize_t rd, towrite;
 
 		rd = libreport_safe_read(src_fd, buffer, buffer_size);
 
 		if (!rd) { /* eof - all done */
-			if (last_was_seek) {
-				if (lseek(dst_fd, -1, SEEK_CUR) < 0
-				 || libreport_safe_write(dst_fd, "", 1) != 1
-				) {
-					perror_msg("%s", msg_write_error);
-					break;
-				}
-			}
 			status = 0;
 			break;
 		}
@@ -85,46 +253,32 @@ static off_t full_fd_action(int src_fd, int dst_fd, off_t size, int flags)
 		/* Add read Bytes before quiting the loop, because the caller
 		 * needs to be able to detect overflows (the return value > size). */
 		total += rd;
-		towrite = rd > size ? size : rd;
+		towrite = till_eof || rd < size ? rd : size;
 		if (towrite == 0) {
 			/* no more Bytes to write - all done */
 			status = 0;
 			break;
 		}
-		/* dst_fd == -1 is a fake, else... */
-		if (dst_fd >= 0) {
-			if (flags & COPYFD_SPARSE) {
-				ssize_t cnt = towrite;
-				while (--cnt >= 0)
-					if (buffer[cnt] != 0)
-						goto need2write;
-				if (lseek(dst_fd, towrite, SEEK_CUR) < 0) {
-					flags &= ~COPYFD_SPARSE;
-					goto need2write;
-				}
-				last_was_seek = 1;
-			} else {
- need2write:
-				{
-				    ssize_t wr = libreport_full_write(dst_fd, buffer, towrite);
-				    if (wr < towrite) {
-				        perror_msg("%s", msg_write_error);
-				        break;
-				    }
-				    last_was_seek = 0;
-				}
-			}
-		}
-		if (status < 0) { /* if we aren't copying till EOF... */
+		if (dst_fd >= 0 && write_buffer(dst_fd, buffer, towrite, &flags, &last_was_seek) != 0)
+			break;
+		if (!till_eof) { /* if we aren't copying till EOF... */
 			size -= towrite;
 		}
 	}
+
+	/* Extend the file over the trailing hole */
+	if (status == 0 && last_was_seek) {
+		if (lseek(dst_fd, -1, SEEK_CUR) < 0
+		 || libreport_safe_write(dst_fd, "", 1) != 1
+		) {
+			perror_msg("%s", msg_write_error);
+			status = -1;
+		}
+	}
  out:
 
-#if CONFIG_FEATURE_COPYBUF_KB > 4
 	if (buffer_size != 4 * 1024)
 		munmap(buffer, buffer_size);
-#endif
 	return status ? -1 : total;
 }
 
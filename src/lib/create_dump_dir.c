@@ -170,11 +170,22 @@ int save_problem_data_in_dump_dir(struct dump_dir *dd, problem_data_t *problem_d
 
         if (value->flags & CD_FLAG_BIN)
         {
-            dd_copy_file(dd, name, value->content);
+            /* Compressed elements are copied decompressed, the mark of
+             * the compression stays with the source file.
+             */
+            const int fd = problem_item_open_file(value);
+            if (fd < 0)
+            {
+                errno = -fd;
+                perror_msg("Can't open '%s'", value->content);
+                continue;
+            }
+            dd_copy_fd(dd, name, fd, /*copy_flags*/0, /*maxsize*/0);
+            close(fd);
             continue;
         }
 
-        dd_save_text(dd, name, value->content);
+        dd_save_text(dd, name, problem_item_get_content(value));
     }
 
     return 0;
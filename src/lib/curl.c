@@ -107,6 +107,275 @@ CURLcode curl_easy_perform_with_proxy(CURL *handle, const char *url)
     return curl_err;
 }
 
+/*
+ * Connection reuse
+ *
+ * Easy handles keep their connections open after a request. Idle handles are
+ * kept per origin (scheme://[userinfo@]host[:port]), so the next request to
+ * the same server reuses the connection instead of paying for the TCP and TLS
+ * handshakes again. All handles share the DNS cache and TLS sessions.
+ */
+
+/* Enough for sequential requests, more parallel ones are not expected */
+#define MAX_IDLE_HANDLES_PER_ORIGIN 4
+
+static GMutex connection_pool_lock;
+/* origin -> GSList of idle CURL handles */
+static GHashTable *connection_pool;
+static CURLSH *connection_share;
+static GMutex connection_share_locks[CURL_LOCK_DATA_LAST];
+
+static void lock_connection_share(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr)
+{
+    g_mutex_lock(&connection_share_locks[data]);
+}
+
+static void unlock_connection_share(CURL *handle, curl_lock_data data, void *userptr)
+{
+    g_mutex_unlock(&connection_share_locks[data]);
+}
+
+/* Must be called with connection_pool_lock held */
+static CURLSH *get_connection_share(void)
+{
+    if (connection_share != NULL)
+        return connection_share;
+
+    connection_share = curl_share_init();
+    if (connection_share == NULL)
+        return NULL;
+
+    curl_share_setopt(connection_share, CURLSHOPT_LOCKFUNC, lock_connection_share);
+    curl_share_setopt(connection_share, CURLSHOPT_UNLOCKFUNC, unlock_connection_share);
+    curl_share_setopt(connection_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(connection_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+    return connection_share;
+}
+
+static char *url_origin(const char *url)
+{
+    const char *authority = strstr(url, "://");
+    if (authority == NULL)
+        return NULL;
+
+    authority += strlen("://");
+    return g_strndup(url, authority - url + strcspn(authority, "/?#"));
+}
+
+/* Returns an idle handle connected to the origin or a new one */
+static CURL *acquire_curl_handle(const char *origin)
+{
+    CURL *handle = NULL;
+
+    g_mutex_lock(&connection_pool_lock);
+    GSList *idle = NULL;
+    if (origin != NULL && connection_pool != NULL
+        && (idle = g_hash_table_lookup(connection_pool, origin)) != NULL)
+    {
+        handle = idle->data;
+        idle = g_slist_delete_link(idle, idle);
+        if (idle != NULL)
+            g_hash_table_insert(connection_pool, g_strdup(origin), idle);
+        else
+            g_hash_table_remove(connection_pool, origin);
+    }
+
+    if (handle == NULL)
+    {
+        handle = xcurl_easy_init();
+        CURLSH *share = get_connection_share();
+        if (share != NULL)
+            curl_easy_setopt(handle, CURLOPT_SHARE, share);
+    }
+    else
+        log_debug("Reusing connection to %s", origin);
+    g_mutex_unlock(&connection_pool_lock);
+
+    return handle;
+}
+
+/* Keeps the handle with its open connection for the next request to the origin */
+static void release_curl_handle(const char *origin, CURL *handle, bool reusable)
+{
+    if (!reusable || origin == NULL)
+    {
+        curl_easy_cleanup(handle);
+        return;
+    }
+
+    /* Drops all options, which refer to the caller's data. The connections,
+     * the caches and the share are kept.
+     */
+    curl_easy_reset(handle);
+
+    g_mutex_lock(&connection_pool_lock);
+    if (connection_pool == NULL)
+        connection_pool = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    GSList *idle = g_hash_table_lookup(connection_pool, origin);
+    if (g_slist_length(idle) < MAX_IDLE_HANDLES_PER_ORIGIN)
+    {
+        g_hash_table_insert(connection_pool, g_strdup(origin), g_slist_prepend(idle, handle));
+        handle = NULL;
+    }
+    g_mutex_unlock(&connection_pool_lock);
+
+    if (handle != NULL)
+        curl_easy_cleanup(handle);
+}
+
+/*
+ * Retrying failed requests
+ */
+
+#define DEFAULT_RETRY_MAX_ATTEMPTS 5
+#define DEFAULT_RETRY_INITIAL_DELAY_MS 1000
+#define DEFAULT_RETRY_MAX_DELAY_MS (30 * 1000)
+#define DEFAULT_RETRY_DEADLINE_MS (2 * 60 * 1000)
+
+/* The server is busy and didn't process the request. A proxy answering 502 or
+ * 504 may have passed the request to the server, so these are retried only
+ * if the policy of an idempotent request lists them.
+ */
+static const int default_retry_http_codes[] = { 429, 503, 0 };
+
+/* Nothing was sent to the server yet, so even requests which must not be
+ * processed twice can be sent again.
+ */
+static const CURLcode default_retry_curl_results[] = {
+    CURLE_COULDNT_RESOLVE_PROXY,
+    CURLE_COULDNT_RESOLVE_HOST,
+    CURLE_COULDNT_CONNECT,
+    CURLE_OK,
+};
+
+static post_retry_policy_t default_retry_policy = {
+    .max_attempts = DEFAULT_RETRY_MAX_ATTEMPTS,
+    .initial_delay_ms = DEFAULT_RETRY_INITIAL_DELAY_MS,
+    .max_delay_ms = DEFAULT_RETRY_MAX_DELAY_MS,
+    .deadline_ms = DEFAULT_RETRY_DEADLINE_MS,
+};
+
+post_retry_policy_t *post_retry_default_policy(void)
+{
+    return &default_retry_policy;
+}
+
+void post_retry_log_stats(const post_retry_policy_t *policy)
+{
+    if (policy == NULL)
+        policy = &default_retry_policy;
+
+    const post_retry_stats_t *stats = &policy->stats;
+    log_notice("HTTP requests: %u, attempts: %u, retries: %u (%u throttled), "
+               "failed after retries: %u, waited: %u ms",
+               g_atomic_int_get(&stats->requests), g_atomic_int_get(&stats->attempts),
+               g_atomic_int_get(&stats->retries), g_atomic_int_get(&stats->throttled),
+               g_atomic_int_get(&stats->exhausted), g_atomic_int_get(&stats->waited_ms));
+}
+
+bool post_retry_http_code(const post_retry_policy_t *policy, int http_resp_code)
+{
+    const int *codes = policy->retry_http_codes ? policy->retry_http_codes : default_retry_http_codes;
+    for (; *codes != 0; ++codes)
+    {
+        if (*codes == http_resp_code)
+            return true;
+    }
+
+    return false;
+}
+
+static bool post_retry_curl_result(const post_retry_policy_t *policy, int curl_result)
+{
+    const CURLcode *results = policy->retry_curl_results ? policy->retry_curl_results : default_retry_curl_results;
+    for (; *results != CURLE_OK; ++results)
+    {
+        if ((int)*results == curl_result)
+            return true;
+    }
+
+    return false;
+}
+
+/* Returns true if the request failed for a transient reason */
+static bool post_state_failed_transiently(const post_retry_policy_t *policy, const post_state_t *state)
+{
+    if (state->curl_result > 0)
+        return post_retry_curl_result(policy, state->curl_result);
+
+    if (state->curl_result != 0)
+        return false;
+
+    return post_retry_http_code(policy, state->http_resp_code)
+        || (state->retry_body_substring && state->body
+            && strstr(state->body, state->retry_body_substring));
+}
+
+void post_retry_start(post_retry_t *retry, post_retry_policy_t *policy)
+{
+    retry->policy = policy ? policy : &default_retry_policy;
+    retry->attempt = 1;
+    retry->start_time = g_get_monotonic_time();
+
+    g_atomic_int_inc(&retry->policy->stats.requests);
+    g_atomic_int_inc(&retry->policy->stats.attempts);
+}
+
+long post_retry_delay(post_retry_t *retry, bool transient, long retry_after_secs)
+{
+    post_retry_policy_t *policy = retry->policy;
+    if (!transient)
+        return -1;
+
+    if (retry->attempt >= policy->max_attempts)
+    {
+        log_info("Giving up after %u attempts", retry->attempt);
+        g_atomic_int_inc(&policy->stats.exhausted);
+        return -1;
+    }
+
+    /* Between the half and the whole of the exponential delay */
+    guint64 delay_ms = policy->initial_delay_ms;
+    for (unsigned i = 1; i < retry->attempt && delay_ms < policy->max_delay_ms; ++i)
+        delay_ms *= 2;
+    if (delay_ms > policy->max_delay_ms)
+        delay_ms = policy->max_delay_ms;
+    delay_ms = delay_ms / 2 + g_random_int_range(0, delay_ms / 2 + 1);
+
+    if (retry_after_secs > 0)
+        delay_ms = (guint64)retry_after_secs * 1000;
+
+    const gint64 elapsed_ms = (g_get_monotonic_time() - retry->start_time) / 1000;
+    if (policy->deadline_ms != 0 && elapsed_ms + delay_ms > policy->deadline_ms)
+    {
+        log_info("Giving up, the next attempt would start after the deadline");
+        g_atomic_int_inc(&policy->stats.exhausted);
+        return -1;
+    }
+
+    ++retry->attempt;
+    g_atomic_int_inc(&policy->stats.attempts);
+    g_atomic_int_inc(&policy->stats.retries);
+    if (retry_after_secs > 0)
+        g_atomic_int_inc(&policy->stats.throttled);
+    g_atomic_int_add(&policy->stats.waited_ms, (gint)delay_ms);
+
+    return delay_ms;
+}
+
+bool post_retry_next(post_retry_t *retry, bool transient, long retry_after_secs)
+{
+    const long delay_ms = post_retry_delay(retry, transient, retry_after_secs);
+    if (delay_ms < 0)
+        return false;
+
+    log_notice("Retrying in %ld ms (attempt %u)", delay_ms, retry->attempt);
+    g_usleep(delay_ms * 1000);
+    return true;
+}
+
 /*
  * post_state utility functions
  */
@@ -234,6 +503,50 @@ static size_t fread_with_reporting(void *ptr, size_t size, size_t nmemb, void *u
     return fread(ptr, size, nmemb, fp);
 }
 
+struct upload_stream
+{
+    int fd;
+    /* Reads the data instead of fd if set */
+    post_read_fn read_fn;
+    void *read_data;
+    /* Starts reading the data again for a retry, if they can be */
+    int (*rewind_fn)(void *read_data);
+    off_t uploaded;
+    time_t last_t;
+    time_t report_interval;
+};
+
+/* "read local data from a stream of unknown size" callback */
+static size_t read_fd_with_reporting(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    struct upload_stream *stream = userdata;
+
+    /* Report the uploaded size after 15 seconds,
+     * then after 30 seconds, then after 60 seconds and so on.
+     */
+    time_t t = time(NULL);
+    if ((t - stream->last_t) >= stream->report_interval)
+    {
+        stream->last_t = t;
+        stream->report_interval *= 2;
+        log_warning(_("Uploaded: %llu kbytes"), (unsigned long long)stream->uploaded / 1024);
+    }
+
+    ssize_t r;
+    if (stream->read_fn)
+        r = stream->read_fn(ptr, size * nmemb, stream->read_data);
+    else
+        r = libreport_safe_read(stream->fd, ptr, size * nmemb);
+    if (r < 0)
+    {
+        perror_msg("Can't read data to upload");
+        return CURL_READFUNC_ABORT;
+    }
+
+    stream->uploaded += r;
+    return r;
+}
+
 static int curl_debug(CURL *handle, curl_infotype it, char *buf, size_t bufsize, void *unused)
 {
     if (libreport_logmode == 0)
@@ -295,31 +608,51 @@ static int curl_debug(CURL *handle, curl_infotype it, char *buf, size_t bufsize,
     return 0;
 }
 
-int
-post(post_state_t *state,
+/* A request, whose handle is set up by prepare_transfer() */
+struct post_transfer
+{
+    post_state_t *state;
+    CURL *handle;
+    char *origin;
+    long response_code;
+    struct curl_httppost *post;
+    FILE *data_file;
+    FILE *body_stream;
+    struct curl_slist *httpheader_list;
+    struct upload_stream data_stream;
+};
+
+/* If upload is set, the data are read from it. POST_DATA_FROMFILE_PUT does
+ * HTTP PUT and data is only the name of the uploaded file, otherwise the data
+ * are posted and data_size is their size or -1 if it isn't known.
+ *
+ * Returns -1 if the data can't be read, the transfer must be cleaned up in
+ * any case.
+ */
+static int
+prepare_transfer(struct post_transfer *transfer,
+                post_state_t *state,
                 const char *url,
                 const char *content_type,
                 const char **additional_headers,
                 const char *data,
-                off_t data_size)
+                off_t data_size,
+                const struct upload_stream *upload)
 {
-    INITIALIZE_LIBREPORT();
-
-    CURLcode curl_err;
-    long response_code;
-    post_state_t localstate;
-
     log_debug("%s('%s','%s')", __func__, url, data);
 
-    if (!state)
-    {
-        memset(&localstate, 0, sizeof(localstate));
-        state = &localstate;
-    }
+    memset(transfer, 0, sizeof(*transfer));
+    transfer->state = state;
+    if (upload)
+        transfer->data_stream = *upload;
+    transfer->data_stream.last_t = time(NULL);
+    transfer->data_stream.report_interval = 15;
 
-    state->curl_result = state->http_resp_code = response_code = -1;
+    state->curl_result = state->http_resp_code = transfer->response_code = -1;
+    state->retry_after = 0;
 
-    CURL *handle = xcurl_easy_init();
+    transfer->origin = url_origin(url);
+    CURL *handle = transfer->handle = acquire_curl_handle(transfer->origin);
 
     // Buffer[CURL_ERROR_SIZE] curl stores human readable error messages in.
     // This may be more helpful than just return code from curl_easy_perform.
@@ -367,30 +700,49 @@ post(post_state_t *state,
     }
     // else (only POST_DATA_FROMFILE_PUT): do HTTP PUT.
 
-    struct curl_httppost *post = NULL;
     struct curl_httppost *last = NULL;
-    FILE *data_file = NULL;
-    FILE *body_stream = NULL;
-    struct curl_slist *httpheader_list = NULL;
 
     // Supply data...
-    if (data_size == POST_DATA_FROMFILE
+    if (upload && data_size == POST_DATA_FROMFILE_PUT)
+    {
+        // ...from a stream, the size is not known. HTTP uploads use chunked
+        // transfer encoding then.
+        xcurl_easy_setopt_ptr(handle, CURLOPT_READDATA, &transfer->data_stream);
+        xcurl_easy_setopt_ptr(handle, CURLOPT_READFUNCTION, (const void*)read_fd_with_reporting);
+        xcurl_easy_setopt_long(handle, CURLOPT_UPLOAD, 1);
+    }
+    else if (upload)
+    {
+        // ...from a stream, in the body of the POST request
+        xcurl_easy_setopt_ptr(handle, CURLOPT_READDATA, &transfer->data_stream);
+        xcurl_easy_setopt_ptr(handle, CURLOPT_READFUNCTION, (const void*)read_fd_with_reporting);
+        if (data_size >= 0)
+            xcurl_easy_setopt_off_t(handle, CURLOPT_POSTFIELDSIZE_LARGE, data_size);
+        else
+        {
+            // HTTP/1.1 servers accept data of unknown size in chunks
+            transfer->httpheader_list = curl_slist_append(transfer->httpheader_list, "Transfer-Encoding: chunked");
+            if (!transfer->httpheader_list)
+                error_msg_and_die("out of memory");
+        }
+    }
+    else if (data_size == POST_DATA_FROMFILE
      || data_size == POST_DATA_FROMFILE_PUT
     ) {
         // ...from a file
-        data_file = fopen(data, "r");
-        if (!data_file)
+        transfer->data_file = fopen(data, "r");
+        if (!transfer->data_file)
         {
             perror_msg("Can't open '%s'", data);
-            goto ret; // return -1
+            return -1;
         }
 
-        xcurl_easy_setopt_ptr(handle, CURLOPT_READDATA, data_file);
+        xcurl_easy_setopt_ptr(handle, CURLOPT_READDATA, transfer->data_file);
         // Want to use custom read function
         xcurl_easy_setopt_ptr(handle, CURLOPT_READFUNCTION, (const void*)fread_with_reporting);
-        fseeko(data_file, 0, SEEK_END);
-        off_t sz = ftello(data_file);
-        fseeko(data_file, 0, SEEK_SET);
+        fseeko(transfer->data_file, 0, SEEK_END);
+        off_t sz = ftello(transfer->data_file);
+        fseeko(transfer->data_file, 0, SEEK_SET);
         if (data_size == POST_DATA_FROMFILE)
         {
             // Without this, curl would send "Content-Length: -1"
@@ -410,23 +762,23 @@ post(post_state_t *state,
         if (basename) basename++;
         else basename = data;
 
-        data_file = fopen(data, "r");
-        if (!data_file)
+        transfer->data_file = fopen(data, "r");
+        if (!transfer->data_file)
         {
             perror_msg("Can't open '%s'", data);
-            goto ret; // return -1
+            return -1;
         }
         // Want to use custom read function
         xcurl_easy_setopt_ptr(handle, CURLOPT_READFUNCTION, (const void*)fread_with_reporting);
         // Need to know file size
-        fseeko(data_file, 0, SEEK_END);
-        off_t sz = ftello(data_file);
-        fseeko(data_file, 0, SEEK_SET);
+        fseeko(transfer->data_file, 0, SEEK_END);
+        off_t sz = ftello(transfer->data_file);
+        fseeko(transfer->data_file, 0, SEEK_SET);
         // Create formdata
-        CURLFORMcode curlform_err = curl_formadd(&post, &last,
+        CURLFORMcode curlform_err = curl_formadd(&transfer->post, &last,
                         CURLFORM_PTRNAME, "file", // element name
                         // use CURLOPT_READFUNCTION for reading, pass data_file as its last param:
-                        CURLFORM_STREAM, data_file,
+                        CURLFORM_STREAM, transfer->data_file,
                         CURLFORM_CONTENTSLENGTH, (long)sz, // a must if we use CURLFORM_STREAM option
 //FIXME: what if file size doesn't fit in long?
                         CURLFORM_CONTENTTYPE, content_type,
@@ -436,11 +788,11 @@ post(post_state_t *state,
         if (curlform_err != 0)
 //FIXME:
             error_msg_and_die("out of memory or read error (curl_formadd error code: %d)", (int)curlform_err);
-        xcurl_easy_setopt_ptr(handle, CURLOPT_HTTPPOST, post);
+        xcurl_easy_setopt_ptr(handle, CURLOPT_HTTPPOST, transfer->post);
     }
     else if (data_size == POST_DATA_STRING_AS_FORM_DATA)
     {
-        CURLFORMcode curlform_err = curl_formadd(&post, &last,
+        CURLFORMcode curlform_err = curl_formadd(&transfer->post, &last,
                         CURLFORM_PTRNAME, "file", // element name
                         // curl bug - missing filename
                         // http://curl.haxx.se/mail/lib-2011-07/0176.html
@@ -456,7 +808,7 @@ post(post_state_t *state,
                         CURLFORM_END);
         if (curlform_err != 0)
             error_msg_and_die("out of memory or read error (curl_formadd error code: %d)", (int)curlform_err);
-        xcurl_easy_setopt_ptr(handle, CURLOPT_HTTPPOST, post);
+        xcurl_easy_setopt_ptr(handle, CURLOPT_HTTPPOST, transfer->post);
     }
     else if (data_size != POST_DATA_GET)
     {
@@ -475,25 +827,25 @@ post(post_state_t *state,
     {
         g_autofree char *content_type_header = g_strdup_printf("Content-Type: %s", content_type);
         // Note: curl_slist_append() copies content_type_header
-        httpheader_list = curl_slist_append(httpheader_list, content_type_header);
-        if (!httpheader_list)
+        transfer->httpheader_list = curl_slist_append(transfer->httpheader_list, content_type_header);
+        if (!transfer->httpheader_list)
             error_msg_and_die("out of memory");
     }
 
     for (; additional_headers && *additional_headers; additional_headers++)
     {
-        httpheader_list = curl_slist_append(httpheader_list, *additional_headers);
-        if (!httpheader_list)
+        transfer->httpheader_list = curl_slist_append(transfer->httpheader_list, *additional_headers);
+        if (!transfer->httpheader_list)
             error_msg_and_die("out of memory");
     }
 
     // Add User-Agent: ABRT/N.M
-    httpheader_list = curl_slist_append(httpheader_list, "User-Agent: ABRT/"VERSION);
-    if (!httpheader_list)
+    transfer->httpheader_list = curl_slist_append(transfer->httpheader_list, "User-Agent: ABRT/"VERSION);
+    if (!transfer->httpheader_list)
         error_msg_and_die("out of memory");
 
-    if (httpheader_list)
-        xcurl_easy_setopt_ptr(handle, CURLOPT_HTTPHEADER, httpheader_list);
+    if (transfer->httpheader_list)
+        xcurl_easy_setopt_ptr(handle, CURLOPT_HTTPHEADER, transfer->httpheader_list);
 
 // Disabled: was observed to also handle "305 Use proxy" redirect,
 // apparently with POST->GET remapping - which server didn't like at all.
@@ -508,10 +860,10 @@ post(post_state_t *state,
     }
     if (state->flags & POST_WANT_BODY)
     {
-        body_stream = open_memstream(&state->body, &state->body_size);
-        if (!body_stream)
+        transfer->body_stream = open_memstream(&state->body, &state->body_size);
+        if (!transfer->body_stream)
             error_msg_and_die("out of memory");
-        xcurl_easy_setopt_ptr(handle, CURLOPT_WRITEDATA, body_stream);
+        xcurl_easy_setopt_ptr(handle, CURLOPT_WRITEDATA, transfer->body_stream);
     }
     if (!(state->flags & POST_WANT_SSL_VERIFY))
     {
@@ -528,9 +880,14 @@ post(post_state_t *state,
     if (state->cert_authority_cert_path)
         xcurl_easy_setopt_ptr(handle, CURLOPT_CAINFO, state->cert_authority_cert_path);
 
-    // This is the place where everything happens.
-    // Here errors are not limited to "out of memory", can't just die.
-    state->curl_result = curl_err = curl_easy_perform_with_proxy(handle, url);
+    return 0;
+}
+
+static void complete_transfer(struct post_transfer *transfer, CURLcode curl_err)
+{
+    post_state_t *state = transfer->state;
+
+    state->curl_result = curl_err;
     if (curl_err)
     {
         log_info("curl_easy_perform: error %d", (int)curl_err);
@@ -539,32 +896,621 @@ post(post_state_t *state,
             state->curl_error_msg = check_curl_error(curl_err, "curl_easy_perform");
             log_debug("curl_easy_perform: error_msg: %s", state->curl_error_msg);
         }
-        goto ret;
+        return;
     }
 
     // curl-7.20.1 doesn't do it, we get NULL body in the log message below
     // unless we fflush the body memstream ourself
-    if (body_stream)
-        fflush(body_stream);
+    if (transfer->body_stream)
+        fflush(transfer->body_stream);
 
     // Headers/body are already saved (if requested), extract more info
-    curl_err = curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &response_code);
+    long response_code;
+    curl_err = curl_easy_getinfo(transfer->handle, CURLINFO_RESPONSE_CODE, &response_code);
     die_if_curl_error(curl_err);
-    state->http_resp_code = response_code;
+    state->http_resp_code = transfer->response_code = response_code;
     log_debug("after curl_easy_perform: response_code:%ld body:'%s'", response_code, state->body);
 
- ret:
-    curl_easy_cleanup(handle);
-    if (httpheader_list)
-        curl_slist_free_all(httpheader_list);
-    if (body_stream)
-        fclose(body_stream);
-    if (data_file)
-        fclose(data_file);
-    if (post)
-        curl_formfree(post);
+    curl_off_t retry_after = 0;
+    if (curl_easy_getinfo(transfer->handle, CURLINFO_RETRY_AFTER, &retry_after) == CURLE_OK)
+        state->retry_after = retry_after;
+}
 
-    return response_code;
+/* Prepares the data of the failed transfer to be sent again, returns false
+ * if they can't be.
+ */
+/* Returns true if the data of the transfer can be sent again, without
+ * rewinding them yet
+ */
+static bool transfer_rewindable(const struct post_transfer *transfer)
+{
+    if (transfer->data_file)
+        return lseek(fileno(transfer->data_file), 0, SEEK_CUR) >= 0;
+
+    const struct upload_stream *stream = &transfer->data_stream;
+    return stream->uploaded == 0 || stream->rewind_fn != NULL;
+}
+
+static bool rewind_transfer(struct post_transfer *transfer)
+{
+    struct upload_stream *stream = &transfer->data_stream;
+    if (stream->uploaded == 0)
+        return true;
+
+    return stream->rewind_fn != NULL && stream->rewind_fn(stream->read_data) == 0;
+}
+
+/* Forgets the results of a failed attempt */
+static void reset_post_state(post_state_t *state)
+{
+    char **headers = state->headers;
+    if (headers)
+    {
+        while (*headers)
+            g_free(*headers++);
+        g_free(state->headers);
+        state->headers = NULL;
+    }
+    state->header_cnt = 0;
+    g_free(state->curl_error_msg);
+    state->curl_error_msg = NULL;
+    free(state->body);
+    state->body = NULL;
+    state->body_size = 0;
+}
+
+/* Returns the HTTP response code or -1 */
+static long cleanup_transfer(struct post_transfer *transfer)
+{
+    /* Connections of failed transfers may be in any state */
+    release_curl_handle(transfer->origin, transfer->handle, transfer->response_code != -1);
+    g_free(transfer->origin);
+    if (transfer->httpheader_list)
+        curl_slist_free_all(transfer->httpheader_list);
+    if (transfer->body_stream)
+        fclose(transfer->body_stream);
+    if (transfer->data_file)
+        fclose(transfer->data_file);
+    if (transfer->post)
+        curl_formfree(transfer->post);
+
+    return transfer->response_code;
+}
+
+static int
+post_ext(post_state_t *state,
+                const char *url,
+                const char *content_type,
+                const char **additional_headers,
+                const char *data,
+                off_t data_size,
+                const struct upload_stream *upload)
+{
+    INITIALIZE_LIBREPORT();
+
+    post_state_t localstate;
+    if (!state)
+    {
+        memset(&localstate, 0, sizeof(localstate));
+        state = &localstate;
+    }
+
+    post_retry_t retry;
+    post_retry_start(&retry, state->retry_policy);
+    for (;;)
+    {
+        struct post_transfer transfer;
+        if (prepare_transfer(&transfer, state, url, content_type, additional_headers, data, data_size, upload) != 0)
+            return cleanup_transfer(&transfer);
+
+        // This is the place where everything happens.
+        // Here errors are not limited to "out of memory", can't just die.
+        complete_transfer(&transfer, curl_easy_perform_with_proxy(transfer.handle, url));
+        state->attempts = retry.attempt;
+
+        const bool transient = post_state_failed_transiently(retry.policy, state);
+        long delay_ms = post_retry_delay(&retry, transient && transfer_rewindable(&transfer), state->retry_after);
+        if (delay_ms >= 0 && !rewind_transfer(&transfer))
+        {
+            log_notice("Can't send the data of %s again", url);
+            delay_ms = -1;
+        }
+        const long response_code = cleanup_transfer(&transfer);
+        if (delay_ms < 0)
+            return response_code;
+
+        log_notice("Retrying %s in %ld ms", url, delay_ms);
+        reset_post_state(state);
+        g_usleep(delay_ms * 1000);
+    }
+}
+
+int
+post(post_state_t *state,
+                const char *url,
+                const char *content_type,
+                const char **additional_headers,
+                const char *data,
+                off_t data_size)
+{
+    return post_ext(state, url, content_type, additional_headers, data, data_size, /*upload*/NULL);
+}
+
+int
+post_stream(post_state_t *state,
+                const char *url,
+                const char *content_type,
+                const char **additional_headers,
+                post_read_fn read_fn,
+                void *user_data,
+                off_t data_size)
+{
+    const struct upload_stream upload = {
+        .fd = -1,
+        .read_fn = read_fn,
+        .read_data = user_data,
+    };
+
+    /* Any negative size means unknown, not one of POST_DATA_* */
+    return post_ext(state, url, content_type, additional_headers,
+                    /*data*/NULL, data_size < 0 ? -1 : data_size, &upload);
+}
+
+/* Base64 encodes input in chunks of this size, must be divisible by 3 */
+#define BASE64_STREAM_CHUNK (48 * 1024)
+
+struct base64_stream
+{
+    int fd;
+    char *prefix;
+    char *suffix;
+    /* The expected and the produced size of the encoded data */
+    off_t encoded_size;
+    off_t encoded;
+    /* The part of the body to be sent next */
+    const char *pending;
+    size_t pending_len;
+    enum { BASE64_DATA, BASE64_SUFFIX, BASE64_END } next;
+    gint base64_state;
+    gint base64_save;
+    unsigned char input[BASE64_STREAM_CHUNK];
+    /* g_base64_encode_step() needs up to (len / 3 + 1) * 4 + 4 bytes */
+    char output[BASE64_STREAM_CHUNK / 3 * 4 + 8];
+};
+
+/* Returns -1 on read errors */
+static int next_base64_stream_part(struct base64_stream *stream)
+{
+    switch (stream->next)
+    {
+    case BASE64_DATA:
+    {
+        ssize_t r = libreport_full_read(stream->fd, stream->input, BASE64_STREAM_CHUNK);
+        if (r < 0)
+        {
+            perror_msg("Can't read data to upload");
+            return -1;
+        }
+
+        size_t len = g_base64_encode_step(stream->input, r, /*break_lines*/FALSE,
+                                          stream->output, &stream->base64_state, &stream->base64_save);
+        if (r < BASE64_STREAM_CHUNK)
+        {
+            len += g_base64_encode_close(/*break_lines*/FALSE, stream->output + len,
+                                         &stream->base64_state, &stream->base64_save);
+            stream->next = BASE64_SUFFIX;
+        }
+
+        stream->encoded += len;
+        if (stream->encoded > stream->encoded_size
+         || (stream->next == BASE64_SUFFIX && stream->encoded != stream->encoded_size))
+        {
+            error_msg("The uploaded data changed while being sent");
+            return -1;
+        }
+
+        stream->pending = stream->output;
+        stream->pending_len = len;
+        break;
+    }
+    case BASE64_SUFFIX:
+        stream->pending = stream->suffix;
+        stream->pending_len = strlen(stream->suffix);
+        stream->next = BASE64_END;
+        break;
+    case BASE64_END:
+        break;
+    }
+
+    return 0;
+}
+
+static ssize_t read_base64_stream(void *buf, size_t size, void *user_data)
+{
+    struct base64_stream *stream = user_data;
+    size_t done = 0;
+
+    while (done < size)
+    {
+        if (stream->pending_len == 0)
+        {
+            if (stream->next == BASE64_END)
+                break;
+            if (next_base64_stream_part(stream) != 0)
+                return -1;
+            continue;
+        }
+
+        const size_t len = MIN(size - done, stream->pending_len);
+        memcpy((char *)buf + done, stream->pending, len);
+        stream->pending += len;
+        stream->pending_len -= len;
+        done += len;
+    }
+
+    return done;
+}
+
+/* Returns -1 if the file can't be read from the beginning */
+static int rewind_base64_stream(void *user_data)
+{
+    struct base64_stream *stream = user_data;
+
+    if (lseek(stream->fd, 0, SEEK_SET) != 0)
+    {
+        perror_msg("Can't read data to upload");
+        return -1;
+    }
+
+    stream->encoded = 0;
+    stream->base64_state = stream->base64_save = 0;
+    stream->pending = stream->prefix;
+    stream->pending_len = strlen(stream->prefix);
+    stream->next = BASE64_DATA;
+    return 0;
+}
+
+static void free_base64_stream(struct base64_stream *stream)
+{
+    g_free(stream->prefix);
+    g_free(stream->suffix);
+    g_free(stream);
+}
+
+static struct base64_stream *new_base64_stream(const char *prefix, int fd, const char *suffix)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        perror_msg("Can't read data to upload");
+        return NULL;
+    }
+
+    struct base64_stream *stream = g_new0(struct base64_stream, 1);
+    stream->fd = fd;
+    stream->prefix = g_strdup(prefix);
+    stream->suffix = g_strdup(suffix);
+    stream->encoded_size = (st.st_size + 2) / 3 * 4;
+    if (rewind_base64_stream(stream) != 0)
+    {
+        free_base64_stream(stream);
+        return NULL;
+    }
+
+    return stream;
+}
+
+static off_t base64_stream_size(const struct base64_stream *stream)
+{
+    return strlen(stream->prefix) + stream->encoded_size + strlen(stream->suffix);
+}
+
+int
+post_base64_fd(post_state_t *state,
+                const char *url,
+                const char *content_type,
+                const char **additional_headers,
+                const char *prefix,
+                int fd,
+                const char *suffix)
+{
+    struct base64_stream *stream = new_base64_stream(prefix, fd, suffix);
+    if (stream == NULL)
+    {
+        state->curl_result = state->http_resp_code = -1;
+        return -1;
+    }
+
+    const struct upload_stream upload = {
+        .fd = -1,
+        .read_fn = read_base64_stream,
+        .read_data = stream,
+        .rewind_fn = rewind_base64_stream,
+    };
+    int r = post_ext(state, url, content_type, additional_headers,
+                     /*data*/NULL, base64_stream_size(stream), &upload);
+
+    free_base64_stream(stream);
+    return r;
+}
+
+/*
+ * post_queue: concurrent transfers
+ */
+
+struct post_queue
+{
+    CURLM *multi;
+    /* struct queued_post */
+    GList *transfers;
+};
+
+struct queued_post
+{
+    struct post_transfer transfer;
+    char *url;
+    /* Proxies to try, the current one first */
+    GList *proxy_list;
+    GList *proxy;
+    post_queue_done_fn done;
+    void *user_data;
+    post_retry_t retry;
+    /* When the failed transfer is started again, 0 if it's running */
+    gint64 retry_time;
+};
+
+static void
+die_if_curl_multi_error(CURLMcode err)
+{
+    if (err)
+        error_msg_and_die("curl: %s", curl_multi_strerror(err));
+}
+
+post_queue_t *new_post_queue(void)
+{
+    INITIALIZE_LIBREPORT();
+
+    post_queue_t *queue = g_new0(post_queue_t, 1);
+    queue->multi = curl_multi_init();
+    if (queue->multi == NULL)
+        error_msg_and_die("Can't create curl multi handle");
+
+    /* Transfers over the limit wait for a free connection, so many requests
+     * to one server reuse the pooled connections. HTTP/2 connections carry
+     * the requests at the same time.
+     */
+    die_if_curl_multi_error(curl_multi_setopt(queue->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)MAX_IDLE_HANDLES_PER_ORIGIN));
+
+    return queue;
+}
+
+static void free_queued_post(struct queued_post *queued)
+{
+    g_free(queued->url);
+    g_list_free_full(queued->proxy_list, g_free);
+    g_free(queued);
+}
+
+void free_post_queue(post_queue_t *queue)
+{
+    if (!queue)
+        return;
+
+    for (GList *iter = queue->transfers; iter != NULL; iter = g_list_next(iter))
+    {
+        struct queued_post *queued = iter->data;
+        curl_multi_remove_handle(queue->multi, queued->transfer.handle);
+        cleanup_transfer(&queued->transfer);
+        free_queued_post(queued);
+    }
+    g_list_free(queue->transfers);
+
+    curl_multi_cleanup(queue->multi);
+    g_free(queue);
+}
+
+static void connect_queued_post(struct queued_post *queued)
+{
+    if (queued->proxy != NULL)
+    {
+        xcurl_easy_setopt_ptr(queued->transfer.handle, CURLOPT_PROXY, queued->proxy->data);
+        log_notice("Connecting to %s (using proxy server %s)", queued->url, (const char *)queued->proxy->data);
+    }
+    else
+        log_notice("Connecting to %s", queued->url);
+}
+
+int post_queue_add(post_queue_t *queue,
+                post_state_t *state,
+                const char *url,
+                const char *content_type,
+                const char **additional_headers,
+                const char *data,
+                off_t data_size,
+                long timeout,
+                post_queue_done_fn done,
+                void *user_data)
+{
+    struct queued_post *queued = g_new0(struct queued_post, 1);
+    if (prepare_transfer(&queued->transfer, state, url, content_type, additional_headers, data, data_size, /*upload*/NULL) != 0)
+    {
+        cleanup_transfer(&queued->transfer);
+        free_queued_post(queued);
+        return -1;
+    }
+
+    queued->url = g_strdup(url);
+    queued->proxy = queued->proxy_list = get_proxy_list(url);
+    queued->done = done;
+    queued->user_data = user_data;
+    post_retry_start(&queued->retry, state->retry_policy);
+
+    CURL *handle = queued->transfer.handle;
+    xcurl_easy_setopt_ptr(handle, CURLOPT_PRIVATE, queued);
+    if (timeout > 0)
+        xcurl_easy_setopt_long(handle, CURLOPT_TIMEOUT, timeout);
+
+    connect_queued_post(queued);
+    die_if_curl_multi_error(curl_multi_add_handle(queue->multi, handle));
+    queue->transfers = g_list_prepend(queue->transfers, queued);
+
+    return 0;
+}
+
+/* Prepares the failed transfer to be started again, returns false if its data
+ * can't be sent again.
+ */
+static bool rewind_queued_post(struct queued_post *queued)
+{
+    struct post_transfer *transfer = &queued->transfer;
+    if (transfer->data_file && fseeko(transfer->data_file, 0, SEEK_SET) != 0)
+        return false;
+
+    if (!rewind_transfer(transfer))
+        return false;
+
+    post_state_t *state = transfer->state;
+    if (transfer->body_stream)
+    {
+        fclose(transfer->body_stream);
+        transfer->body_stream = NULL;
+    }
+    reset_post_state(state);
+    if (state->flags & POST_WANT_BODY)
+    {
+        transfer->body_stream = open_memstream(&state->body, &state->body_size);
+        if (!transfer->body_stream)
+            error_msg_and_die("out of memory");
+        xcurl_easy_setopt_ptr(transfer->handle, CURLOPT_WRITEDATA, transfer->body_stream);
+    }
+    state->curl_result = state->http_resp_code = transfer->response_code = -1;
+    state->retry_after = 0;
+
+    return true;
+}
+
+/* Like curl_easy_perform_with_proxy(), failed transfers are started again
+ * with the next proxy.
+ */
+static bool retry_queued_post(post_queue_t *queue, struct queued_post *queued)
+{
+    if (queued->proxy == NULL || g_list_next(queued->proxy) == NULL)
+        return false;
+
+    if (!rewind_queued_post(queued))
+        return false;
+
+    queued->proxy = g_list_next(queued->proxy);
+    connect_queued_post(queued);
+    die_if_curl_multi_error(curl_multi_add_handle(queue->multi, queued->transfer.handle));
+
+    return true;
+}
+
+/* Returns true if the transfer which failed for a transient reason is going
+ * to be started again later, according to its retry policy.
+ */
+static bool retry_queued_post_later(struct queued_post *queued)
+{
+    post_state_t *state = queued->transfer.state;
+    if (!post_state_failed_transiently(queued->retry.policy, state))
+        return false;
+
+    /* The failed attempt stays in state if there is no next one */
+    const long delay_ms = post_retry_delay(&queued->retry, transfer_rewindable(&queued->transfer), state->retry_after);
+    if (delay_ms < 0 || !rewind_queued_post(queued))
+        return false;
+
+    log_notice("Retrying %s in %ld ms", queued->url, delay_ms);
+    queued->proxy = queued->proxy_list;
+    queued->retry_time = g_get_monotonic_time() + delay_ms * 1000;
+    return true;
+}
+
+/* Starts the transfers whose time to retry came, returns the number of
+ * milliseconds until the next one or -1 if no other is waiting.
+ */
+static int start_retried_posts(post_queue_t *queue)
+{
+    const gint64 now = g_get_monotonic_time();
+    gint64 next = -1;
+    for (GList *iter = queue->transfers; iter != NULL; iter = g_list_next(iter))
+    {
+        struct queued_post *queued = iter->data;
+        if (queued->retry_time == 0)
+            continue;
+
+        if (queued->retry_time <= now)
+        {
+            queued->retry_time = 0;
+            connect_queued_post(queued);
+            die_if_curl_multi_error(curl_multi_add_handle(queue->multi, queued->transfer.handle));
+        }
+        else if (next < 0 || queued->retry_time < next)
+            next = queued->retry_time;
+    }
+
+    return next < 0 ? -1 : (int)((next - now + 999) / 1000);
+}
+
+static void finish_queued_posts(post_queue_t *queue)
+{
+    CURLMsg *msg;
+    int msgs_left;
+    while ((msg = curl_multi_info_read(queue->multi, &msgs_left)) != NULL)
+    {
+        if (msg->msg != CURLMSG_DONE)
+            continue;
+
+        /* msg is not valid after the handle is removed */
+        CURL *handle = msg->easy_handle;
+        const CURLcode result = msg->data.result;
+
+        struct queued_post *queued = NULL;
+        curl_easy_getinfo(handle, CURLINFO_PRIVATE, (char **)&queued);
+        curl_multi_remove_handle(queue->multi, handle);
+
+        if (result != CURLE_OK && retry_queued_post(queue, queued))
+            continue;
+
+        complete_transfer(&queued->transfer, result);
+        queued->transfer.state->attempts = queued->retry.attempt;
+        if (retry_queued_post_later(queued))
+            continue;
+
+        queue->transfers = g_list_remove(queue->transfers, queued);
+        cleanup_transfer(&queued->transfer);
+
+        if (queued->done)
+            queued->done(queued->transfer.state, queued->user_data);
+        free_queued_post(queued);
+    }
+}
+
+unsigned post_queue_perform(post_queue_t *queue, int timeout_ms)
+{
+    const int retry_ms = start_retried_posts(queue);
+
+    int running;
+    die_if_curl_multi_error(curl_multi_perform(queue->multi, &running));
+    if ((running > 0 || retry_ms >= 0) && timeout_ms > 0)
+    {
+        if (retry_ms >= 0 && retry_ms < timeout_ms)
+            timeout_ms = retry_ms;
+        /* Without running transfers, it waits for the retry */
+        die_if_curl_multi_error(curl_multi_poll(queue->multi, NULL, 0, timeout_ms, NULL));
+        die_if_curl_multi_error(curl_multi_perform(queue->multi, &running));
+    }
+
+    finish_queued_posts(queue);
+
+    return g_list_length(queue->transfers);
+}
+
+void post_queue_run(post_queue_t *queue)
+{
+    while (post_queue_perform(queue, /*timeout_ms*/1000) > 0)
+        continue;
 }
 
 /* Unlike post_file(),
@@ -579,7 +1525,8 @@ char *libreport_upload_file(const char *url, const char *filename)
     return retval;
 }
 
-char *libreport_upload_file_ext(post_state_t *state, const char *url, const char *filename, int flags)
+/* Uploads the data of fd if it is not negative, otherwise the file filename */
+static char *upload_ext(post_state_t *state, const char *url, const char *filename, int fd, int flags)
 {
     /* we don't want to print the whole url as it may contain password
      * rhbz#856960
@@ -641,17 +1588,26 @@ char *libreport_upload_file_ext(post_state_t *state, const char *url, const char
     /* Do not include the path part of the URL as it can contain sensitive data
      * in case of typos */
     log_warning(_("Sending %s to %s//%s"), filename, scheme, hostname);
-    post(state,
+    const struct upload_stream upload = { .fd = fd };
+    post_ext(state,
                 whole_url,
                 /*content_type:*/ "application/octet-stream",
                 /*additional_headers:*/ NULL,
                 /*data:*/ filename,
-                POST_DATA_FROMFILE_PUT
+                POST_DATA_FROMFILE_PUT,
+                fd >= 0 ? &upload : NULL
     );
 
     dup2(stdin_bck, 0);
 
     int error = (state->curl_result != 0);
+    /* Servers which need to know the size in advance refuse chunked uploads */
+    if (fd >= 0 && g_ascii_strncasecmp(scheme, "http", strlen("http")) == 0
+        && (state->http_resp_code == 411 || state->http_resp_code == 501))
+    {
+        error_msg("The server refused data of unknown size: HTTP %d", state->http_resp_code);
+        error = 1;
+    }
     if (error)
     {
         if (state->curl_error_msg)
@@ -660,7 +1616,8 @@ char *libreport_upload_file_ext(post_state_t *state, const char *url, const char
             /* for example, when source file can't be opened */
             error_msg("Error while uploading");
 
-        if ((flags & UPLOAD_FILE_HANDLE_ACCESS_DENIALS) &&
+        /* A stream can't be read again */
+        if (fd < 0 && (flags & UPLOAD_FILE_HANDLE_ACCESS_DENIALS) &&
                 (state->curl_result == CURLE_LOGIN_DENIED
                  || state->curl_result == CURLE_REMOTE_ACCESS_DENIED))
         {
@@ -700,3 +1657,13 @@ finito:
 
     return whole_url;
 }
+
+char *libreport_upload_file_ext(post_state_t *state, const char *url, const char *filename, int flags)
+{
+    return upload_ext(state, url, filename, /*fd*/-1, flags);
+}
+
+char *libreport_upload_fd(post_state_t *state, const char *url, const char *filename, int fd)
+{
+    return upload_ext(state, url, filename, fd, UPLOAD_FILE_NOFLAGS);
+}
@@ -53,6 +53,161 @@ double libreport_get_dirsize(const char *pPath)
     return size;
 }
 
+/* Sizes of problem directories are remembered between calls, in memory and
+ * in a cache file, so the spool is not traversed every time.
+ *
+ * Every dd_* function writing or deleting an element replaces the file,
+ * which updates mtime and ctime of the problem directory. A remembered size
+ * is thus used as long as the directory's inode and times do not change, but
+ * not longer than DIRSIZE_VERIFY_SECS, because files can be modified in
+ * place by other tools as well.
+ */
+#define DIRSIZE_VERIFY_SECS (10 * 60)
+
+/* name, dev, ino, mtime sec, mtime nsec, ctime sec, ctime nsec, verified,
+ * is a problem dir, size
+ */
+#define DIRSIZE_ENTRIES_TYPE "a(sttxxxxxnd)"
+
+struct dirsize_entry
+{
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    struct timespec ctime;
+    /* When the size was computed */
+    time_t verified;
+    /* -1 not known yet */
+    int is_dd;
+    double size;
+};
+
+/* Spool path -> GHashTable of directory name -> struct dirsize_entry */
+static GHashTable *dirsize_indexes;
+
+static char *dirsize_cache_name(const char *spool)
+{
+    g_autofree char *checksum = g_compute_checksum_for_string(G_CHECKSUM_SHA1, spool, -1);
+    return g_strdup_printf("dirsize-%s", checksum);
+}
+
+static GHashTable *new_dirsize_entries(void)
+{
+    return g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+}
+
+static GHashTable *load_dirsize_entries(const char *spool)
+{
+    GHashTable *entries = new_dirsize_entries();
+
+    g_autofree char *name = dirsize_cache_name(spool);
+    GPtrArray *sources = NULL;
+    GVariant *payload = libreport_load_config_cache(name, spool, G_VARIANT_TYPE(DIRSIZE_ENTRIES_TYPE), &sources);
+    if (payload == NULL)
+        return entries;
+    g_ptr_array_free(sources, TRUE);
+
+    GVariantIter iter;
+    g_variant_iter_init(&iter, payload);
+    const char *dir_name;
+    guint64 dev, ino;
+    gint64 mtime_sec, mtime_nsec, ctime_sec, ctime_nsec, verified;
+    gint16 is_dd;
+    double size;
+    while (g_variant_iter_next(&iter, "(&sttxxxxxnd)", &dir_name, &dev, &ino,
+                &mtime_sec, &mtime_nsec, &ctime_sec, &ctime_nsec, &verified, &is_dd, &size))
+    {
+        struct dirsize_entry *entry = g_new0(struct dirsize_entry, 1);
+        entry->dev = dev;
+        entry->ino = ino;
+        entry->mtime.tv_sec = mtime_sec;
+        entry->mtime.tv_nsec = mtime_nsec;
+        entry->ctime.tv_sec = ctime_sec;
+        entry->ctime.tv_nsec = ctime_nsec;
+        entry->verified = verified;
+        entry->is_dd = is_dd;
+        entry->size = size;
+        g_hash_table_replace(entries, g_strdup(dir_name), entry);
+    }
+    g_variant_unref(payload);
+
+    log_debug("Loaded sizes of %u directories of '%s'", g_hash_table_size(entries), spool);
+    return entries;
+}
+
+static void save_dirsize_entries(const char *spool, GHashTable *entries)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE(DIRSIZE_ENTRIES_TYPE));
+
+    GHashTableIter iter;
+    const char *dir_name;
+    struct dirsize_entry *entry;
+    g_hash_table_iter_init(&iter, entries);
+    while (g_hash_table_iter_next(&iter, (gpointer *)&dir_name, (gpointer *)&entry))
+    {
+        g_variant_builder_add(&builder, "(sttxxxxxnd)", dir_name,
+                (guint64)entry->dev, (guint64)entry->ino,
+                (gint64)entry->mtime.tv_sec, (gint64)entry->mtime.tv_nsec,
+                (gint64)entry->ctime.tv_sec, (gint64)entry->ctime.tv_nsec,
+                (gint64)entry->verified, (gint16)entry->is_dd, entry->size);
+    }
+
+    g_autofree char *name = dirsize_cache_name(spool);
+    GPtrArray *sources = libreport_new_config_sources();
+    libreport_save_config_cache(name, spool, sources, g_variant_builder_end(&builder));
+    g_ptr_array_free(sources, TRUE);
+}
+
+static bool dirsize_entry_valid(const struct dirsize_entry *entry, const struct stat *st, time_t now)
+{
+    return entry->dev == st->st_dev
+        && entry->ino == st->st_ino
+        && entry->mtime.tv_sec == st->st_mtim.tv_sec
+        && entry->mtime.tv_nsec == st->st_mtim.tv_nsec
+        && entry->ctime.tv_sec == st->st_ctim.tv_sec
+        && entry->ctime.tv_nsec == st->st_ctim.tv_nsec
+        && entry->verified <= now
+        && now - entry->verified < DIRSIZE_VERIFY_SECS;
+}
+
+/* Moves the entry of the directory from old to new entries, computes its size
+ * again if the directory changed. Sets *changed if it did.
+ */
+static struct dirsize_entry *get_dirsize_entry(GHashTable *old_entries, GHashTable *new_entries,
+        const char *dir_name, const char *dir_path, const struct stat *st, time_t now, bool *changed)
+{
+    char *key = NULL;
+    struct dirsize_entry *entry = NULL;
+    if (g_hash_table_lookup_extended(old_entries, dir_name, (gpointer *)&key, (gpointer *)&entry))
+    {
+        g_hash_table_steal(old_entries, dir_name);
+        if (!dirsize_entry_valid(entry, st, now))
+        {
+            g_free(key);
+            g_free(entry);
+            entry = NULL;
+        }
+    }
+
+    if (entry == NULL)
+    {
+        entry = g_new0(struct dirsize_entry, 1);
+        entry->dev = st->st_dev;
+        entry->ino = st->st_ino;
+        entry->mtime = st->st_mtim;
+        entry->ctime = st->st_ctim;
+        entry->verified = now;
+        entry->is_dd = -1;
+        entry->size = libreport_get_dirsize(dir_path);
+        key = g_strdup(dir_name);
+        *changed = true;
+    }
+
+    g_hash_table_replace(new_entries, key, entry);
+    return entry;
+}
+
 static bool this_is_a_dd(const char *dirname)
 {
     /* Prevent libreport_get_dirsize_find_largest_dir() from flooding log
@@ -62,8 +217,11 @@ static bool this_is_a_dd(const char *dirname)
     int sv_logmode = libreport_logmode;
     libreport_logmode = 0;
 
+    /* The shared lock doesn't touch the directory, so its remembered size
+     * remains valid.
+     */
     struct dump_dir *dd = dd_opendir(dirname,
-                /*flags:*/ DD_OPEN_READONLY | DD_FAIL_QUIETLY_ENOENT | DD_FAIL_QUIETLY_EACCES
+                /*flags:*/ DD_OPEN_READONLY | DD_OPEN_SHARED_LOCK | DD_FAIL_QUIETLY_ENOENT | DD_FAIL_QUIETLY_EACCES
     );
     dd_close(dd);
 
@@ -84,6 +242,22 @@ double libreport_get_dirsize_find_largest_dir(
     if (dp == NULL)
         return 0;
 
+    if (dirsize_indexes == NULL)
+        dirsize_indexes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_hash_table_destroy);
+
+    /* Entries of directories which are not found are dropped */
+    char *spool = NULL;
+    GHashTable *old_entries = NULL;
+    if (g_hash_table_lookup_extended(dirsize_indexes, pPath, (gpointer *)&spool, (gpointer *)&old_entries))
+    {
+        g_hash_table_steal(dirsize_indexes, pPath);
+        g_free(spool);
+    }
+    else
+        old_entries = load_dirsize_entries(pPath);
+    GHashTable *entries = new_dirsize_entries();
+    bool changed = false;
+
     time_t cur_time = time(NULL);
     struct dirent *ep;
     struct stat statbuf;
@@ -94,62 +268,76 @@ double libreport_get_dirsize_find_largest_dir(
         if (libreport_dot_or_dotdot(ep->d_name))
             continue;
         g_autofree char *dname = g_build_filename(pPath ? pPath : "", ep->d_name, NULL);
+        if (lstat(dname, &statbuf) != 0)
+        {
+            continue;
+        }
+        if (!S_ISDIR(statbuf.st_mode))
+        {
+            if (S_ISREG(statbuf.st_mode))
+                size += statbuf.st_size;
+            continue;
+        }
+
+        struct dirsize_entry *entry = get_dirsize_entry(old_entries, entries,
+                ep->d_name, dname, &statbuf, cur_time, &changed);
+        double sz = entry->size;
+        size += sz;
+
+        struct stat lock_statbuf;
         g_autofree char *sosreport_path = g_build_filename(dname, "sosreport.log", NULL);
         g_autofree char *lock_path = g_build_filename(dname, ".lock", NULL);
-        if (lstat(sosreport_path, &statbuf) == 0)
+        if (lstat(sosreport_path, &lock_statbuf) == 0)
         {
             log_debug("Skipping %s': sosreport is being generated.", dname);
-            size += libreport_get_dirsize(dname);
             continue;
         }
-        if (lstat(lock_path, &statbuf) == 0)
+        if (lstat(lock_path, &lock_statbuf) == 0)
         {
             log_warning("Skipping %s: directory locked. Is a backtrace being generated?", dname);
-            size += libreport_get_dirsize(dname);
             continue;
         }
-        if (lstat(dname, &statbuf) != 0)
-        {
-            continue;
-        }
-        if (S_ISDIR(statbuf.st_mode))
+
+        if (worst_dir && (!excluded || strcmp(excluded, ep->d_name) != 0))
         {
-            double sz = libreport_get_dirsize(dname);
-            size += sz;
+            /* Calculate "weighted" size and age
+             * w = sz_kbytes * age_mins
+             */
+            sz /= 1024;
+            long age = (cur_time - statbuf.st_mtime) / 60;
+            if (age > 0)
+                sz *= age;
 
-            if (worst_dir && (!excluded || strcmp(excluded, ep->d_name) != 0))
+            if (sz > maxsz)
             {
-                /* Calculate "weighted" size and age
-                 * w = sz_kbytes * age_mins
-                 */
-                sz /= 1024;
-                long age = (cur_time - statbuf.st_mtime) / 60;
-                if (age > 0)
-                    sz *= age;
-
-                if (sz > maxsz)
+                if (entry->is_dd < 0)
                 {
-                    if (!this_is_a_dd(dname))
-                    {
-                        log_notice("'%s' isn't a problem directory, probably a stray directory?", dname);
-                    }
-                    else
+                    entry->is_dd = this_is_a_dd(dname);
+                    changed = true;
+                }
+
+                if (!entry->is_dd)
+                {
+                    log_notice("'%s' isn't a problem directory, probably a stray directory?", dname);
+                }
+                else
+                {
+                    if (!proc_dir || strcmp(proc_dir, ep->d_name) != 0)
                     {
-                        if (!proc_dir || strcmp(proc_dir, ep->d_name) != 0)
-                        {
-                            maxsz = sz;
-                            g_free(*worst_dir);
-                            *worst_dir = g_strdup(ep->d_name);
-                        }
+                        maxsz = sz;
+                        g_free(*worst_dir);
+                        *worst_dir = g_strdup(ep->d_name);
                     }
                 }
             }
         }
-        else if (S_ISREG(statbuf.st_mode))
-        {
-            size += statbuf.st_size;
-        }
     }
     closedir(dp);
+
+    if (changed || g_hash_table_size(old_entries) != 0)
+        save_dirsize_entries(pPath, entries);
+    g_hash_table_destroy(old_entries);
+    g_hash_table_replace(dirsize_indexes, g_strdup(pPath), entries);
+
     return size;
 }
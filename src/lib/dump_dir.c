@@ -16,7 +16,12 @@
     with this program; if not, write to the Free Software Foundation, Inc.,
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/statvfs.h>
 #include <sys/utsname.h>
+#include <sys/xattr.h>
 #include <archive.h>
 #include <archive_entry.h>
 #include <glib-unix.h>
@@ -51,6 +56,13 @@
 // We detect it by bailing out of "lock, check time file; sleep
 // and retry if it doesn't exist" loop using a counter.
 //
+// Processes which only read the directory (DD_OPEN_SHARED_LOCK) do not
+// create .lock, they share a flock() of the directory instead and back off
+// while .lock exists. Writers create .lock first, which stops new readers,
+// and then wait for the flock() of the directory held by the current
+// readers. Older libreport, which knows only .lock, is thus kept away by
+// writers, but it is not kept away by readers.
+//
 // To make locking work reliably, it's important to set timeouts
 // correctly. For example, dd_create should retry locking
 // its newly-created directory much faster than dd_opendir
@@ -421,39 +433,334 @@ static const char *dd_check(struct dump_dir *dd)
     return NULL;
 }
 
-static int dd_lock(struct dump_dir *dd, unsigned sleep_usec, int flags)
+static struct dd_lock_wait_stats lock_wait_stats;
+
+void dd_get_lock_wait_stats(struct dd_lock_wait_stats *stats)
 {
-    if (dd->locked)
+    *stats = lock_wait_stats;
+}
+
+void dd_reset_lock_wait_stats(void)
+{
+    memset(&lock_wait_stats, 0, sizeof(lock_wait_stats));
+}
+
+/* Returns an inotify descriptor watching the files of the directory which
+ * matter to dd_lock(), or -1 if inotify can't be used.
+ */
+static int dd_watch_lock(struct dump_dir *dd)
+{
+    int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0)
+    {
+        log_info("Can't initialize inotify: %s", strerror(errno));
+        return -1;
+    }
+
+    char dir_path[sizeof("/proc/self/fd/") + sizeof(int)*3];
+    snprintf(dir_path, sizeof(dir_path), "/proc/self/fd/%d", dd->dd_fd);
+    if (inotify_add_watch(inotify_fd, dir_path,
+                IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE
+                | IN_CLOSE_NOWRITE | IN_DELETE_SELF | IN_ONLYDIR) < 0)
+    {
+        log_info("Can't watch '%s': %s", dd->dd_dirname, strerror(errno));
+        close(inotify_fd);
+        return -1;
+    }
+
+    return inotify_fd;
+}
+
+/* Returns true if the inotify events may have changed the result of
+ * dd_lock(): the lock or one of the files checked by dd_check(), or
+ * a reader closed the directory, which releases its flock().
+ */
+static bool dd_lock_events_relevant(const char *buf, ssize_t len)
+{
+    bool relevant = false;
+    for (const char *ptr = buf; ptr < buf + len; )
+    {
+        const struct inotify_event *event = (const struct inotify_event *)ptr;
+        ptr += sizeof(*event) + event->len;
+
+        if (event->len == 0) /* the directory itself */
+        {
+            relevant = true;
+            continue;
+        }
+        /* Somebody read a file */
+        if (event->mask & IN_CLOSE_NOWRITE)
+            continue;
+
+        relevant = relevant
+                || strcmp(event->name, ".lock") == 0
+                || strcmp(event->name, FILENAME_TIME) == 0
+                || strcmp(event->name, FILENAME_TYPE) == 0;
+    }
+    return relevant;
+}
+
+/* Sleeps until the lock or the required files of the directory change, at
+ * most usec microseconds and not past the deadline (-1 for no deadline).
+ * Without inotify, simply sleeps.
+ */
+static void dd_wait_for_lock_change(int inotify_fd, unsigned usec, gint64 deadline)
+{
+    gint64 wake_up = g_get_monotonic_time() + usec;
+    if (deadline >= 0)
+        wake_up = MIN(wake_up, deadline);
+
+    while (1)
+    {
+        const gint64 now = g_get_monotonic_time();
+        if (now >= wake_up)
+            return;
+
+        if (inotify_fd < 0)
+        {
+            usleep(wake_up - now);
+            return;
+        }
+
+        struct pollfd pfd = { .fd = inotify_fd, .events = POLLIN };
+        if (poll(&pfd, 1, (wake_up - now + 999) / 1000) <= 0)
+            continue; /* timed out or EINTR */
+
+        char buf[sizeof(struct inotify_event) + NAME_MAX + 1]
+            __attribute__ ((aligned(__alignof__(struct inotify_event))));
+        bool relevant = false;
+        ssize_t len;
+        while ((len = read(inotify_fd, buf, sizeof(buf))) > 0)
+            relevant = dd_lock_events_relevant(buf, len) || relevant;
+
+        if (relevant)
+            return;
+    }
+}
+
+/* Dump dirs locked for reading with flock() by this process */
+static GList *shared_locked_dds;
+/* A forked child shares the locks of the list with its parent */
+static pid_t shared_locked_dds_pid;
+
+/* Applies the flock() operation to the other dump dirs of the directory
+ * which this process has locked for reading, returns their number.
+ */
+static unsigned dd_flock_shared_by_us(struct dump_dir *dd, int operation)
+{
+    if (shared_locked_dds == NULL || shared_locked_dds_pid != getpid())
+        return 0;
+
+    struct stat st;
+    if (fstat(dd->dd_fd, &st) != 0)
+        return 0;
+
+    unsigned count = 0;
+    for (GList *iter = shared_locked_dds; iter != NULL; iter = g_list_next(iter))
+    {
+        struct dump_dir *other = iter->data;
+        struct stat other_st;
+        if (other != dd
+         && fstat(other->dd_fd, &other_st) == 0
+         && other_st.st_dev == st.st_dev && other_st.st_ino == st.st_ino)
+        {
+            flock(other->dd_fd, operation);
+            ++count;
+        }
+    }
+    return count;
+}
+
+/* Return values:
+ * -1: error
+ *  0: the lock is held by another process
+ *  1: success, dd->owns_lock is 0 if the lock has been already held by us
+ */
+static int dd_try_lock_exclusive(struct dump_dir *dd, const char *pid_buf)
+{
+    /* The symlink is kept while waiting for readers to finish, new readers
+     * don't start then.
+     */
+    if (!dd->owns_lock)
+    {
+        int r = create_symlink_lockfile_at(dd->dd_fd, ".lock", pid_buf);
+        if (r < 0)
+            return r;
+        if (r == 0 && errno != EALREADY)
+            return 0;
+
+        /* Reset errno to 0 only if errno is EALREADY (used by
+         * create_symlink_lockfile() to signal that the dump directory is
+         * already locked by us) */
+        if (!(dd->owns_lock = (r > 0)))
+        {
+            errno = 0;
+            return 1;
+        }
+    }
+
+    /* Waiting for our own readers would never end, their locks are left
+     * out of the attempt. While we write, they are kept out by .lock, and
+     * dd_release_lock() gives the locks back before it removes .lock.
+     */
+    const bool shared_by_us = dd_flock_shared_by_us(dd, LOCK_UN) > 0;
+    if (flock(dd->dd_fd, LOCK_EX | LOCK_NB) == 0)
+        return 1;
+    const int flock_errno = errno;
+    if (shared_by_us)
+        dd_flock_shared_by_us(dd, LOCK_SH | LOCK_NB);
+
+    if (flock_errno != EWOULDBLOCK)
+    {
+        errno = flock_errno;
+        perror_msg("Can't lock '%s'", dd->dd_dirname);
+        errno = 0;
+        return -1;
+    }
+
+    log_info("Waiting for readers of '%s'", dd->dd_dirname);
+    return 0;
+}
+
+/* Returns 1 if the dir is locked by this process, 0 if by another live
+ * process, -1 if it isn't locked or the lock is stale.
+ */
+static int dd_lock_holder(struct dump_dir *dd, const char *pid_buf)
+{
+    char holder[sizeof(pid_t)*3 + 4];
+    ssize_t r = readlinkat(dd->dd_fd, ".lock", holder, sizeof(holder) - 1);
+    if (r < 0)
+        return -1;
+    holder[r] = '\0';
+
+    if (strcmp(holder, pid_buf) == 0)
+        return 1;
+
+    char proc_path[sizeof("/proc/") + sizeof(holder)];
+    snprintf(proc_path, sizeof(proc_path), "/proc/%s", holder);
+    if (isdigit_str(holder) && access(proc_path, F_OK) == 0)
+        return 0;
+
+    /* Stale, the next writer removes it */
+    return -1;
+}
+
+/* Readers share a flock() of the directory, writers take it exclusively.
+ * Processes not knowing the flock() create only the .lock symlink, which
+ * readers respect as well, but do not create. Such processes thus don't
+ * wait for the readers, see DD_OPEN_SHARED_LOCK.
+ *
+ * Return values are the same as of dd_try_lock_exclusive().
+ */
+static int dd_try_lock_shared(struct dump_dir *dd, const char *pid_buf)
+{
+    dd->owns_lock = 0;
+
+    const int holder = dd_lock_holder(dd, pid_buf);
+    if (holder == 1)
+        return 1; /* we already have an exclusive lock */
+    if (holder == 0)
+        return 0;
+
+    if (flock(dd->dd_fd, LOCK_SH | LOCK_NB) == 0)
+    {
+        if (shared_locked_dds_pid != getpid())
+        {
+            g_list_free(shared_locked_dds);
+            shared_locked_dds = NULL;
+            shared_locked_dds_pid = getpid();
+        }
+        shared_locked_dds = g_list_prepend(shared_locked_dds, dd);
+        return 1;
+    }
+    if (errno != EWOULDBLOCK)
+    {
+        perror_msg("Can't lock '%s'", dd->dd_dirname);
+        errno = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/* Drops whatever dd_try_lock_*() took */
+static void dd_release_lock(struct dump_dir *dd)
+{
+    /* Before removing .lock which wakes up the waiters */
+    flock(dd->dd_fd, LOCK_UN);
+    shared_locked_dds = g_list_remove(shared_locked_dds, dd);
+
+    if (dd->owns_lock)
+    {
+        /* Readers of this process left out by dd_try_lock_exclusive() */
+        dd_flock_shared_by_us(dd, LOCK_SH | LOCK_NB);
+        libreport_xunlinkat(dd->dd_fd, ".lock", /*only files*/0);
+    }
+    dd->owns_lock = 0;
+}
+
+/* timeout_ms is the longest time to wait for other process to unlock the
+ * directory, -1 means forever.
+ */
+static int dd_lock(struct dump_dir *dd, unsigned sleep_usec, int flags, int timeout_ms)
+{
+    if (dd->locked || dd->shared_lock)
         error_msg_and_die("Locking bug on '%s'", dd->dd_dirname);
 
     char pid_buf[sizeof(long)*3 + 2];
     snprintf(pid_buf, sizeof(pid_buf), "%lu", (long)getpid());
 
-    unsigned count = NO_TIME_FILE_COUNT;
+    const bool shared = flags & DD_OPEN_SHARED_LOCK;
+
+    /* Waiting for the lock and waiting for the missing files are woken up
+     * by changes of the directory, the sleep times are only upper limits
+     * for the cases inotify can't see, such as the lock owner's death.
+     */
+    int inotify_fd = -1;
+    gint64 wait_start = 0;
+    const gint64 deadline = timeout_ms < 0 ? -1 : g_get_monotonic_time() + (gint64)timeout_ms * 1000;
+    gint64 no_time_file_deadline = -1;
+    int r = 0;
 
  retry:
     while (1)
     {
-        int r = create_symlink_lockfile_at(dd->dd_fd, ".lock", pid_buf);
+        r = shared ? dd_try_lock_shared(dd, pid_buf) : dd_try_lock_exclusive(dd, pid_buf);
         if (r < 0)
-            return r; /* error */
-        if (r > 0 || errno == EALREADY)
+        {
+            /* error, don't leave .lock behind */
+            const int saved_errno = errno;
+            dd_release_lock(dd);
+            errno = saved_errno;
+            goto finito;
+        }
+        if (r > 0)
             break; /* locked successfully */
-        if (flags & DD_DONT_WAIT_FOR_LOCK)
+        if ((flags & DD_DONT_WAIT_FOR_LOCK)
+         || (deadline >= 0 && g_get_monotonic_time() >= deadline))
         {
+            if (wait_start != 0)
+                lock_wait_stats.timeouts++;
+            dd_release_lock(dd);
             errno = EAGAIN;
-            return -1;
+            r = -1;
+            goto finito;
+        }
+        if (wait_start == 0)
+        {
+            wait_start = g_get_monotonic_time();
+            lock_wait_stats.waits++;
+        }
+        if (inotify_fd < 0)
+        {
+            inotify_fd = dd_watch_lock(dd);
+            /* The lock could have been removed before the watch was added */
+            if (inotify_fd >= 0)
+                continue;
         }
         /* Other process has the lock, wait for it to go away */
-        usleep(sleep_usec);
+        dd_wait_for_lock_change(inotify_fd, sleep_usec, deadline);
     }
 
-    /* Reset errno to 0 only if errno is EALREADY (used by
-     * create_symlink_lockfile() to signal that the dump directory is already
-     * locked by us) */
-    if (!(dd->owns_lock = (errno != EALREADY)))
-        errno = 0;
-
     /* Are we called by dd_opendir (as opposed to dd_create)? */
     if (sleep_usec == WAIT_FOR_OTHER_PROCESS_USLEEP) /* yes */
     {
@@ -465,33 +772,67 @@ static int dd_lock(struct dump_dir *dd, unsigned sleep_usec, int flags)
          */
         if (missing_file)
         {
-            if (dd->owns_lock)
-                libreport_xunlinkat(dd->dd_fd, ".lock", /*only files*/0);
+            dd_release_lock(dd);
 
             log_notice("Unlocked '%s' (no or corrupted '%s' file)", dd->dd_dirname, missing_file);
-            if (--count == 0 || flags & DD_DONT_WAIT_FOR_LOCK)
+
+            const gint64 now = g_get_monotonic_time();
+            if (no_time_file_deadline < 0)
+                no_time_file_deadline = now + NO_TIME_FILE_COUNT * NO_TIME_FILE_USLEEP;
+
+            if (now >= no_time_file_deadline || flags & DD_DONT_WAIT_FOR_LOCK)
             {
                 errno = EISDIR; /* "this is an ordinary dir, not dump dir" */
-                return -1;
+                r = -1;
+                goto finito;
+            }
+            if (deadline >= 0 && now >= deadline)
+            {
+                errno = EAGAIN;
+                r = -1;
+                goto finito;
             }
-            usleep(NO_TIME_FILE_USLEEP);
+            if (inotify_fd < 0)
+                inotify_fd = dd_watch_lock(dd);
+            dd_wait_for_lock_change(inotify_fd, NO_TIME_FILE_USLEEP, deadline);
             goto retry;
         }
     }
 
-    dd->locked = true;
-    return 0;
+    /* Readers get a dump dir which can't be modified */
+    if (shared)
+        dd->shared_lock = 1;
+    else
+        dd->locked = true;
+    r = 0;
+
+ finito:
+    {
+        const int saved_errno = errno;
+
+        if (wait_start != 0)
+        {
+            const guint64 waited = g_get_monotonic_time() - wait_start;
+            lock_wait_stats.wait_usec += waited;
+            lock_wait_stats.max_wait_usec = MAX(lock_wait_stats.max_wait_usec, waited);
+            log_info("Waited %llu ms for lock of '%s'", (unsigned long long)waited / 1000, dd->dd_dirname);
+        }
+        if (inotify_fd >= 0)
+            close(inotify_fd);
+
+        errno = saved_errno;
+    }
+    return r;
 }
 
 static void dd_unlock(struct dump_dir *dd)
 {
-    if (dd->locked)
+    if (dd->locked || dd->shared_lock)
     {
-        if (dd->owns_lock)
-            libreport_xunlinkat(dd->dd_fd, ".lock", /*only files*/0);
+        dd_release_lock(dd);
 
-        dd->owns_lock = 0;
         dd->locked = 0;
+        dd->shared_lock = 0;
 
         log_info("Unlocked '%s/.lock'", dd->dd_dirname);
     }
@@ -943,13 +1284,13 @@ static char* rm_trailing_slashes(const char *dir)
     return g_strndup(dir, len);
 }
 
-static struct dump_dir *dd_do_open(struct dump_dir *dd, const char *dir, int flags)
+static struct dump_dir *dd_do_open(struct dump_dir *dd, const char *dir, int flags, int timeout_ms)
 {
     if (dir != NULL)
     {
         dd->dd_dirname = rm_trailing_slashes(dir);
         /* dd_do_open validates dd_fd */
-        dd->dd_fd = open(dd->dd_dirname, O_DIRECTORY | O_NOFOLLOW);
+        dd->dd_fd = open(dd->dd_dirname, O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
 
         struct stat stat_buf;
         if (dd->dd_fd < 0)
@@ -993,7 +1334,7 @@ static struct dump_dir *dd_do_open(struct dump_dir *dd, const char *dir, int fla
     }
 
     errno = 0;
-    if (dd_lock(dd, WAIT_FOR_OTHER_PROCESS_USLEEP, flags) < 0)
+    if (dd_lock(dd, WAIT_FOR_OTHER_PROCESS_USLEEP, flags, timeout_ms) < 0)
     {
         if (errno == EISDIR)
         {
@@ -1008,7 +1349,7 @@ static struct dump_dir *dd_do_open(struct dump_dir *dd, const char *dir, int fla
             goto fail_with_close;
         }
 
-        if (errno == EAGAIN && (flags & DD_DONT_WAIT_FOR_LOCK))
+        if (errno == EAGAIN && ((flags & DD_DONT_WAIT_FOR_LOCK) || timeout_ms >= 0))
         {
             log_debug("Can't access locked directory '%s'", dd->dd_dirname);
             goto fail_with_close;
@@ -1074,13 +1415,18 @@ struct dump_dir *dd_fdopendir(struct dump_dir *dd, int flags)
     if (dd->locked)
         error_msg_and_die("the dump directory is already locked");
 
-    return dd_do_open(dd, NULL, flags);
+    return dd_do_open(dd, NULL, flags, /*timeout_ms*/-1);
 }
 
 struct dump_dir *dd_opendir(const char *dir, int flags)
+{
+    return dd_opendir_timeout(dir, flags, /*timeout_ms*/-1);
+}
+
+struct dump_dir *dd_opendir_timeout(const char *dir, int flags, int timeout_ms)
 {
     struct dump_dir *dd = dd_init();
-    return dd_do_open(dd, dir, flags);
+    return dd_do_open(dd, dir, flags, timeout_ms);
 }
 
 /* Create a fresh empty debug dump dir which is owned bu the calling user. If
@@ -1185,7 +1531,7 @@ struct dump_dir *dd_create_skeleton(const char *dir, uid_t uid, mode_t mode, int
         goto fail;
     }
 
-    dd->dd_fd = open(dd->dd_dirname, O_DIRECTORY | O_NOFOLLOW);
+    dd->dd_fd = open(dd->dd_dirname, O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
     if (dd->dd_fd < 0)
     {
         perror_msg("Can't open newly created directory '%s'", dir);
@@ -1199,7 +1545,7 @@ struct dump_dir *dd_create_skeleton(const char *dir, uid_t uid, mode_t mode, int
         goto fail;
     }
 
-    if (dd_lock(dd, CREATE_LOCK_USLEEP, /*flags:*/ 0) < 0)
+    if (dd_lock(dd, CREATE_LOCK_USLEEP, /*flags:*/ 0, /*timeout_ms*/-1) < 0)
         goto fail;
 
     /* mkdir's mode (above) can be affected by umask, fix it */
@@ -1687,8 +2033,106 @@ next:
     return chown_res;
 }
 
+/* Compressed elements are stored under their own names and marked by an
+ * extended attribute holding "<compressor> <uncompressed size>". The attribute
+ * belongs to the inode, hence an element rewritten by any tool is plain again.
+ */
+#define DD_COMPRESSION_XATTR "user.libreport.compression"
+
+off_t libreport_compressed_element_size(int fd)
+{
+    char value[64];
+    const ssize_t len = fgetxattr(fd, DD_COMPRESSION_XATTR, value, sizeof(value) - 1);
+    if (len <= 0)
+        return -1;
+
+    value[len] = '\0';
+    unsigned long long size;
+    if (sscanf(value, "zstd %llu", &size) != 1)
+    {
+        log_notice("Unknown compression of element: '%s'", value);
+        return -1;
+    }
+
+    return size;
+}
+
+/* The uncompressed size is written by the owner of the element, the data
+ * are decompressed only if that size fits in the file system of fd_out, or
+ * in the memory if fd_out is not on a file system with limited size.
+ */
+static bool dd_decompressed_size_fits(int fd_out, off_t size)
+{
+    off_t available;
+    struct statvfs vfs;
+    if (fstatvfs(fd_out, &vfs) == 0 && vfs.f_blocks != 0)
+        available = (off_t)vfs.f_bavail * vfs.f_frsize;
+    else
+        available = (off_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+
+    if (size <= available)
+        return true;
+
+    error_msg("Uncompressed size of element %llu exceeds available %llu Bytes",
+              (unsigned long long)size, (unsigned long long)available);
+    return false;
+}
+
+/* Names of temporary files are ignored by the problem data loaders */
+static char *dd_temporary_element_name(const char *name)
+{
+    return g_strdup_printf("%s.tmp~", name);
+}
+
+int libreport_uncompressed_element_fd(int fd)
+{
+    const off_t size = libreport_compressed_element_size(fd);
+    if (size < 0)
+        return fd;
+
+    /* Consumers seek and map the elements, so the content is decompressed
+     * into memory backed file instead of being piped to them.
+     */
+    int content_fd = memfd_create("libreport-element", MFD_CLOEXEC);
+    if (content_fd < 0)
+    {
+        const int err = errno;
+        perror_msg("Can't create a file for decompressed element");
+        close(fd);
+        return -err;
+    }
+
+    if (!dd_decompressed_size_fits(content_fd, size))
+    {
+        close(fd);
+        close(content_fd);
+        return -EFBIG;
+    }
+
+    const int r = lseek(fd, 0, SEEK_SET) == 0 ? libreport_decompress_fd_ext(fd, content_fd, size) : -1;
+    close(fd);
+    if (r != 0 || lseek(content_fd, 0, SEEK_SET) != 0)
+    {
+        error_msg("Can't decompress element");
+        close(content_fd);
+        return -EIO;
+    }
+
+    return content_fd;
+}
+
 static char *load_text_from_file_descriptor(int fd, const char *path, int flags)
 {
+    if (fd >= 0)
+    {
+        fd = libreport_uncompressed_element_fd(fd);
+        if (fd < 0)
+        {
+            errno = -fd;
+            fd = -1;
+        }
+    }
+
     if (fd == -1)
     {
         if (!(flags & DD_FAIL_QUIETLY_ENOENT))
@@ -1953,7 +2397,18 @@ long dd_get_item_size(struct dump_dir *dd, const char *name)
 
     const char *error = NULL;
     if (r == 0)
+    {
         size = statbuf.st_size;
+
+        const int fd = openat(dd->dd_fd, name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+        if (fd >= 0)
+        {
+            const off_t uncompressed = libreport_compressed_element_size(fd);
+            if (uncompressed >= 0)
+                size = uncompressed;
+            close(fd);
+        }
+    }
     else if (r == -ENOENT)
         size = 0;
     else if (r == -EINVAL)
@@ -2002,7 +2457,10 @@ int dd_open_item(struct dump_dir *dd, const char *name, int flag)
     }
 
     if (flag == O_RDONLY)
-        return openat(dd->dd_fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    {
+        const int fd = openat(dd->dd_fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        return fd < 0 ? fd : libreport_uncompressed_element_fd(fd);
+    }
 
     if (!dd->locked)
         error_msg_and_die("dump_dir is not locked"); /* bug */
@@ -2439,142 +2897,266 @@ int dd_unpack_coredump(struct dump_dir *dd, const char *coredump_archive_filenam
     return 0;
 }
 
-/* flags - for future needs */
-int dd_create_archive(struct dump_dir *dd, const char *archive_name,
-        const_string_vector_const_ptr_t exclude_elements, int flags)
+/* Elements are read in large chunks to keep the compressor threads busy */
+#define DD_ARCHIVE_BUFFER_SIZE (1024 * 1024)
+
+int dd_archive_type_for_name(const char *archive_name)
 {
-    if (!g_str_has_suffix(archive_name, ".tar.gz"))
-        return -ENOSYS;
+    if (g_str_has_suffix(archive_name, ".tar.gz"))
+        return DD_ARCHIVE_TAR_GZ;
+    if (g_str_has_suffix(archive_name, ".tar.xz"))
+        return DD_ARCHIVE_TAR_XZ;
+    if (g_str_has_suffix(archive_name, ".tar.zst"))
+        return DD_ARCHIVE_TAR_ZST;
 
-    if (access(archive_name, F_OK) == 0)
-        return -EEXIST;
+    return -ENOSYS;
+}
 
-    int result = 0;
+static int archive_result(struct archive *a)
+{
+    const int err = archive_errno(a);
+    return err > 0 ? -err : -1;
+}
 
-    /* Create tar writer object */
-    struct archive *a;
-    struct archive_entry *entry = NULL;
+static int dd_archive_add_filter(struct archive *a, int type)
+{
+    int r;
+    const char *filter;
+    switch (type)
+    {
+        case DD_ARCHIVE_TAR_GZ:
+            /* libarchive compresses gzip streams in one thread only */
+            return archive_write_add_filter_gzip(a);
+        case DD_ARCHIVE_TAR_XZ:
+            filter = "xz";
+            r = archive_write_add_filter_xz(a);
+            break;
+        case DD_ARCHIVE_TAR_ZST:
+            filter = "zstd";
+            r = archive_write_add_filter_zstd(a);
+            break;
+        default:
+            return ARCHIVE_FATAL;
+    }
+
+    if (r != ARCHIVE_OK)
+        return r;
+
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > 1)
+    {
+        char threads[sizeof(long)*3 + 2];
+        snprintf(threads, sizeof(threads), "%ld", cpus);
+        /* Older libarchive doesn't know the option, compress in one thread then */
+        if (archive_write_set_filter_option(a, filter, "threads", threads) != ARCHIVE_OK)
+            log_debug("Can't compress %s in %s threads: %s", filter, threads, archive_error_string(a));
+    }
+
+    return ARCHIVE_OK;
+}
+
+/* Takes the ownership of fd */
+static int dd_archive_add_element(struct archive *a, struct archive_entry *entry,
+        const char *name, int fd, char *buffer)
+{
+    /* Archives contain the content of compressed elements */
+    fd = libreport_uncompressed_element_fd(fd);
+    if (fd < 0)
+    {
+        log_warning(_("Failed to add file to archive: %s"), name);
+        return fd;
+    }
+
+    int result = 0;
     struct stat st;
-    int archive_fd = -1;
-    char buff[8192];
-    int len;
-    int fd;
-    int r = 0;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        result = -EINVAL;
+        log_warning(_("Failed to add file to archive: %s"), name);
+        goto finito;
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    archive_entry_clear(entry);
+    archive_entry_set_pathname(entry, name);
+    archive_entry_copy_stat(entry, &st);
+    archive_entry_set_filetype(entry, AE_IFREG);
+    archive_entry_set_perm(entry, 0644);
+
     unsigned max_tries = 10; //because why not
     unsigned tries = 0;
-
-    a = archive_write_new();
-    if (a == NULL)
+retry:
+    switch (archive_write_header(a, entry))
     {
-        result = -1;
-        log_warning(_("Failed to allocate and initialize archive object"));
-        goto finito;
+        case ARCHIVE_WARN:
+            log_warning(_("%s"), archive_error_string(a));
+        case ARCHIVE_OK:
+            break;
+        case ARCHIVE_RETRY:
+            if (++tries < max_tries)
+            {
+                log_warning(_("Failed to write to archive, retrying..."));
+                goto retry;
+            }
+        default:
+            log_warning(_("Failed to write to archive: %s"),
+                    (tries == max_tries ?  "too many attempts" : archive_error_string(a)));
+            result = (tries == max_tries ? -1 : archive_result(a));
+            goto finito;
+    }
 
+    ssize_t len;
+    while ((len = libreport_safe_read(fd, buffer, DD_ARCHIVE_BUFFER_SIZE)) > 0)
+    {
+        if (archive_write_data(a, buffer, len) < 0)
+        {
+            log_warning(_("Failed to write to archive: %s"), archive_error_string(a));
+            result = archive_result(a);
+            goto finito;
+        }
     }
 
-    r = archive_write_add_filter_gzip(a);
-    if (r == ARCHIVE_FATAL)
+    if (len < 0)
     {
-        result = -archive_errno(a);
-        log_warning(_("%s"), archive_error_string(a));
-        return result;
+        result = -errno;
+        log_warning(_("Failed to add file to archive: %s"), name);
     }
 
-    r = archive_write_set_format_pax_restricted(a);
-    if (r != ARCHIVE_OK)
+finito:
+    close(fd);
+    return result;
+}
+
+int dd_create_archive_fd(struct dump_dir *dd, int archive_fd, int type,
+        const_string_vector_const_ptr_t exclude_elements, int flags)
+{
+    if (type < DD_ARCHIVE_TAR_GZ || type > DD_ARCHIVE_TAR_ZST)
+        return -ENOSYS;
+
+    int result = 0;
+    struct archive_entry *entry = NULL;
+    char *buffer = NULL;
+
+    /* Create tar writer object */
+    struct archive *a = archive_write_new();
+    if (a == NULL)
     {
-        result = -archive_errno(a);
-        log_warning(_("%s"), archive_error_string(a));
-        return result;
+        log_warning(_("Failed to allocate and initialize archive object"));
+        return -1;
     }
 
-    archive_fd = open(archive_name, O_CREAT|O_WRONLY|O_EXCL, S_IRUSR|S_IWUSR);
-    if (archive_fd == -1)
-        return -errno;
-    r = archive_write_open_fd(a, archive_fd);
-    if (r == ARCHIVE_FATAL)
+    if (dd_archive_add_filter(a, type) == ARCHIVE_FATAL
+        || archive_write_set_format_pax_restricted(a) != ARCHIVE_OK
+        || archive_write_open_fd(a, archive_fd) == ARCHIVE_FATAL)
     {
-        result = -archive_errno(a);
+        result = archive_result(a);
         log_warning(_("%s"), archive_error_string(a));
+        archive_write_free(a);
         return result;
     }
 
-    /* Write data to the tarball */
-    dd_init_next_file(dd);
-    char *short_name, *full_name;
+    /* Opened elements and their names, the first 'added' ones are closed */
+    GArray *fds = g_array_new(FALSE, FALSE, sizeof(int));
+    GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+    unsigned added = 0;
+
     entry = archive_entry_new();
     if (entry == NULL)
     {
         result = -1;
         log_warning(_("Failed to allocate and initialize archive entry object"));
-        return result;
+        goto finito;
+    }
 
+    if (dd_init_next_file(dd) == NULL)
+    {
+        result = -EIO;
+        goto finito;
     }
 
-    while (dd_get_next_file(dd, &short_name, &full_name))
+    /* All elements are opened before writing, which can take long if the
+     * archive is consumed slowly. libreport never truncates elements, so the
+     * opened files stay intact when dd is unlocked.
+     */
+    struct dirent *dent;
+    while (_dd_get_next_file_dent(dd, &dent))
     {
-        if (!(exclude_elements && libreport_is_in_string_list(short_name, exclude_elements)))
+        if (exclude_elements && libreport_is_in_string_list(dent->d_name, exclude_elements))
+            continue;
+
+        const int fd = openat(dd->dd_fd, dent->d_name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd == -1)
         {
-            stat(full_name, &st);
-            archive_entry_set_pathname(entry, short_name);
-            archive_entry_copy_stat(entry, &st);
-            archive_entry_set_filetype(entry, AE_IFREG);
-            archive_entry_set_perm(entry, 0644);
+            result = -errno;
+            log_warning(_("Failed to add file to archive: %s"), dent->d_name);
+            goto finito;
+        }
 
-retry:
-            r = archive_write_header(a, entry);
-            switch (r)
-            {
-                case ARCHIVE_WARN:
-                    log_warning(_("%s"), archive_error_string(a));
-                case ARCHIVE_OK:
-                    break;
-                case ARCHIVE_RETRY:
-                    if (++tries < max_tries)
-                    {
-                        log_warning(_("Failed to write to archive, retrying..."));
-                        goto retry;
-                    }
-                case ARCHIVE_FATAL:
-                    log_warning(_("Failed to write to archive: %s"),
-                            (tries == max_tries ?  "too many attempts" : archive_error_string(a)));
-                    result = (tries == max_tries ? -1 : -archive_errno(a));
-                    goto finito;
-            }
+        g_ptr_array_add(names, g_strdup(dent->d_name));
+        g_array_append_val(fds, fd);
+    }
+    dd_clear_next_file(dd);
 
-            archive_entry_clear(entry);
-            fd = open(full_name, O_RDONLY);
-            if (fd == -1)
-            {
-                result = -errno;
-                log_warning(_("Failed to add file to archive: %s"), full_name);
-                goto finito;
-            }
-            len = read(fd, buff, sizeof (buff));
-            while (len > 0)
-            {
-                archive_write_data(a, buff, len);
-                len = read(fd, buff, sizeof (buff));
-            }
-            close(fd);
+    if (flags & DD_ARCHIVE_UNLOCK)
+        dd_unlock(dd);
+
+    /* Write data to the tarball */
+    buffer = g_malloc(DD_ARCHIVE_BUFFER_SIZE);
+    for (; added < fds->len; ++added)
+    {
+        result = dd_archive_add_element(a, entry, g_ptr_array_index(names, added),
+                g_array_index(fds, int, added), buffer);
+        if (result != 0)
+        {
+            ++added; /* closed by dd_archive_add_element() */
+            goto finito;
         }
+    }
 
-        g_clear_pointer(&short_name, g_free);
-        g_clear_pointer(&full_name, g_free);
+finito:
+    dd_clear_next_file(dd);
+    for (; added < fds->len; ++added)
+        close(g_array_index(fds, int, added));
+    g_array_free(fds, TRUE);
+    g_ptr_array_free(names, TRUE);
+    g_free(buffer);
+    if (entry != NULL)
+        archive_entry_free(entry);
 
-    } /*while*/
+    /* Flushes the compressor, the archive is incomplete if this fails */
+    if (archive_write_close(a) != ARCHIVE_OK && result == 0)
+    {
+        log_warning(_("Failed to write to archive: %s"), archive_error_string(a));
+        result = archive_result(a);
+    }
+    archive_write_free(a);
 
-finito:
+    return result;
+}
 
-    archive_entry_free(entry);
-    archive_write_close(a);
-    r = close(archive_fd);
-    if (r == -1)
+int dd_create_archive(struct dump_dir *dd, const char *archive_name,
+        const_string_vector_const_ptr_t exclude_elements, int flags)
+{
+    const int type = dd_archive_type_for_name(archive_name);
+    if (type < 0)
+        return type;
+
+    int archive_fd = open(archive_name, O_CREAT | O_WRONLY | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (archive_fd == -1)
+        return -errno;
+
+    int result = dd_create_archive_fd(dd, archive_fd, type, exclude_elements, flags);
+
+    if (close(archive_fd) != 0 && result == 0)
     {
+        result = -errno;
         log_warning(_("Failed to close archive"));
-        return -errno;
     }
-    archive_write_free(a);
+
+    /* Don't leave truncated archives behind */
+    if (result != 0)
+        unlink(archive_name);
 
     return result;
 }
@@ -2603,3 +3185,199 @@ off_t dd_copy_fd(struct dump_dir *dd, const char *name, int fd, int copy_flags,
 
     return read;
 }
+
+static int compress_element(int src_fd, int dst_fd, off_t size, char *buffer)
+{
+    struct archive *a = archive_write_new();
+    if (a == NULL)
+        return -ENOMEM;
+
+    int result = 0;
+    if (archive_write_set_format_raw(a) != ARCHIVE_OK
+        || dd_archive_add_filter(a, DD_ARCHIVE_TAR_ZST) != ARCHIVE_OK
+        || archive_write_open_fd(a, dst_fd) != ARCHIVE_OK)
+    {
+        log_warning(_("Failed to compress element: %s"), archive_error_string(a));
+        result = archive_result(a);
+        goto finito;
+    }
+
+    struct archive_entry *entry = archive_entry_new();
+    archive_entry_set_pathname(entry, "data");
+    archive_entry_set_filetype(entry, AE_IFREG);
+    archive_entry_set_size(entry, size);
+    const int r = archive_write_header(a, entry);
+    archive_entry_free(entry);
+    if (r != ARCHIVE_OK)
+    {
+        log_warning(_("Failed to compress element: %s"), archive_error_string(a));
+        result = archive_result(a);
+        goto finito;
+    }
+
+    ssize_t len;
+    while ((len = libreport_safe_read(src_fd, buffer, DD_ARCHIVE_BUFFER_SIZE)) > 0)
+    {
+        if (archive_write_data(a, buffer, len) < 0)
+        {
+            log_warning(_("Failed to compress element: %s"), archive_error_string(a));
+            result = archive_result(a);
+            goto finito;
+        }
+    }
+
+    if (len < 0)
+        result = -errno;
+
+ finito:
+    if (archive_write_close(a) != ARCHIVE_OK && result == 0)
+    {
+        log_warning(_("Failed to compress element: %s"), archive_error_string(a));
+        result = archive_result(a);
+    }
+    archive_write_free(a);
+
+    return result;
+}
+
+int dd_compress_item(struct dump_dir *dd, const char *name)
+{
+    if (!dd->locked)
+        error_msg_and_die("dump_dir is not opened"); /* bug */
+
+    if (!dd_validate_element_name(name))
+    {
+        error_msg("Cannot compress item. '%s' is not a valid file name", name);
+        return -EINVAL;
+    }
+
+    const int src_fd = secure_openat_read(dd->dd_fd, name);
+    if (src_fd < 0)
+        return -ENOENT;
+
+    struct stat src_st;
+    if (fstat(src_fd, &src_st) != 0)
+    {
+        const int err = errno;
+        close(src_fd);
+        return -err;
+    }
+
+    if (libreport_compressed_element_size(src_fd) >= 0)
+    {
+        close(src_fd);
+        return 0;
+    }
+
+    /* Written aside and renamed over the element, readers which don't lock
+     * the directory see either the plain or the compressed element.
+     */
+    g_autofree char *tmp_name = dd_temporary_element_name(name);
+    const int dst_fd = create_new_file_at(dd->dd_fd, O_WRONLY, tmp_name, dd->dd_uid, dd->dd_gid, dd->mode);
+    if (dst_fd < 0)
+    {
+        close(src_fd);
+        return -EIO;
+    }
+
+    posix_fadvise(src_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    g_autofree char *buffer = g_malloc(DD_ARCHIVE_BUFFER_SIZE);
+    int result = compress_element(src_fd, dst_fd, src_st.st_size, buffer);
+    close(src_fd);
+
+    struct stat dst_st = { 0 };
+    if (result == 0 && fstat(dst_fd, &dst_st) != 0)
+        result = -errno;
+
+    /* Already compressed data, e.g. archives, don't shrink */
+    bool replace = result == 0 && dst_st.st_size < src_st.st_size;
+    if (replace)
+    {
+        char value[sizeof("zstd ") + sizeof(long long)*3];
+        snprintf(value, sizeof(value), "zstd %llu", (unsigned long long)src_st.st_size);
+        if (fsetxattr(dst_fd, DD_COMPRESSION_XATTR, value, strlen(value), 0) != 0)
+        {
+            result = -errno;
+            if (errno == ENOTSUP)
+                log_notice("File system of '%s' doesn't support extended attributes", dd->dd_dirname);
+            else
+                perror_msg("Can't mark '%s' compressed", name);
+            replace = false;
+        }
+    }
+
+    if (close(dst_fd) != 0 && replace)
+    {
+        result = -errno;
+        perror_msg("Can't write compressed '%s'", name);
+        replace = false;
+    }
+
+    if (replace && renameat(dd->dd_fd, tmp_name, dd->dd_fd, name) != 0)
+    {
+        result = -errno;
+        perror_msg("Can't replace '%s' with compressed data", name);
+        replace = false;
+    }
+
+    if (!replace)
+        unlinkat(dd->dd_fd, tmp_name, /*only files*/0);
+    else
+        log_debug("Compressed '%s' from %llu to %llu bytes", name,
+                  (unsigned long long)src_st.st_size, (unsigned long long)dst_st.st_size);
+
+    return result;
+}
+
+int dd_decompress_item(struct dump_dir *dd, const char *name)
+{
+    if (!dd->locked)
+        error_msg_and_die("dump_dir is not opened"); /* bug */
+
+    if (!dd_validate_element_name(name))
+    {
+        error_msg("Cannot decompress item. '%s' is not a valid file name", name);
+        return -EINVAL;
+    }
+
+    const int src_fd = secure_openat_read(dd->dd_fd, name);
+    if (src_fd < 0)
+        return -ENOENT;
+
+    const off_t size = libreport_compressed_element_size(src_fd);
+    if (size < 0)
+    {
+        close(src_fd);
+        return 0;
+    }
+
+    g_autofree char *tmp_name = dd_temporary_element_name(name);
+    const int dst_fd = create_new_file_at(dd->dd_fd, O_WRONLY, tmp_name, dd->dd_uid, dd->dd_gid, dd->mode);
+    if (dst_fd < 0)
+    {
+        close(src_fd);
+        return -EIO;
+    }
+
+    int result = -EFBIG;
+    if (dd_decompressed_size_fits(dst_fd, size))
+        result = libreport_decompress_fd_ext(src_fd, dst_fd, size) == 0 ? 0 : -EIO;
+    close(src_fd);
+
+    if (close(dst_fd) != 0 && result == 0)
+    {
+        result = -errno;
+        perror_msg("Can't write decompressed '%s'", name);
+    }
+
+    if (result == 0 && renameat(dd->dd_fd, tmp_name, dd->dd_fd, name) != 0)
+    {
+        result = -errno;
+        perror_msg("Can't replace '%s' with decompressed data", name);
+    }
+
+    if (result != 0)
+        unlinkat(dd->dd_fd, tmp_name, /*only files*/0);
+
+    return result;
+}
@@ -229,6 +229,208 @@ static void load_config_files(const char *dir_path)
     }
 }
 
+/* Persistent cache of the parsed event definitions, see config_cache.c
+ *
+ * Only the definitions from EVENTS_DIR are cached, the configuration files
+ * are small and users edit them.
+ */
+#define EVENT_CACHE_NAME "event_definitions"
+#define EVENT_OPTION_CACHE_TYPE "(msmsmsmsiib)"
+#define EVENT_CACHE_TYPE "(smsmsmsmsmsmsmsbxbbbmsbasa"EVENT_OPTION_CACHE_TYPE")"
+
+/* The definitions are translated while parsed, so the cache is valid only
+ * for the locale it was created in.
+ */
+static char *event_cache_key(void)
+{
+    g_autofree char *locale = g_strdup(setlocale(LC_ALL, NULL));
+    strchrnul(locale, '.')[0] = '\0';
+    return g_strdup_printf("%s:%s", EVENTS_DIR, locale);
+}
+
+static GVariant *event_config_to_variant(event_config_t *ec)
+{
+    GVariantBuilder options;
+    g_variant_builder_init(&options, G_VARIANT_TYPE("a"EVENT_OPTION_CACHE_TYPE));
+    for (GList *o = ec->options; o != NULL; o = g_list_next(o))
+    {
+        const event_option_t *opt = o->data;
+        g_variant_builder_add(&options, EVENT_OPTION_CACHE_TYPE,
+                opt->eo_name, opt->eo_value, opt->eo_label, opt->eo_note_html,
+                (gint32)opt->eo_type, (gint32)opt->eo_allow_empty, (gboolean)opt->is_advanced);
+    }
+
+    GVariantBuilder imported;
+    g_variant_builder_init(&imported, G_VARIANT_TYPE_STRING_ARRAY);
+    for (GList *i = ec->ec_imported_event_names; i != NULL; i = g_list_next(i))
+        g_variant_builder_add(&imported, "s", (const char *)i->data);
+
+    return g_variant_new(EVENT_CACHE_TYPE,
+            ec_get_name(ec),
+            ec_get_screen_name(ec),
+            ec_get_description(ec),
+            ec_get_long_desc(ec),
+            ec->ec_requires_items,
+            ec->ec_exclude_items_by_default,
+            ec->ec_include_items_by_default,
+            ec->ec_exclude_items_always,
+            (gboolean)ec->ec_exclude_binary_items,
+            (gint64)ec->ec_minimal_rating,
+            (gboolean)ec->ec_skip_review,
+            (gboolean)ec->ec_sending_sensitive_data,
+            (gboolean)ec->ec_supports_restricted_access,
+            ec->ec_restricted_access_option,
+            (gboolean)ec->ec_requires_details,
+            &imported,
+            &options);
+}
+
+static event_config_t *event_config_from_variant(GVariant *event)
+{
+    const char *name;
+    const char *screen_name;
+    const char *description;
+    const char *long_desc;
+    gboolean exclude_binary_items;
+    gint64 minimal_rating;
+    gboolean skip_review;
+    gboolean sending_sensitive_data;
+    gboolean supports_restricted_access;
+    gboolean requires_details;
+    GVariantIter *imported;
+    GVariantIter *options;
+
+    g_variant_get_child(event, 0, "&s", &name);
+    event_config_t *ec = new_event_config(name);
+
+    g_variant_get(event, "(&sm&sm&sm&smsmsmsmsbxbbbmsbasa"EVENT_OPTION_CACHE_TYPE")",
+            &name,
+            &screen_name,
+            &description,
+            &long_desc,
+            &ec->ec_requires_items,
+            &ec->ec_exclude_items_by_default,
+            &ec->ec_include_items_by_default,
+            &ec->ec_exclude_items_always,
+            &exclude_binary_items,
+            &minimal_rating,
+            &skip_review,
+            &sending_sensitive_data,
+            &supports_restricted_access,
+            &ec->ec_restricted_access_option,
+            &requires_details,
+            &imported,
+            &options);
+
+    ec_set_screen_name(ec, screen_name);
+    ec_set_description(ec, description);
+    ec_set_long_desc(ec, long_desc);
+    ec->ec_exclude_binary_items = exclude_binary_items;
+    ec->ec_minimal_rating = minimal_rating;
+    ec->ec_skip_review = skip_review;
+    ec->ec_sending_sensitive_data = sending_sensitive_data;
+    ec->ec_supports_restricted_access = supports_restricted_access;
+    ec->ec_requires_details = requires_details;
+
+    char *imported_name;
+    while (g_variant_iter_next(imported, "s", &imported_name))
+        ec->ec_imported_event_names = g_list_prepend(ec->ec_imported_event_names, imported_name);
+    ec->ec_imported_event_names = g_list_reverse(ec->ec_imported_event_names);
+    g_variant_iter_free(imported);
+
+    gint32 type;
+    gint32 allow_empty;
+    gboolean is_advanced;
+    event_option_t *opt = new_event_option();
+    while (g_variant_iter_next(options, EVENT_OPTION_CACHE_TYPE,
+                &opt->eo_name, &opt->eo_value, &opt->eo_label, &opt->eo_note_html,
+                &type, &allow_empty, &is_advanced))
+    {
+        opt->eo_type = type;
+        opt->eo_allow_empty = allow_empty;
+        opt->is_advanced = is_advanced;
+        ec->options = g_list_prepend(ec->options, opt);
+        opt = new_event_option();
+    }
+    free_event_option(opt);
+    ec->options = g_list_reverse(ec->options);
+    g_variant_iter_free(options);
+
+    return ec;
+}
+
+static bool load_cached_event_definitions(const char *key)
+{
+    GPtrArray *sources = NULL;
+    GVariant *events = libreport_load_config_cache(EVENT_CACHE_NAME, key,
+            G_VARIANT_TYPE("a"EVENT_CACHE_TYPE), &sources);
+    if (events == NULL)
+        return false;
+
+    g_ptr_array_free(sources, TRUE);
+
+    GVariantIter iter;
+    GVariant *event;
+    g_variant_iter_init(&iter, events);
+    while ((event = g_variant_iter_next_value(&iter)) != NULL)
+    {
+        event_config_t *event_config = event_config_from_variant(event);
+        g_hash_table_replace(g_event_config_list, g_strdup(ec_get_name(event_config)), event_config);
+        g_variant_unref(event);
+    }
+    g_variant_unref(events);
+
+    return true;
+}
+
+static void save_cached_event_definitions(const char *key, GPtrArray *sources)
+{
+    GVariantBuilder events;
+    g_variant_builder_init(&events, G_VARIANT_TYPE("a"EVENT_CACHE_TYPE));
+
+    GHashTableIter iter;
+    event_config_t *event_config;
+    g_hash_table_iter_init(&iter, g_event_config_list);
+    while (g_hash_table_iter_next(&iter, NULL, (void **)&event_config))
+        g_variant_builder_add_value(&events, event_config_to_variant(event_config));
+
+    libreport_save_config_cache(EVENT_CACHE_NAME, key, sources, g_variant_builder_end(&events));
+}
+
+static void load_event_definitions(void)
+{
+    g_autofree char *key = event_cache_key();
+    if (load_cached_event_definitions(key))
+        return;
+
+    GPtrArray *sources = libreport_new_config_sources();
+    /* Stat before reading, so modifications made meanwhile are noticed */
+    libreport_add_config_source(sources, EVENTS_DIR);
+
+    GList *event_files = libreport_get_file_list(EVENTS_DIR, "xml");
+    while (event_files)
+    {
+        file_obj_t *file = (file_obj_t *)event_files->data;
+
+        event_config_t *event_config = get_event_config(file->filename);
+        bool new_config = (!event_config);
+        if (new_config)
+           event_config = new_event_config(file->filename);
+
+        libreport_add_config_source(sources, file->fullpath);
+        load_event_description_from_file(event_config, file->fullpath);
+
+        if (new_config)
+            g_hash_table_replace(g_event_config_list, g_strdup(ec_get_name(event_config)), event_config);
+
+        libreport_free_file_obj(file);
+        event_files = g_list_delete_link(event_files, event_files);
+    }
+
+    save_cached_event_definitions(key, sources);
+    g_ptr_array_free(sources, TRUE);
+}
+
 /* (Re)loads data from /etc/abrt/events/foo.{xml,conf} and $XDG_CACHE_HOME/abrt/events/foo.conf */
 GHashTable *load_event_config_data(void)
 {
@@ -252,24 +454,7 @@ GHashTable *load_event_config_data(void)
                 /*value_destroy_func:*/ free
         );
 
-    GList *event_files = libreport_get_file_list(EVENTS_DIR, "xml");
-    while (event_files)
-    {
-        file_obj_t *file = (file_obj_t *)event_files->data;
-
-        event_config_t *event_config = get_event_config(file->filename);
-        bool new_config = (!event_config);
-        if (new_config)
-           event_config = new_event_config(file->filename);
-
-        load_event_description_from_file(event_config, file->fullpath);
-
-        if (new_config)
-            g_hash_table_replace(g_event_config_list, g_strdup(ec_get_name(event_config)), event_config);
-
-        libreport_free_file_obj(file);
-        event_files = g_list_delete_link(event_files, event_files);
-    }
+    load_event_definitions();
 
     /* EVENTS_DIR      -> /usr/share/libreport/events/$EVENT_NAME.xml
      *   - event xml definition files
@@ -26,6 +26,14 @@ static bool rejected_name(const char *name, char **v, int flags)
     return r;
 }
 
+/* Text items may be megabytes long and the size is cached in the item */
+static unsigned long text_item_size(struct problem_item *item)
+{
+    unsigned long size = 0;
+    problem_item_get_size(item, &size);
+    return size;
+}
+
 static
 char *make_description_item_multiline(const char *name, const char *content)
 {
@@ -102,7 +110,7 @@ char *libreport_make_description(problem_data_t *problem_data, char **names_to_s
             && rejected_name(key, names_to_skip, desc_flags))
             continue;
 
-        struct problem_item *item = g_hash_table_lookup(problem_data, key);
+        struct problem_item *item = problem_data_get_item_or_NULL(problem_data, key);
         if (!item)
             continue;
 
@@ -197,7 +205,7 @@ char *libreport_make_description(problem_data_t *problem_data, char **names_to_s
                 && rejected_name(key, names_to_skip, desc_flags))
                 continue;
 
-            struct problem_item *item = g_hash_table_lookup(problem_data, key);
+            struct problem_item *item = problem_data_get_item_or_NULL(problem_data, key);
             if (!item)
                 continue;
 
@@ -205,7 +213,7 @@ char *libreport_make_description(problem_data_t *problem_data, char **names_to_s
                 continue;
 
             if ((item->flags & CD_FLAG_BIN)
-             || ((item->flags & CD_FLAG_TXT) && strlen(item->content) > max_text_size)
+             || ((item->flags & CD_FLAG_TXT) && text_item_size(item) > max_text_size)
             ) {
                 if (append_empty_line)
                     g_string_append_c(buf_dsc, '\n');
@@ -255,7 +263,7 @@ char *libreport_make_description(problem_data_t *problem_data, char **names_to_s
                 && rejected_name(key, names_to_skip, desc_flags))
                 continue;
 
-            struct problem_item *item = g_hash_table_lookup(problem_data, key);
+            struct problem_item *item = problem_data_get_item_or_NULL(problem_data, key);
             if (!item)
                 continue;
 
@@ -263,7 +271,7 @@ char *libreport_make_description(problem_data_t *problem_data, char **names_to_s
                 continue;
 
             if ((item->flags & CD_FLAG_TXT)
-                && (strlen(item->content) <= max_text_size
+                && (text_item_size(item) <= max_text_size
                     || (is_kernel_oops && strcmp(key, FILENAME_BACKTRACE) == 0)))
             {
                 g_autofree char *formatted = problem_item_format(item);
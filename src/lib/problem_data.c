@@ -18,16 +18,68 @@
 */
 #include "internal_libreport.h"
 
+/* Dump directory shared by all lazily loaded items of one problem data */
+struct lazy_dump_dir
+{
+    unsigned refs;
+    int dir_fd;
+    int flags;
+};
+
+/* Element file content of a lazily loaded item comes from */
+struct problem_item_source
+{
+    struct lazy_dump_dir *dir;
+    dev_t dev;
+    ino_t ino;
+    char name[];
+};
+
+static void load_item_source(struct problem_item *item);
+
+static void free_item_source(struct problem_item_source *source)
+{
+    if (--source->dir->refs == 0)
+    {
+        close(source->dir->dir_fd);
+        g_free(source->dir);
+    }
+    g_free(source);
+}
+
+static void release_problem_item_content(struct problem_item *item)
+{
+    if (item->mapped_size != 0)
+        munmap(item->content, item->mapped_size);
+    else
+        g_free(item->content);
+
+    if (item->source != NULL)
+        free_item_source(item->source);
+
+    item->content = NULL;
+    item->mapped_size = 0;
+    item->source = NULL;
+}
+
 static void free_problem_item(void *ptr)
 {
     if (ptr)
     {
         struct problem_item *item = (struct problem_item *)ptr;
-        g_free(item->content);
+        release_problem_item_content(item);
         g_free(item);
     }
 }
 
+void problem_item_set_content(struct problem_item *item, const char *content)
+{
+    char *copy = g_strdup(content);
+    release_problem_item_content(item);
+    item->content = copy;
+    item->size = PROBLEM_ITEM_UNINITIALIZED_SIZE;
+}
+
 char *problem_item_format(struct problem_item *item)
 {
     if (!item)
@@ -38,9 +90,10 @@ char *problem_item_format(struct problem_item *item)
         errno = 0;
         char *end;
         /* On x32 arch, time_t is wider than long. Must use strtoll */
-        long long ll = strtoll(item->content, &end, 10);
+        const char *content = problem_item_get_content(item);
+        long long ll = strtoll(content, &end, 10);
         time_t time = ll;
-        if (!errno && *end == '\0' && end != item->content
+        if (!errno && *end == '\0' && end != content
          && ll == time /* there was no truncation in long long -> time_t conv */
         ) {
             char timeloc[256];
@@ -62,22 +115,50 @@ int problem_item_get_size(struct problem_item *item, unsigned long *size)
 
     if (item->flags & CD_FLAG_TXT)
     {
-        *size = item->size = strlen(item->content);
+        *size = item->size = strlen(problem_item_get_content(item));
         return 0;
     }
 
     /* else if (item->flags & CD_FLAG_BIN) */
 
-    struct stat statbuf;
-    statbuf.st_size = 0;
-
-    if (stat(item->content, &statbuf) != 0)
+    int fd = open(item->content, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
         return -errno;
 
+    struct stat statbuf;
+    statbuf.st_size = libreport_compressed_element_size(fd);
+    if (statbuf.st_size < 0 && fstat(fd, &statbuf) != 0)
+    {
+        const int err = errno;
+        close(fd);
+        return -err;
+    }
+    close(fd);
+
     *size = item->size = statbuf.st_size;
     return 0;
 }
 
+int problem_item_open_file(struct problem_item *item)
+{
+    if (!(item->flags & CD_FLAG_BIN))
+        return -EINVAL;
+
+    const int fd = open(item->content, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+
+    return libreport_uncompressed_element_fd(fd);
+}
+
+char *problem_item_get_content(struct problem_item *item)
+{
+    if (item->source != NULL)
+        load_item_source(item);
+
+    return item->content;
+}
+
 /* problem_data["name"] = { "content", CD_FLAG_foo_bits } */
 
 problem_data_t *problem_data_new(void)
@@ -141,8 +222,8 @@ void problem_data_add_basics(problem_data_t *pd)
                  */
                 if (item->flags & CD_FLAG_BIN)
                     continue;
-                g_checksum_update(hash, (unsigned char *)item->content,
-                                  strlen(item->content));
+                const char *content = problem_item_get_content(item);
+                g_checksum_update(hash, (unsigned char *)content, strlen(content));
             }
             g_list_free(list);
 
@@ -186,9 +267,10 @@ void problem_data_add_current_process_data(problem_data_t *pd)
     }
 }
 
-struct problem_item *problem_data_add_ext(problem_data_t *problem_data,
+/* Like problem_data_add_ext() but takes ownership of content */
+static struct problem_item *problem_data_add_take(problem_data_t *problem_data,
                 const char *name,
-                const char *content,
+                char *content,
                 unsigned flags,
                 unsigned long size)
 {
@@ -198,7 +280,7 @@ struct problem_item *problem_data_add_ext(problem_data_t *problem_data,
         flags |= CD_FLAG_ISNOTEDITABLE;
 
     struct problem_item *item = g_new0(struct problem_item, 1);
-    item->content = g_strdup(content);
+    item->content = content;
     item->flags = flags;
     item->size = size;
     g_hash_table_replace(problem_data, g_strdup(name), item);
@@ -206,6 +288,15 @@ struct problem_item *problem_data_add_ext(problem_data_t *problem_data,
     return item;
 }
 
+struct problem_item *problem_data_add_ext(problem_data_t *problem_data,
+                const char *name,
+                const char *content,
+                unsigned flags,
+                unsigned long size)
+{
+    return problem_data_add_take(problem_data, name, g_strdup(content), flags, size);
+}
+
 void problem_data_add(problem_data_t *problem_data,
                 const char *name,
                 const char *content,
@@ -241,6 +332,15 @@ void problem_data_add_file(problem_data_t *pd, const char *name, const char *pat
 }
 
 
+struct problem_item *problem_data_get_item_or_NULL(problem_data_t *problem_data, const char *key)
+{
+    struct problem_item *item = g_hash_table_lookup(problem_data, key);
+    if (item != NULL && item->source != NULL)
+        load_item_source(item);
+
+    return item;
+}
+
 char *problem_data_get_content_or_die(problem_data_t *problem_data, const char *key)
 {
     INITIALIZE_LIBREPORT();
@@ -315,6 +415,67 @@ static const char *const always_text_files[] = {
     FILENAME_OS_RELEASE,
     NULL
 };
+
+/* Elements up to this size are read by a single read(). Bigger elements are
+ * probed first and read completely only if the probe looks like text.
+ */
+#define IS_TEXT_FILE_AT_PROBE_SIZE (4*1024)
+
+/* Of control chars, text elements may contain only tab and newline */
+#define TEXT_ELEMENT_SANITIZE (SANITIZE_ALL & ~SANITIZE_LF & ~SANITIZE_TAB)
+
+/* Returns CD_FLAG_TXT if the first r Bytes of an element look like text;
+ * otherwise returns CD_FLAG_BIN.
+ *
+ * If sanitized is not NULL, the Bytes are sanitized in the same pass and
+ * the sanitized copy is stored there (NULL if the Bytes can be used as is).
+ */
+static int classify_element_data(const char *name, const unsigned char *buf, ssize_t r, char **sanitized)
+{
+    char *text = NULL;
+    int flags = CD_FLAG_TXT;
+
+    /* Some files in our dump directories are known to always be textual */
+    const char *base = strrchr(name, '/');
+    if (base && libreport_is_in_string_list(base + 1, always_text_files))
+    {
+        if (sanitized)
+            text = libreport_sanitize_utf8_ext((const char *)buf, r, TEXT_ELEMENT_SANITIZE, NULL);
+        goto finito;
+    }
+
+    /* Every once in a while, even a text file contains a few garbled
+     * or unexpected non-ASCII chars. We should not declare it "binary".
+     *
+     * Used to have RATIO = 50 (2%), but then came Fedora 19 with
+     * os_release = "Schrödinger's Cat". Bumped to 10%.
+     * Alternatives: add os_release to always_text_files[]
+     * or add "if it is valid Unicode, then it's text" check here.
+     *
+     * Replaced crude "buf[r] > 0x7e is bad" logic with
+     * "if it is a broken Unicode, then it's bad".
+     *
+     * We don't like NULs and other control chars very much, any of them
+     * makes the data binary for sure.
+     */
+    const unsigned RATIO = 10;
+    struct libreport_text_stats stats = { 0 };
+    text = libreport_sanitize_utf8_ext((const char *)buf, r, TEXT_ELEMENT_SANITIZE, &stats);
+
+    unsigned total_chars = r + RATIO;
+    unsigned bad_chars = stats.bad_chars + 1; /* 1 prevents division by 0 later */
+    if (stats.control_chars != 0 || (total_chars / bad_chars) < RATIO)
+        flags = CD_FLAG_BIN; /* it's binary */
+
+finito:
+    if (sanitized && flags == CD_FLAG_TXT)
+        *sanitized = text;
+    else
+        g_free(text);
+
+    return flags;
+}
+
 static int is_text_file_at(int dir_fd, const char *name, char **content, ssize_t *sz, int *file_fd)
 {
     /* We were using magic.h API to check for file being text, but it thinks
@@ -326,6 +487,10 @@ static int is_text_file_at(int dir_fd, const char *name, char **content, ssize_t
     if (fd < 0)
         return fd; /* it's not text (because it does not exist! :) */
 
+    fd = libreport_uncompressed_element_fd(fd);
+    if (fd < 0)
+        return fd;
+
     off_t size = lseek(fd, 0, SEEK_END);
     if (size < 0)
     {
@@ -353,65 +518,12 @@ static int is_text_file_at(int dir_fd, const char *name, char **content, ssize_t
         buf[r] = '\0';
     *sz = r;
 
-    /* Some files in our dump directories are known to always be textual */
-    const char *base = strrchr(name, '/');
-    if (base)
+    if (classify_element_data(name, buf, r, /*sanitized*/NULL) != CD_FLAG_TXT)
     {
-        base++;
-        if (libreport_is_in_string_list(base, always_text_files))
-            goto text;
-    }
-
-    /* Every once in a while, even a text file contains a few garbled
-     * or unexpected non-ASCII chars. We should not declare it "binary".
-     *
-     * Used to have RATIO = 50 (2%), but then came Fedora 19 with
-     * os_release = "Schrödinger's Cat". Bumped to 10%.
-     * Alternatives: add os_release to always_text_files[]
-     * or add "if it is valid Unicode, then it's text" check here.
-     *
-     * Replaced crude "buf[r] > 0x7e is bad" logic with
-     * "if it is a broken Unicode, then it's bad".
-     */
-    const unsigned RATIO = 10;
-    unsigned total_chars = r + RATIO;
-    unsigned bad_chars = 1; /* 1 prevents division by 0 later */
-    bool prev_was_unicode = 0;
-    ssize_t i = -1;
-    while (++i < r)
-    {
-        /* Among control chars, only '\t','\n' etc are allowed */
-        if (buf[i] < ' ' && !isspace(buf[i]))
-        {
-            /* We don't like NULs and other control chars very much.
-             * Not text for sure!
-             */
-            g_free(buf);
-            return CD_FLAG_BIN;
-        }
-        if (buf[i] == 0x7f)
-            bad_chars++;
-        else if (buf[i] > 0x7f)
-        {
-            /* We test two possible bad cases with one comparison:
-             * (1) prev byte was unicode AND cur byte is 11xxxxxx:
-             * BAD - unicode start byte can't be in the middle of unicode char
-             * (2) prev byte wasnt unicode AND cur byte is 10xxxxxx:
-             * BAD - unicode continuation byte can't start unicode char
-             */
-            if (prev_was_unicode == ((buf[i] & 0x40) == 0x40))
-                bad_chars++;
-        }
-        prev_was_unicode = (buf[i] > 0x7f);
+        g_free(buf);
+        return CD_FLAG_BIN; /* it's binary */
     }
 
-    if ((total_chars / bad_chars) >= RATIO)
-        goto text; /* looks like text to me */
-
-    g_free(buf);
-    return CD_FLAG_BIN; /* it's binary */
-
- text:
     if (size > CD_MAX_TEXT_SIZE)
     {
         g_free(buf);
@@ -422,14 +534,29 @@ static int is_text_file_at(int dir_fd, const char *name, char **content, ssize_t
     return CD_FLAG_TXT;
 }
 
+/* Strips '\n' from one-line elements */
+static void strip_single_newline(char *text)
+{
+    char *nl = strchr(text, '\n');
+    if (nl && nl[1] == '\0')
+        *nl = '\0';
+}
+
+/* Strips '\n' from one-line elements and sanitizes possibly corrupted utf8.
+ *
+ * Returns NULL if the text can be used as is.
+ */
+static char *finalize_text_element(char *text)
+{
+    strip_single_newline(text);
+    return libreport_sanitize_utf8(text, TEXT_ELEMENT_SANITIZE);
+}
 
 static int _problem_data_load_dump_dir_element(struct dump_dir *dd, const char *name, char **content, int *type_flags, int *fd)
 {
     int file_fd = -1;
     int *file_fd_ptr = fd == NULL ? &file_fd : fd;
 
-#define IS_TEXT_FILE_AT_PROBE_SIZE 4*1024
-
     ssize_t sz = IS_TEXT_FILE_AT_PROBE_SIZE;
     char *text = NULL;
     int r = is_text_file_at(dd->dd_fd, name, &text, &sz, file_fd_ptr);
@@ -456,20 +583,7 @@ static int _problem_data_load_dump_dir_element(struct dump_dir *dd, const char *
         text = libreport_xmalloc_read(*file_fd_ptr, NULL);
     }
 
-#undef IS_TEXT_FILE_AT_PROBE_SIZE
-
-    /* Strip '\n' from one-line elements: */
-    char *nl = strchr(text, '\n');
-    if (nl && nl[1] == '\0')
-        *nl = '\0';
-
-    /* Sanitize possibly corrupted utf8.
-     * Of control chars, allow only tab and newline.
-     */
-    char *sanitized = libreport_sanitize_utf8(text,
-            (SANITIZE_ALL & ~SANITIZE_LF & ~SANITIZE_TAB)
-    );
-
+    char *sanitized = finalize_text_element(text);
     if (sanitized != NULL)
     {
         g_free(text);
@@ -492,74 +606,433 @@ int problem_data_load_dump_dir_element(struct dump_dir *dd, const char *name, ch
     return _problem_data_load_dump_dir_element(dd, name, content, type_flags, fd);
 }
 
-void problem_data_load_from_dump_dir(problem_data_t *problem_data, struct dump_dir *dd, char **excluding)
+/* State of one problem_data_load_from_dump_dir() pass.
+ *
+ * Elements smaller than the probe size are read into the arena, which is
+ * allocated only once per pass, and only the final text is copied out of it.
+ */
+struct element_loader
+{
+    int dir_fd;
+    int flags;
+    unsigned char *arena;
+};
+
+/* Text elements of at least this size are mapped if PD_LOAD_MAP_BIG_TEXT is
+ * requested. Mapping smaller ones does not pay off.
+ */
+#define MAPPED_TEXT_MIN_SIZE (128*1024)
+
+/* Maps the whole file read-only, followed by at least one zero Byte, so the
+ * mapping can be used as a regular C string.
+ *
+ * The remainder of the last page of a file mapping is filled with zeros. If
+ * the file ends on a page boundary, the extra page of the anonymous
+ * reservation provides the terminator.
+ */
+static char *map_text_element(int fd, size_t size, size_t *mapped_size)
 {
-    char *short_name;
-    char *full_name;
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    const size_t total = (size / page_size + 1) * page_size;
+
+    char *area = mmap(NULL, total, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (area == MAP_FAILED)
+        return NULL;
 
-    dd_init_next_file(dd);
-    while (dd_get_next_file(dd, &short_name, &full_name))
+    if (mmap(area, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
     {
+        perror_msg("Can't map text element");
+        munmap(area, total);
+        return NULL;
+    }
+
+    *mapped_size = total;
+    return area;
+}
+
+/* Returns the mapped text if it can be used as is; otherwise returns NULL
+ * and stores the sanitized copy in content.
+ */
+static char *map_big_text_element(int fd, const struct stat *st, char **content, size_t *mapped_size)
+{
+    size_t total = 0;
+    char *text = map_text_element(fd, st->st_size, &total);
+    if (text == NULL)
+        return NULL;
+
+    /* One-line elements get their '\n' stripped, which can't be done in
+     * a read-only mapping. Such big elements are rare, read them as usual.
+     */
+    const char *nl = memchr(text, '\n', st->st_size);
+    if (nl != NULL && nl[1] == '\0')
+    {
+        munmap(text, total);
+        return NULL;
+    }
+
+    char *sanitized = libreport_sanitize_utf8(text, TEXT_ELEMENT_SANITIZE);
+    if (sanitized != NULL)
+    {
+        munmap(text, total);
+        *content = sanitized;
+        return NULL;
+    }
+
+    *mapped_size = total;
+    return text;
+}
+
+/* Opens an element which has already been examined by fstatat().
+ *
+ * secure_openat_read() needs three syscalls to open a file without following
+ * symlinks and without opening anything but regular files. Here the element
+ * is known to be a regular file, so it is opened directly (O_NONBLOCK covers
+ * a FIFO swapped in meanwhile) and the opened file is verified to be the very
+ * same single-linked regular file.
+ */
+static int open_examined_element_at(int dir_fd, const char *name, const struct stat *st)
+{
+    int fd = openat(dir_fd, name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+
+    struct stat fd_sb;
+    if (fstat(fd, &fd_sb) != 0
+     || fd_sb.st_dev != st->st_dev
+     || fd_sb.st_ino != st->st_ino
+     || !S_ISREG(fd_sb.st_mode)
+     || fd_sb.st_nlink > 1
+    ) {
+        log_notice("'%s' isn't a regular file or has more links", name);
+        close(fd);
+        return -EINVAL;
+    }
+
+    return fd;
+}
+
+/* Loads an element in the fewest possible syscalls.
+ *
+ * Small elements are read by a single read() into the loader's arena. Bigger
+ * elements fall back to the two-phase probe: the first
+ * IS_TEXT_FILE_AT_PROBE_SIZE Bytes are classified and the rest is read only
+ * for text elements, continuing from the current offset.
+ *
+ * Compressed elements are probed by decompressing their head only, so binary
+ * ones (coredumps) are never decompressed. st->st_size is updated to the size
+ * of the content.
+ */
+static int load_element_at(struct element_loader *loader, const char *name,
+        struct stat *st, char **content, int *type_flags, size_t *mapped_size)
+{
+    int fd = open_examined_element_at(loader->dir_fd, name, st);
+    if (fd < 0)
+        return fd;
+
+    int retval = 0;
+    unsigned char *const probe = loader->arena;
+
+    ssize_t probed;
+    const off_t uncompressed = libreport_compressed_element_size(fd);
+    if (uncompressed >= 0)
+    {
+        st->st_size = uncompressed;
+        probed = libreport_decompress_head(fd, probe, IS_TEXT_FILE_AT_PROBE_SIZE);
+    }
+    else
+    {
+        probed = libreport_safe_read(fd, probe, IS_TEXT_FILE_AT_PROBE_SIZE);
+        if (probed >= 0 && probed < IS_TEXT_FILE_AT_PROBE_SIZE && probed < st->st_size)
+        {
+            /* Short read, it should not happen with regular files */
+            const ssize_t rest = libreport_full_read(fd, probe + probed, IS_TEXT_FILE_AT_PROBE_SIZE - probed);
+            probed = rest < 0 ? rest : probed + rest;
+        }
+    }
+
+    if (probed < 0)
+    {
+        retval = -EIO;
+        goto finito;
+    }
+
+    /* If the whole element is in the arena, classify and sanitize it at once */
+    const bool whole = probed < IS_TEXT_FILE_AT_PROBE_SIZE;
+    char *sanitized = NULL;
+    int flags = classify_element_data(name, probe, probed, whole ? &sanitized : NULL);
+    if (flags == CD_FLAG_TXT && st->st_size > CD_MAX_TEXT_SIZE)
+        flags = CD_FLAG_BIN | CD_FLAG_BIGTXT;
+
+    *type_flags = flags;
+    if (flags != CD_FLAG_TXT)
+    {
+        g_free(sanitized);
+        goto finito;
+    }
+
+    if (whole)
+    {
+        probe[probed] = '\0';
+        *content = sanitized ? sanitized : g_strdup((char *)probe);
+        strip_single_newline(*content);
+        goto finito;
+    }
+
+    /* Leave content NULL, the caller records where to load it from */
+    if (loader->flags & PD_LOAD_LAZY)
+        goto finito;
+
+    if (uncompressed >= 0)
+    {
+        /* The content continues at the same offset */
+        fd = libreport_uncompressed_element_fd(fd);
+        if (fd < 0)
+            return fd;
+        if (lseek(fd, probed, SEEK_SET) != probed)
+        {
+            retval = -EIO;
+            goto finito;
+        }
+    }
+
+    if ((loader->flags & PD_LOAD_MAP_BIG_TEXT) && st->st_size >= MAPPED_TEXT_MIN_SIZE)
+    {
+        char *mapped = map_big_text_element(fd, st, content, mapped_size);
+        if (mapped != NULL || *content != NULL)
+        {
+            if (mapped != NULL)
+                *content = mapped;
+            goto finito;
+        }
+        /* else: fall back to reading */
+    }
+
+    const size_t size = MAX((size_t)st->st_size, (size_t)probed);
+    char *text = g_malloc(size + 1);
+    memcpy(text, probe, probed);
+
+    const ssize_t rest = libreport_full_read(fd, text + probed, size - probed);
+    if (rest < 0)
+    {
+        g_free(text);
+        retval = -EIO;
+        goto finito;
+    }
+    text[probed + rest] = '\0';
+
+    sanitized = finalize_text_element(text);
+    if (sanitized != NULL)
+    {
+        g_free(text);
+        text = sanitized;
+    }
+    *content = text;
+
+finito:
+    close(fd);
+    return retval;
+}
+
+static void set_loaded_text(struct problem_item *item, char *content, size_t mapped_size, off_t file_size)
+{
+    item->content = content;
+    item->mapped_size = mapped_size;
+
+    if (mapped_size != 0)
+    {
+        /* Save consumers from scanning megabytes by strlen() */
+        const char *nul = memchr(content, '\0', file_size);
+        item->size = nul ? (unsigned long)(nul - content) : (unsigned long)file_size;
+    }
+}
+
+static void add_item_source(struct problem_item *item, struct lazy_dump_dir *dir,
+        const char *name, const struct stat *st)
+{
+    const size_t name_len = strlen(name);
+    struct problem_item_source *source = g_malloc(sizeof(*source) + name_len + 1);
+    source->dir = dir;
+    source->dev = st->st_dev;
+    source->ino = st->st_ino;
+    memcpy(source->name, name, name_len + 1);
+
+    dir->refs++;
+    item->source = source;
+}
+
+/* Loads content of a lazily loaded item. The element must be the very same
+ * file which was examined when the problem data were loaded. If it cannot be
+ * loaded or it is not a text anymore, the item gets empty content.
+ */
+static void load_item_source(struct problem_item *item)
+{
+    struct problem_item_source *source = item->source;
+    item->source = NULL;
+
+    struct element_loader loader = {
+        .dir_fd = source->dir->dir_fd,
+        .flags = source->dir->flags & ~PD_LOAD_LAZY,
+        .arena = g_malloc(IS_TEXT_FILE_AT_PROBE_SIZE + 1),
+    };
+
+    char *content = NULL;
+    int type_flags = 0;
+    size_t mapped_size = 0;
+
+    struct stat st = { 0 };
+    int r = 0;
+    if (fstatat(loader.dir_fd, source->name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+        r = -errno;
+    else if (st.st_dev != source->dev || st.st_ino != source->ino || !S_ISREG(st.st_mode))
+        r = -EINVAL;
+    else
+        r = load_element_at(&loader, source->name, &st, &content, &type_flags, &mapped_size);
+
+    if (r == 0 && type_flags != CD_FLAG_TXT)
+        r = -EINVAL;
+
+    if (r < 0)
+    {
+        error_msg("Failed to load element %s: %s", source->name, strerror(-r));
+        content = g_strdup("");
+        mapped_size = 0;
+    }
+
+    set_loaded_text(item, content, mapped_size, st.st_size);
+
+    g_free(loader.arena);
+    free_item_source(source);
+}
+
+static unsigned text_element_flags(const char *name, unsigned flags)
+{
+    if (is_editable_file(name))
+        flags |= CD_FLAG_ISEDITABLE;
+    else
+        flags |= CD_FLAG_ISNOTEDITABLE;
+
+    static const char *const list_files[] = {
+        FILENAME_UID       ,
+        FILENAME_PACKAGE   ,
+        FILENAME_CMDLINE   ,
+        FILENAME_TIME      ,
+        FILENAME_COUNT     ,
+        FILENAME_REASON    ,
+        NULL
+    };
+    if (libreport_is_in_string_list(name, list_files))
+        flags |= CD_FLAG_LIST;
+
+    if (strcmp(name, FILENAME_TIME) == 0)
+        flags |= CD_FLAG_UNIXTIME;
+
+    return flags;
+}
+
+/* Loads all elements in a single pass over the directory entries with one
+ * fstatat() per entry. Element names are not duplicated unless they are
+ * stored in problem_data and full paths are built only for binary elements.
+ */
+void problem_data_load_from_dump_dir_ext(problem_data_t *problem_data, struct dump_dir *dd,
+                char **excluding, int flags)
+{
+    DIR *d = dd_init_next_file(dd);
+    if (d == NULL)
+        return;
+
+    struct element_loader loader = {
+        .dir_fd = dd->dd_fd,
+        .flags = flags,
+        .arena = g_malloc(IS_TEXT_FILE_AT_PROBE_SIZE + 1),
+    };
+
+    struct lazy_dump_dir *lazy_dir = NULL;
+    if (flags & PD_LOAD_LAZY)
+    {
+        /* The dump directory may be closed before the items are loaded */
+        const int dir_fd = fcntl(dd->dd_fd, F_DUPFD_CLOEXEC, 0);
+        if (dir_fd >= 0)
+        {
+            lazy_dir = g_new0(struct lazy_dump_dir, 1);
+            lazy_dir->dir_fd = dir_fd;
+            lazy_dir->flags = flags;
+        }
+        else
+        {
+            perror_msg("Can't duplicate dump directory fd, loading elements eagerly");
+            loader.flags &= ~PD_LOAD_LAZY;
+        }
+    }
+
+    struct dirent *dent;
+    while ((dent = readdir(d)) != NULL)
+    {
+        const char *short_name = dent->d_name;
+
+        /* Don't stat what is surely not a regular file (.lock, .libreport) */
+        if (dent->d_type != DT_REG && dent->d_type != DT_UNKNOWN)
+            continue;
+
         if (excluding && libreport_is_in_string_list(short_name, (const char *const *)excluding))
         {
             //log_warning("Excluded:'%s'", short_name);
-            goto next;
+            continue;
         }
 
         if (short_name[0] == '#'
          || (short_name[0] && short_name[strlen(short_name) - 1] == '~')
         ) {
             //log_warning("Excluded (editor backup file):'%s'", short_name);
-            goto next;
+            continue;
         }
 
+        struct stat st;
+        if (fstatat(dd->dd_fd, short_name, &st, AT_SYMLINK_NOFOLLOW) != 0
+         || !S_ISREG(st.st_mode))
+            continue;
+
         char *content = NULL;
-        int flags = 0;
-        int r = _problem_data_load_dump_dir_element(dd, short_name, &content, &flags, /*fd*/NULL);
+        int type_flags = 0;
+        size_t mapped_size = 0;
+        int r = load_element_at(&loader, short_name, &st, &content, &type_flags, &mapped_size);
         if (r < 0)
         {
             error_msg("Failed to load element %s: %s", short_name, strerror(-r));
-            goto next;
+            continue;
         }
 
-        if (flags & CD_FLAG_TXT)
-        {
-            if (is_editable_file(short_name))
-                flags |= CD_FLAG_ISEDITABLE;
-            else
-                flags |= CD_FLAG_ISNOTEDITABLE;
-
-            static const char *const list_files[] = {
-                FILENAME_UID       ,
-                FILENAME_PACKAGE   ,
-                FILENAME_CMDLINE   ,
-                FILENAME_TIME      ,
-                FILENAME_COUNT     ,
-                FILENAME_REASON    ,
-                NULL
-            };
-            if (libreport_is_in_string_list(short_name, list_files))
-                flags |= CD_FLAG_LIST;
-
-            if (strcmp(short_name, FILENAME_TIME) == 0)
-                flags |= CD_FLAG_UNIXTIME;
-        }
+        if (type_flags & CD_FLAG_TXT)
+            type_flags = text_element_flags(short_name, type_flags);
         else
-        {
-            content = full_name;
-            full_name = NULL;
-        }
+            content = g_build_filename(dd->dd_dirname ? dd->dd_dirname : "", short_name, NULL);
 
-        problem_data_add(problem_data,
+        /* st.st_size is the uncompressed size, see load_element_at() */
+        struct problem_item *item = problem_data_add_take(problem_data,
                 short_name,
-                content,
-                flags
+                /*content*/NULL,
+                type_flags,
+                (type_flags & CD_FLAG_BIN) ? (unsigned long)st.st_size : PROBLEM_ITEM_UNINITIALIZED_SIZE
         );
-        g_free(content);
- next:
-        g_free(short_name);
-        g_free(full_name);
+
+        if (content != NULL)
+            set_loaded_text(item, content, mapped_size, st.st_size);
+        else /* deferred by PD_LOAD_LAZY */
+            add_item_source(item, lazy_dir, short_name, &st);
+    }
+
+    if (lazy_dir != NULL && lazy_dir->refs == 0)
+    {
+        close(lazy_dir->dir_fd);
+        g_free(lazy_dir);
     }
+
+    g_free(loader.arena);
+    dd_clear_next_file(dd);
+}
+
+void problem_data_load_from_dump_dir(problem_data_t *problem_data, struct dump_dir *dd, char **excluding)
+{
+    problem_data_load_from_dump_dir_ext(problem_data, dd, excluding, /*flags*/0);
 }
 
 problem_data_t *create_problem_data_from_dump_dir(struct dump_dir *dd)
@@ -571,12 +1044,17 @@ problem_data_t *create_problem_data_from_dump_dir(struct dump_dir *dd)
 
 problem_data_t *create_problem_data_for_reporting(const char *dump_dir_name)
 {
-    struct dump_dir *dd = dd_opendir(dump_dir_name, /*flags:*/ 0);
+    return create_problem_data_for_reporting_ext(dump_dir_name, /*flags*/0);
+}
+
+problem_data_t *create_problem_data_for_reporting_ext(const char *dump_dir_name, int flags)
+{
+    struct dump_dir *dd = dd_opendir(dump_dir_name, /*flags:*/ DD_OPEN_SHARED_LOCK);
     if (!dd)
         return NULL; /* dd_opendir already emitted error msg */
     string_vector_ptr_t exclude_items = libreport_get_global_always_excluded_elements();
     problem_data_t *problem_data = problem_data_new();
-    problem_data_load_from_dump_dir(problem_data, dd, exclude_items);
+    problem_data_load_from_dump_dir_ext(problem_data, dd, exclude_items, flags);
     dd_close(dd);
     g_strfreev(exclude_items);
     return problem_data;
@@ -592,7 +1070,7 @@ void libreport_log_problem_data(problem_data_t *problem_data, const char *pfx)
     {
         log_warning("%s[%s]:'%s' 0x%x",
                 pfx, name,
-                value->content,
+                problem_item_get_content(value),
                 value->flags
         );
     }
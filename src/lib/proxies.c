@@ -21,16 +21,77 @@
 
 #include <gio/gio.h>
 
-GList *get_proxy_list(const char *url)
+/* Overrides the system proxy configuration, see get_proxy_list() */
+#define PROXY_ENV_VAR "LIBREPORT_PROXY"
+
+/* Lookups may evaluate a PAC script or ask a D-Bus service. Their results
+ * are remembered per scheme, host and port for a while.
+ */
+#define PROXY_CACHE_TTL_SECS 300
+
+struct cached_proxies
 {
-    int i;
-    GList *l = NULL;
-    GProxyResolver *resolver;
-    g_auto(GStrv) proxies = NULL;
-    g_autoptr(GError) error = NULL;
+    char **proxies;
+    gint64 expires;
+};
+
+static GMutex proxy_cache_lock;
+/* scheme://host[:port] -> struct cached_proxies */
+static GHashTable *proxy_cache;
+
+static void free_cached_proxies(void *ptr)
+{
+    struct cached_proxies *cached = ptr;
+    g_strfreev(cached->proxies);
+    g_free(cached);
+}
+
+/* Returns NULL for URLs without authority, they are not cached */
+static char *proxy_cache_key(const char *url)
+{
+    const char *authority = strstr(url, "://");
+    if (authority == NULL)
+        return NULL;
+
+    authority += strlen("://");
+    const char *end = authority + strcspn(authority, "/?#");
+
+    /* Credentials don't affect the proxy and must not be kept */
+    const char *host = memrchr(authority, '@', end - authority);
+    host = host ? host + 1 : authority;
+
+    return g_strdup_printf("%.*s%.*s", (int)(authority - url), url, (int)(end - host), host);
+}
+
+static char **lookup_proxies(const char *url)
+{
+    const char *override = getenv(PROXY_ENV_VAR);
+    if (override != NULL && override[0] != '\0')
+    {
+        log_debug("Using proxy '%s' from $"PROXY_ENV_VAR, override);
+        char **proxies = g_new0(char *, 2);
+        proxies[0] = g_strdup(override);
+        return proxies;
+    }
+
+    g_autofree char *key = proxy_cache_key(url);
+    const gint64 now = g_get_monotonic_time();
+    char **proxies = NULL;
+
+    g_mutex_lock(&proxy_cache_lock);
+    struct cached_proxies *cached = key && proxy_cache ? g_hash_table_lookup(proxy_cache, key) : NULL;
+    if (cached != NULL && cached->expires > now)
+        proxies = g_strdupv(cached->proxies);
+    g_mutex_unlock(&proxy_cache_lock);
 
-    resolver = g_proxy_resolver_get_default();
+    if (proxies != NULL)
+    {
+        log_debug("Using cached proxies for %s", key);
+        return proxies;
+    }
 
+    g_autoptr(GError) error = NULL;
+    GProxyResolver *resolver = g_proxy_resolver_get_default();
     proxies = g_proxy_resolver_lookup(resolver, url, NULL, &error);
     if (!proxies)
     {
@@ -38,13 +99,38 @@ GList *get_proxy_list(const char *url)
         return NULL;
     }
 
+    if (key != NULL)
+    {
+        cached = g_new(struct cached_proxies, 1);
+        cached->proxies = g_strdupv(proxies);
+        cached->expires = now + PROXY_CACHE_TTL_SECS * G_USEC_PER_SEC;
+
+        g_mutex_lock(&proxy_cache_lock);
+        if (proxy_cache == NULL)
+            proxy_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_cached_proxies);
+        g_hash_table_replace(proxy_cache, g_steal_pointer(&key), cached);
+        g_mutex_unlock(&proxy_cache_lock);
+    }
+
+    return proxies;
+}
+
+GList *get_proxy_list(const char *url)
+{
+    int i;
+    GList *l = NULL;
+    g_auto(GStrv) proxies = lookup_proxies(url);
+
+    if (!proxies)
+        return NULL;
+
     for (i = 0, l = NULL; proxies[i]; i++)
         l = g_list_append(l, g_steal_pointer(&proxies[i]));
 
     /* Don't set proxy if the list contains just "direct://" */
     if (l && !g_list_next(l) && !strcmp(l->data, "direct://"))
     {
-        g_list_free(l);
+        g_list_free_full(l, g_free);
         l = NULL;
     }
 
@@ -25,6 +25,14 @@
 extern "C" {
 #endif
 
+/* Returns the list of proxies to try for the url, NULL for direct
+ * connections.
+ *
+ * The results of the system proxy resolver are cached per scheme, host and
+ * port for 5 minutes. If $LIBREPORT_PROXY is set, its value is the only proxy
+ * for all URLs and the system resolver is not used at all; "direct://" means
+ * no proxy.
+ */
 GList *get_proxy_list(const char *url);
 
 #ifdef __cplusplus
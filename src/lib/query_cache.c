@@ -0,0 +1,127 @@
+/*
+    Copyright (C) 2024  ABRT Team
+    Copyright (C) 2024  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* Persistent cache of results of queries to bug trackers
+ *
+ * The same problem is often reported from many machines or several times in
+ * a row, and every report searches the tracker for duplicates. The results
+ * are kept in the config cache files, one file per group of results which
+ * become out of date together, e.g. all searches for a duphash.
+ */
+#include "internal_libreport.h"
+
+/* key -> (saved, result) */
+#define QUERY_CACHE_TYPE "a{s(xv)}"
+
+static char *query_cache_name(const char *group)
+{
+    g_autofree char *checksum = g_compute_checksum_for_string(G_CHECKSUM_SHA1, group, -1);
+    return g_strdup_printf("query-%s", checksum);
+}
+
+static GVariant *load_query_results(const char *group)
+{
+    g_autofree char *name = query_cache_name(group);
+    GPtrArray *sources = NULL;
+    GVariant *results = libreport_load_config_cache(name, group, G_VARIANT_TYPE(QUERY_CACHE_TYPE), &sources);
+    if (results != NULL)
+        g_ptr_array_free(sources, TRUE);
+
+    return results;
+}
+
+static gint64 now_secs(void)
+{
+    return g_get_real_time() / G_USEC_PER_SEC;
+}
+
+GVariant *libreport_load_query_cache(const char *group, const char *key,
+        const GVariantType *type, unsigned ttl_secs, unsigned negative_ttl_secs)
+{
+    if (ttl_secs == 0 && negative_ttl_secs == 0)
+        return NULL;
+
+    GVariant *results = load_query_results(group);
+    if (results == NULL)
+        return NULL;
+
+    gint64 saved;
+    GVariant *result = NULL;
+    const bool found = g_variant_lookup(results, key, "(xv)", &saved, &result);
+    g_variant_unref(results);
+    if (!found)
+        return NULL;
+
+    if (!g_variant_is_of_type(result, type))
+    {
+        g_variant_unref(result);
+        return NULL;
+    }
+
+    const bool negative = g_variant_is_container(result) && g_variant_n_children(result) == 0;
+    const gint64 age = now_secs() - saved;
+    /* A result from the future was saved with a wrong clock */
+    if (age < 0 || age >= (negative ? negative_ttl_secs : ttl_secs))
+    {
+        log_debug("Cached result of '%s' for '%s' expired", group, key);
+        g_variant_unref(result);
+        return NULL;
+    }
+
+    log_debug("Using cached result of '%s' for '%s'", group, key);
+    return result;
+}
+
+void libreport_save_query_cache(const char *group, const char *key, GVariant *result)
+{
+    g_variant_ref_sink(result);
+
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE(QUERY_CACHE_TYPE));
+    g_variant_builder_add(&builder, "{s(xv)}", key, now_secs(), result);
+
+    GVariant *results = load_query_results(group);
+    if (results != NULL)
+    {
+        GVariantIter iter;
+        g_variant_iter_init(&iter, results);
+        const char *cached_key;
+        GVariant *entry;
+        while (g_variant_iter_next(&iter, "{&s@(xv)}", &cached_key, &entry))
+        {
+            if (strcmp(cached_key, key) != 0)
+                g_variant_builder_add(&builder, "{s@(xv)}", cached_key, entry);
+            g_variant_unref(entry);
+        }
+        g_variant_unref(results);
+    }
+
+    g_autofree char *name = query_cache_name(group);
+    GPtrArray *sources = libreport_new_config_sources();
+    libreport_save_config_cache(name, group, sources, g_variant_builder_end(&builder));
+    g_ptr_array_free(sources, TRUE);
+
+    g_variant_unref(result);
+}
+
+void libreport_drop_query_cache(const char *group)
+{
+    g_autofree char *name = query_cache_name(group);
+    libreport_remove_config_cache(name);
+}
@@ -18,6 +18,7 @@
 */
 #include <glob.h>
 #include <regex.h>
+#include <sys/epoll.h>
 #include "client.h"
 #include "internal_libreport.h"
 
@@ -42,6 +43,13 @@ struct run_event_state *new_run_event_state()
 
     state->command_output = g_string_new(NULL);
 
+    const char *max_parallel = getenv("LIBREPORT_MAX_PARALLEL_COMMANDS");
+    if (max_parallel != NULL)
+    {
+        unsigned long value = strtoul(max_parallel, NULL, 10);
+        state->max_parallel_commands = MIN(value, 64);
+    }
+
     return state;
 }
 
@@ -138,10 +146,40 @@ void free_rule_list(GList *rule_list)
 /* Stop-gap measure against infinite recursion */
 #define MAX_recursion_depth 32
 
-GList *load_rule_list(GList *rule_list,
+/* Files newly matching an include glob change mtime of the deepest
+ * directory of the pattern without wildcards.
+ */
+static void add_glob_rule_source(GPtrArray *sources, const char *pattern)
+{
+    if (sources == NULL)
+        return;
+
+    g_autofree char *dir = g_path_get_dirname(pattern);
+    char *wildcard = strpbrk(dir, "*?[");
+    if (wildcard != NULL)
+    {
+        *wildcard = '\0';
+        char *last_slash = strrchr(dir, '/');
+        if (last_slash == NULL)
+            strcpy(dir, ".");
+        else
+            last_slash[last_slash == dir] = '\0';
+    }
+
+    libreport_add_config_source(sources, dir);
+}
+
+/* Like load_rule_list(), records every configuration file and include
+ * directory in sources, if not NULL.
+ */
+static GList *load_rule_list_ext(GList *rule_list,
                 const char *conf_file_name,
-                unsigned recursion_depth
+                unsigned recursion_depth,
+                GPtrArray *sources
 ) {
+    /* Stat before reading, so modifications made meanwhile are noticed */
+    libreport_add_config_source(sources, conf_file_name);
+
     FILE *conffile = fopen(conf_file_name, "r");
     if (!conffile)
     {
@@ -286,6 +324,8 @@ GList *load_rule_list(GList *rule_list,
                  */
                 name_to_glob = g_strdup(p);
 
+            add_glob_rule_source(sources, name_to_glob);
+
             glob_t globbuf;
             memset(&globbuf, 0, sizeof(globbuf));
             log_parser("globbing '%s'", name_to_glob);
@@ -294,7 +334,7 @@ GList *load_rule_list(GList *rule_list,
             if (name) while (*name)
             {
                 log_parser("recursing into '%s'", *name);
-                rule_list = load_rule_list(rule_list, *name, recursion_depth + 1);
+                rule_list = load_rule_list_ext(rule_list, *name, recursion_depth + 1, sources);
                 log_parser("returned from '%s'", *name);
                 name++;
             }
@@ -311,26 +351,311 @@ GList *load_rule_list(GList *rule_list,
     return rule_list;
 }
 
-static int regcmp_lines(char *val, const char *regex)
+GList *load_rule_list(GList *rule_list,
+                const char *conf_file_name,
+                unsigned recursion_depth
+) {
+    return load_rule_list_ext(rule_list, conf_file_name, recursion_depth, /*sources*/NULL);
+}
+
+/* Compiled rules */
+
+enum {
+    RULE_COND_EVENT, /* EVENT=foo */
+    RULE_COND_EQ,    /* VAR=VAL */
+    RULE_COND_NE,    /* VAR!=VAL */
+    RULE_COND_REGEX, /* VAR~=REGEX */
+    RULE_COND_PARALLEL, /* PARALLEL=yes, not a condition but an annotation */
+};
+
+struct rule_condition
+{
+    int type;
+    /* Element name, NULL for EVENT */
+    char *name;
+    /* Points into the condition string of the rule */
+    const char *value;
+    int regcomp_error;
+    regex_t regex;
+};
+
+struct compiled_rule
+{
+    /* Must be first, lists of rules point to it */
+    struct rule rule;
+    /* Value of the first EVENT condition, NULL if there is none */
+    const char *event;
+    /* The command may run concurrently with other such commands */
+    bool parallel;
+    unsigned condition_count;
+    struct rule_condition conditions[];
+};
+
+struct rule_set
+{
+    unsigned refs;
+    char *conf_file_name;
+    /* Files and directories the rules were loaded from */
+    GPtrArray *sources;
+    /* All rules in the configuration order */
+    GList *rules;
+    /* EVENT -> rules which can match it, in the configuration order */
+    GHashTable *event_rules;
+    /* Rules without EVENT condition, they match every event */
+    GList *any_event_rules;
+};
+
+/* Rules of the last loaded configuration */
+static struct rule_set *s_rule_set;
+
+/* Takes ownership of the rule's conditions and command */
+static struct compiled_rule *compile_rule(struct rule *loaded)
+{
+    const unsigned count = g_list_length(loaded->conditions);
+    struct compiled_rule *cur_rule = g_malloc0(sizeof(*cur_rule) + count * sizeof(cur_rule->conditions[0]));
+    cur_rule->rule = *loaded;
+    cur_rule->condition_count = count;
+    g_free(loaded);
+
+    struct rule_condition *cond = cur_rule->conditions;
+    for (GList *c = cur_rule->rule.conditions; c != NULL; c = g_list_next(c), ++cond)
+    {
+        const char *cond_str = c->data;
+        const char *eq_sign = strchr(cond_str, '=');
+        cond->value = eq_sign + 1;
+
+        /* Is it "EVENT=foo"? */
+        if (strncmp(cond_str, "EVENT=", 6) == 0)
+        {
+            cond->type = RULE_COND_EVENT;
+            if (cur_rule->event == NULL)
+                cur_rule->event = cond->value;
+            continue;
+        }
+
+        /* Is it "PARALLEL=yes"? */
+        if (strncmp(cond_str, "PARALLEL=", 9) == 0)
+        {
+            cond->type = RULE_COND_PARALLEL;
+            cur_rule->parallel = libreport_string_to_bool(cond->value);
+            continue;
+        }
+
+        /* Is it "VAR~=REGEX"? */
+        const int regex = (eq_sign > cond_str && eq_sign[-1] == '~');
+        /* Is it "VAR!=VAL"? */
+        const int inverted = (eq_sign > cond_str && eq_sign[-1] == '!');
+        cond->name = g_strndup(cond_str, eq_sign - cond_str - (regex|inverted));
+
+        if (regex)
+        {
+            cond->type = RULE_COND_REGEX;
+            cond->regcomp_error = regcomp(&cond->regex, cond->value, REG_NOSUB); //TODO: and REG_EXTENDED?
+        }
+        else
+            cond->type = inverted ? RULE_COND_NE : RULE_COND_EQ;
+    }
+
+    return cur_rule;
+}
+
+static void free_compiled_rule(void *ptr)
+{
+    struct compiled_rule *cur_rule = ptr;
+
+    for (unsigned i = 0; i < cur_rule->condition_count; ++i)
+    {
+        struct rule_condition *cond = &cur_rule->conditions[i];
+        g_free(cond->name);
+        if (cond->type == RULE_COND_REGEX && cond->regcomp_error == 0)
+            regfree(&cond->regex);
+    }
+
+    g_list_free_full(cur_rule->rule.conditions, free);
+    g_free(cur_rule->rule.command);
+    g_free(cur_rule);
+}
+
+static void index_rules(struct rule_set *set)
+{
+    /* All lists are built reversed and reversed at the end. The table has no
+     * value destroy function, because the values are replaced by longer
+     * lists sharing the nodes.
+     */
+    set->event_rules = g_hash_table_new(g_str_hash, g_str_equal);
+
+    for (GList *r = set->rules; r != NULL; r = g_list_next(r))
+    {
+        struct compiled_rule *cur_rule = r->data;
+
+        if (cur_rule->event == NULL)
+        {
+            set->any_event_rules = g_list_prepend(set->any_event_rules, cur_rule);
+
+            GHashTableIter iter;
+            GList *event_rules;
+            g_hash_table_iter_init(&iter, set->event_rules);
+            while (g_hash_table_iter_next(&iter, NULL, (void **)&event_rules))
+                g_hash_table_iter_replace(&iter, g_list_prepend(event_rules, cur_rule));
+
+            continue;
+        }
+
+        GList *event_rules = g_hash_table_lookup(set->event_rules, cur_rule->event);
+        if (event_rules == NULL)
+            event_rules = g_list_copy(set->any_event_rules);
+
+        g_hash_table_insert(set->event_rules, (void *)cur_rule->event, g_list_prepend(event_rules, cur_rule));
+    }
+
+    GHashTableIter iter;
+    GList *event_rules;
+    g_hash_table_iter_init(&iter, set->event_rules);
+    while (g_hash_table_iter_next(&iter, NULL, (void **)&event_rules))
+        g_hash_table_iter_replace(&iter, g_list_reverse(event_rules));
+
+    set->any_event_rules = g_list_reverse(set->any_event_rules);
+}
+
+/* Persistent cache of the rule list, see config_cache.c */
+#define RULE_CACHE_NAME "event_rules"
+#define RULE_CACHE_TYPE "a(ass)"
+
+static GList *load_cached_rule_list(const char *conf_file_name, GPtrArray **sources)
+{
+    GVariant *rules = libreport_load_config_cache(RULE_CACHE_NAME, conf_file_name,
+            G_VARIANT_TYPE(RULE_CACHE_TYPE), sources);
+    if (rules == NULL)
+        return NULL;
+
+    GList *rule_list = NULL;
+    GVariantIter iter;
+    GVariantIter *conditions;
+    const char *command;
+    g_variant_iter_init(&iter, rules);
+    while (g_variant_iter_next(&iter, "(as&s)", &conditions, &command))
+    {
+        struct rule *cur_rule = g_new0(struct rule, 1);
+        cur_rule->command = g_strdup(command);
+
+        char *cond;
+        while (g_variant_iter_next(conditions, "s", &cond))
+            cur_rule->conditions = g_list_prepend(cur_rule->conditions, cond);
+        cur_rule->conditions = g_list_reverse(cur_rule->conditions);
+        g_variant_iter_free(conditions);
+
+        rule_list = g_list_prepend(rule_list, cur_rule);
+    }
+    g_variant_unref(rules);
+
+    return g_list_reverse(rule_list);
+}
+
+static void save_cached_rule_list(const char *conf_file_name, GPtrArray *sources, GList *rule_list)
+{
+    GVariantBuilder rules;
+    g_variant_builder_init(&rules, G_VARIANT_TYPE(RULE_CACHE_TYPE));
+    for (GList *r = rule_list; r != NULL; r = g_list_next(r))
+    {
+        struct rule *cur_rule = r->data;
+
+        g_variant_builder_open(&rules, G_VARIANT_TYPE("(ass)"));
+        g_variant_builder_open(&rules, G_VARIANT_TYPE_STRING_ARRAY);
+        for (GList *c = cur_rule->conditions; c != NULL; c = g_list_next(c))
+            g_variant_builder_add(&rules, "s", (const char *)c->data);
+        g_variant_builder_close(&rules);
+        g_variant_builder_add(&rules, "s", cur_rule->command);
+        g_variant_builder_close(&rules);
+    }
+
+    libreport_save_config_cache(RULE_CACHE_NAME, conf_file_name, sources, g_variant_builder_end(&rules));
+}
+
+struct rule_set *load_rule_set(const char *conf_file_name)
+{
+    if (s_rule_set != NULL)
+    {
+        if (strcmp(s_rule_set->conf_file_name, conf_file_name) == 0
+         && !libreport_config_sources_changed(s_rule_set->sources))
+        {
+            s_rule_set->refs++;
+            return s_rule_set;
+        }
+
+        unref_rule_set(s_rule_set);
+        s_rule_set = NULL;
+    }
+
+    struct rule_set *set = g_new0(struct rule_set, 1);
+    set->conf_file_name = g_strdup(conf_file_name);
+
+    /* The parsed rules are cached across processes too */
+    GList *rule_list = load_cached_rule_list(conf_file_name, &set->sources);
+    if (set->sources == NULL)
+    {
+        set->sources = libreport_new_config_sources();
+        rule_list = load_rule_list_ext(NULL, conf_file_name, /*recursion_depth:*/ 0, set->sources);
+        save_cached_rule_list(conf_file_name, set->sources, rule_list);
+    }
+
+    for (GList *r = rule_list; r != NULL; r = g_list_next(r))
+        r->data = compile_rule(r->data);
+
+    set->rules = rule_list;
+    index_rules(set);
+
+    /* One reference is held by the cache */
+    set->refs = 2;
+    s_rule_set = set;
+
+    return set;
+}
+
+void unref_rule_set(struct rule_set *set)
+{
+    if (set == NULL || --set->refs != 0)
+        return;
+
+    GHashTableIter iter;
+    GList *event_rules;
+    g_hash_table_iter_init(&iter, set->event_rules);
+    while (g_hash_table_iter_next(&iter, NULL, (void **)&event_rules))
+        g_list_free(event_rules);
+    g_hash_table_destroy(set->event_rules);
+    g_list_free(set->any_event_rules);
+    g_list_free_full(set->rules, free_compiled_rule);
+    g_ptr_array_free(set->sources, TRUE);
+    g_free(set->conf_file_name);
+    g_free(set);
+}
+
+GList *get_rule_set_rules(struct rule_set *set, const char *event)
 {
-    regex_t rx;
-    int r = regcomp(&rx, regex, REG_NOSUB); //TODO: and REG_EXTENDED?
-    //log_warning("REGEX:'%s':%d", regex, r);
-    if (r)
+    if (event == NULL)
+        return g_list_copy(set->rules);
+
+    GList *event_rules = g_hash_table_lookup(set->event_rules, event);
+    return g_list_copy(event_rules ? event_rules : set->any_event_rules);
+}
+
+static int regcmp_lines(char *val, const struct rule_condition *cond)
+{
+    if (cond->regcomp_error)
     {
         //char errbuf[256];
         //size_t needsz = regerror(r, &rx, errbuf, sizeof(errbuf));
-        error_msg("Bad regexp '%s'", regex); // TODO: use errbuf?
-        return r;
+        error_msg("Bad regexp '%s'", cond->value); // TODO: use errbuf?
+        return cond->regcomp_error;
     }
 
     /* Check every line */
+    int r;
     while (1)
     {
         char *eol = strchr(val, '\n');
         if (eol)
             *eol = '\0';
-        r = regexec(&rx, val, 0, NULL, /*eflags:*/ 0);
+        r = regexec(&cond->regex, val, 0, NULL, /*eflags:*/ 0);
         //log_warning("REGCMP:'%s':%d", val, r);
         if (eol)
             *eol = '\n';
@@ -339,23 +664,28 @@ static int regcmp_lines(char *val, const char *regex)
         val = eol + 1;
     }
     /* Here, r == 0 if match was found */
-    regfree(&rx);
     return r;
 }
 
 /* Checks rules in *pp_rule_list, starting from first (remaining) rule,
  * until it finds a rule with all conditions satisfied.
- * In this case, it deletes this rule and returns this rule's cmd.
+ * In this case, it deletes this rule from the list and returns a copy of
+ * this rule's cmd.
  * Else (if it didn't find such rule), it returns NULL.
  * In case of error (dump_dir can't be opened), returns NULL.
  *
+ * The rules must be compiled, the list must not own them.
+ * Every element is loaded from the dump dir at most once per call.
+ *
  * Intended usage:
- * list = load_rule_list(...);
+ * set = load_rule_set(...);
+ * list = get_rule_set_rules(set, ...);
  * while ((cmd = pop_next_command(&list, ...)) != NULL)
  *     run(cmd);
  */
 static char* pop_next_command(GList **pp_rule_list,
         char **pp_event_name,    /* reports EVENT value thru this, if not NULL on entry */
+        bool *p_parallel,        /* reports PARALLEL annotation thru this, if not NULL */
         struct dump_dir **pp_dd, /* use *pp_dd for access to dump dir, if non-NULL */
         problem_data_t *pd,      /* use *pd for access to problem data, if non-NULL */
         const char *dump_dir_name,
@@ -370,81 +700,87 @@ static char* pop_next_command(GList **pp_rule_list,
 
     char *command = NULL;
     struct dump_dir *dd = pp_dd ? *pp_dd : NULL;
+    /* Element name -> value loaded from dump dir */
+    g_autoptr(GHashTable) loaded_values = NULL;
 
     GList *rule_list = *pp_rule_list;
     while (rule_list)
     {
-        struct rule *cur_rule = rule_list->data;
+        struct compiled_rule *cur_rule = rule_list->data;
 
-        GList *condition = cur_rule->conditions;
-        while (condition)
+        for (unsigned i = 0; i < cur_rule->condition_count; ++i)
         {
-            const char *cond_str = condition->data;
-            const char *eq_sign = strchr(cond_str, '=');
+            const struct rule_condition *cond = &cur_rule->conditions[i];
 
-            /* Is it "EVENT=foo"? */
-            if (strncmp(cond_str, "EVENT=", 6) == 0)
+            if (cond->type == RULE_COND_EVENT)
             {
-                if (strncmp(eq_sign + 1, pfx, pfx_len) != 0)
+                if (strncmp(cond->value, pfx, pfx_len) != 0)
                     goto next_rule; /* prefix doesn't match */
                 if (pp_event_name)
                 {
                     g_free(*pp_event_name);
-                    *pp_event_name = g_strdup(eq_sign + 1);
+                    *pp_event_name = g_strdup(cond->value);
                 }
+                continue;
             }
-            else
+
+            if (cond->type == RULE_COND_PARALLEL)
+                continue;
+
+            /* Read from dump dir and compare */
+            if (!dd && pd == NULL)
             {
-                /* Read from dump dir and compare */
-                if (!dd && pd == NULL)
+                /* Without dir to match, we assume match for all conditions */
+                if (!dump_dir_name)
+                    continue;
+                dd = dd_opendir(dump_dir_name, /*flags:*/ DD_OPEN_READONLY | DD_OPEN_SHARED_LOCK);
+                if (!dd)
                 {
-                    /* Without dir to match, we assume match for all conditions */
-                    if (!dump_dir_name)
-                        goto next_cond;
-                    dd = dd_opendir(dump_dir_name, /*flags:*/ DD_OPEN_READONLY);
-                    if (!dd)
-                    {
-                        free_rule_list(rule_list);
-                        *pp_rule_list = NULL;
-                        goto ret; /* error (note: dd_opendir logged error msg) */
-                    }
+                    g_list_free(*pp_rule_list);
+                    *pp_rule_list = NULL;
+                    goto ret; /* error (note: dd_opendir logged error msg) */
                 }
-                /* Is it "VAR~=REGEX"? */
-                int regex = (eq_sign > cond_str && eq_sign[-1] == '~');
-                /* Is it "VAR!=VAL"? */
-                int inverted = (eq_sign > cond_str && eq_sign[-1] == '!');
-                g_autofree char *var_name = g_strndup(cond_str, eq_sign - cond_str - (regex|inverted));
-                char *real_val = NULL;
-                g_autofree char *free_me = NULL;
-                if (pd == NULL)
-                    free_me = real_val = dd_load_text_ext(dd, var_name, DD_FAIL_QUIETLY_ENOENT);
-                else
-                {
-                    real_val = problem_data_get_content_or_NULL(pd, var_name);
-                    if (real_val == NULL)
-                        free_me = real_val = g_strdup("");
-                }
-                int vals_differ = regex ? regcmp_lines(real_val, eq_sign + 1) : strcmp(real_val, eq_sign + 1);
-                if (inverted)
-                    vals_differ = !vals_differ;
+            }
 
-                /* Do values match? */
-                if (vals_differ) /* no */
+            char empty[] = "";
+            char *real_val = NULL;
+            if (pd == NULL)
+            {
+                if (loaded_values == NULL)
+                    loaded_values = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+
+                real_val = g_hash_table_lookup(loaded_values, cond->name);
+                if (real_val == NULL)
                 {
-                    goto next_rule;
+                    real_val = dd_load_text_ext(dd, cond->name, DD_FAIL_QUIETLY_ENOENT);
+                    g_hash_table_insert(loaded_values, cond->name, real_val);
                 }
             }
- next_cond:
-            /* We are here if current condition is satisfied */
+            else
+            {
+                real_val = problem_data_get_content_or_NULL(pd, cond->name);
+                if (real_val == NULL)
+                    real_val = empty;
+            }
+
+            int vals_differ = (cond->type == RULE_COND_REGEX)
+                              ? regcmp_lines(real_val, cond)
+                              : strcmp(real_val, cond->value);
+            if (cond->type == RULE_COND_NE)
+                vals_differ = !vals_differ;
 
-            condition = condition->next;
-        } /* while (condition) */
+            /* Do values match? */
+            if (vals_differ) /* no */
+                goto next_rule;
+
+            /* We are here if current condition is satisfied */
+        }
         /* We are here if all conditions are satisfied */
         /* IOW, we found rule to run, delete it and return its command */
         *pp_rule_list = g_list_remove(*pp_rule_list, cur_rule);
-        g_list_free_full(cur_rule->conditions, free);
-        command = cur_rule->command;
-        g_free(cur_rule);
+        command = g_strdup(cur_rule->rule.command);
+        if (p_parallel)
+            *p_parallel = cur_rule->parallel;
         break;
 
  next_rule:
@@ -461,12 +797,23 @@ static char* pop_next_command(GList **pp_rule_list,
 
 void free_commands(struct run_event_state *state)
 {
-    free_rule_list(state->rule_list);
+    g_list_free(state->rule_list);
     state->rule_list = NULL;
+    unref_rule_set(state->rule_set);
+    state->rule_set = NULL;
+    g_free(state->rule_list_event);
+    state->rule_list_event = NULL;
     state->command_out_fd = -1;
     state->command_pid = 0;
 }
 
+/* The tests supply their own rules */
+static const char *report_event_conf_path(void)
+{
+    const char *path = getenv("LIBREPORT_DEBUG_REPORT_EVENT_CONF");
+    return path != NULL ? path : CONF_DIR"/report_event.conf";
+}
+
 int prepare_commands(struct run_event_state *state)
 {
     free_commands(state);
@@ -474,25 +821,39 @@ int prepare_commands(struct run_event_state *state)
     state->children_count = 0;
     g_string_erase(state->command_output, 0, -1);
 
-    GList *rule_list = load_rule_list(NULL, CONF_DIR"/report_event.conf", /*recursion_depth:*/ 0);
-    state->rule_list = rule_list;
-    return rule_list != NULL;
+    /* The rules are selected by the first spawn_next_command() */
+    state->rule_set = load_rule_set(report_event_conf_path());
+    return state->rule_set->rules != NULL;
 }
 
-int spawn_next_command(struct run_event_state *state,
+/* Returns the command of the next rule matching the event, NULL if there is
+ * none. The conditions are checked in dd, or in dump_dir_name opened for
+ * the time of the call if dd is NULL.
+ */
+static char *select_next_command(struct run_event_state *state,
+                struct dump_dir *dd,
                 const char *dump_dir_name,
                 const char *event,
-                unsigned execflags
+                bool *p_parallel
 ) {
-    g_autofree char *cmd = pop_next_command(&state->rule_list,
+    if (state->rule_set != NULL && g_strcmp0(state->rule_list_event, event) != 0)
+    {
+        g_list_free(state->rule_list);
+        state->rule_list = get_rule_set_rules(state->rule_set, event);
+        g_free(state->rule_list_event);
+        state->rule_list_event = g_strdup(event);
+    }
+
+    char *cmd = pop_next_command(&state->rule_list,
                 NULL,          /* don't return event_name */
-                NULL,          /* NULL dd: we match by... */
+                p_parallel,
+                dd ? &dd : NULL, /* match this dd, or if NULL, by... */
                 NULL,          /* no problem data */
                 dump_dir_name, /* ...dirname */
                 event, strlen(event)+1 /* for this event name exactly (not prefix) */
     );
     if (!cmd)
-        return -1;
+        return NULL;
 
     /* We count it even if fork fails. The counter isn't meant
      * to count *successful* forks, it is meant to let caller know
@@ -502,6 +863,63 @@ int spawn_next_command(struct run_event_state *state,
 
     log_info("Next command: '%s'", cmd);
 
+    return cmd;
+}
+
+/* Returns argv of a command which the shell would merely split into words
+ * and execute, or NULL if the command needs the shell.
+ */
+static char **split_plain_command(const char *cmd)
+{
+    static const char *const shell_words[] = {
+        "case", "do", "done", "elif", "else", "esac", "fi", "for", "function",
+        "if", "in", "select", "then", "time", "until", "while", NULL
+    };
+
+    cmd = libreport_skip_whitespace(cmd);
+    for (const char *c = cmd; *c != '\0'; ++c)
+    {
+        /* Quotes, expansions, redirections, separators, globs, comments */
+        if (!isalnum((unsigned char)*c) && strchr(" \t-_./,:=+@%^", *c) == NULL
+         && !(*c == '\n' && *libreport_skip_whitespace(c) == '\0'))
+            return NULL;
+    }
+
+    GPtrArray *argv = g_ptr_array_new_with_free_func(g_free);
+    g_auto(GStrv) words = g_strsplit_set(cmd, " \t\n", -1);
+    for (char **word = words; *word != NULL; ++word)
+    {
+        if (**word != '\0')
+            g_ptr_array_add(argv, g_strdup(*word));
+    }
+    g_ptr_array_add(argv, NULL);
+
+    const char *program = argv->pdata[0];
+    g_autofree char *program_path = NULL;
+    /* Assignments, reserved words and builtins */
+    if (program == NULL
+     || strchr(program, '=') != NULL
+     || libreport_is_in_string_list(program, shell_words)
+     || (program_path = g_find_program_in_path(program)) == NULL)
+    {
+        g_ptr_array_free(argv, TRUE);
+        return NULL;
+    }
+
+    return (char **)g_ptr_array_free(argv, FALSE);
+}
+
+/* Runs the command in shell, or directly if it is a plain command and
+ * state->exec_plain_commands is set. Its stdout and stderr are connected to
+ * pipefds[0] and its stdin to pipefds[1].
+ */
+static pid_t spawn_command(struct run_event_state *state,
+                char *cmd,
+                const char *dump_dir_name,
+                const char *event,
+                unsigned execflags,
+                int pipefds[2]
+) {
     /* Just exporting dump_dir_name isn't always ok: it can be "."
      * and some children want to cd to other directory but still
      * be able to find problem directory by using $DUMP_DIR...
@@ -531,173 +949,616 @@ int spawn_next_command(struct run_event_state *state,
     argv[2] = cmd;
     argv[3] = NULL;
 
-    int pipefds[2];
-    state->command_pid = libreport_fork_execv_on_steroids(
+    g_auto(GStrv) plain_argv = state->exec_plain_commands ? split_plain_command(cmd) : NULL;
+    if (plain_argv != NULL)
+        log_debug("Executing '%s' without shell", cmd);
+
+    pid_t pid = libreport_fork_execv_on_steroids(
                 EXECFLG_INPUT | EXECFLG_OUTPUT | EXECFLG_ERR2OUT | execflags,
-                argv,
+                plain_argv != NULL ? plain_argv : argv,
                 pipefds,
                 /* env_vec: */ (char **)env_array->pdata,
                 /* dir: */ dump_dir_name,
                 /* uid(unused): */ 0
     );
-    state->command_out_fd = pipefds[0];
-    state->command_in_fd = pipefds[1];
 
     g_ptr_array_free(env_array, TRUE);
 
+    return pid;
+}
+
+int spawn_next_command(struct run_event_state *state,
+                const char *dump_dir_name,
+                const char *event,
+                unsigned execflags
+) {
+    g_autofree char *cmd = select_next_command(state, /*dd*/NULL, dump_dir_name, event, /*parallel*/NULL);
+    if (!cmd)
+        return -1;
+
+    int pipefds[2];
+    state->command_pid = spawn_command(state, cmd, dump_dir_name, event, execflags, pipefds);
+    state->command_out_fd = pipefds[0];
+    state->command_in_fd = pipefds[1];
+
     return 0;
 }
 
+/* Handles one line of command's output: forwards log lines and alerts, and
+ * writes answers to the questions of the interactive protocol to in_fd.
+ */
+static void process_command_line(struct run_event_state *state, int in_fd, char *msg)
+{
+    g_autofree char *response = NULL;
+
+    /* just cut off prefix, no waiting */
+    if (g_str_has_prefix(msg, REPORT_PREFIX_ALERT))
+    {
+        state->alert_callback(msg + sizeof(REPORT_PREFIX_ALERT) - 1 , state->interaction_param);
+    }
+    /* wait for y/N/f response on the same line */
+    else if (g_str_has_prefix(msg, REPORT_PREFIX_ASK_YES_NO_YESFOREVER))
+    {
+        /* example:
+         *   ASK_YES_NO_YESFOREVER ask_before_delete Do you want to delete selected files?
+         */
+        char *key = msg + sizeof(REPORT_PREFIX_ASK_YES_NO_YESFOREVER) - 1;
+        char *key_end = strchr(key, ' ');
+
+        bool ans = false;
+
+        if (!key_end)
+        {   /* example:
+             *  ASK_YES_NO_YESFOREVER Continue?
+             *
+             * Print a wraning only and do not scary users with error messages.
+             */
+            log_warning("invalid input format (missing option name), using simple ask yes/no");
+
+            /* can't simply use 'goto ask_yes_no' because of different lenght of prefixes */
+            ans = state->ask_yes_no_callback(key, state->interaction_param);
+        }
+        else
+        {
+            key_end[0] = '\0'; /* split 'key msg' to 'key' and 'msg' */
+            ans = state->ask_yes_no_yesforever_callback(key, key + strlen(key) + 1, state->interaction_param);
+            key_end[0] = ' '; /* restore original message, not sure if it is necessary */
+        }
+
+        response = g_strdup(ans ? "y" : "N");
+    }
+    /* wait for y/N/f/e response on the same line */
+    else if (g_str_has_prefix(msg, REPORT_PREFIX_ASK_YES_NO_SAVE_RESULT))
+    {
+        /* example:
+         *   ASK_YES_NO_SAVE_RESULT ask_before_delete Do you want to delete selected files?
+         */
+        char *key = msg + sizeof(REPORT_PREFIX_ASK_YES_NO_SAVE_RESULT) - 1;
+        char *key_end = strchr(key, ' ');
+
+        bool ans = false;
+
+        if (!key_end)
+        {   /* example:
+             *  ASK_YES_NO_YESFOREVER Continue?
+             *
+             * Print a wraning only and do not scary users with error messages.
+             */
+            log_warning("invalid input format (missing option name), using simple ask yes/no");
+
+            /* can't simply use 'goto ask_yes_no' because of different lenght of prefixes */
+            ans = state->ask_yes_no_callback(key, state->interaction_param);
+        }
+        else
+        {
+            key_end[0] = '\0'; /* split 'key msg' to 'key' and 'msg' */
+            ans = state->ask_yes_no_save_result_callback(key, key + strlen(key) + 1, state->interaction_param);
+            key_end[0] = ' '; /* restore original message, not sure if it is necessary */
+        }
+
+        response = g_strdup(ans ? "y" : "N");
+    }
+    /* wait for y/N response on the same line */
+    else if (g_str_has_prefix(msg, REPORT_PREFIX_ASK_YES_NO))
+    {
+        const bool ans = state->ask_yes_no_callback(msg + sizeof(REPORT_PREFIX_ASK_YES_NO) - 1, state->interaction_param);
+        response = g_strdup(ans ? "y" : "N");
+    }
+    /* wait for the string on the same line */
+    else if (g_str_has_prefix(msg, REPORT_PREFIX_ASK))
+    {
+        response = state->ask_callback(msg + sizeof(REPORT_PREFIX_ASK) - 1, state->interaction_param);
+    }
+    /* set echo off and wait for password on the same line */
+    else if (g_str_has_prefix(msg, REPORT_PREFIX_ASK_PASSWORD))
+    {
+        response = state->ask_password_callback(msg + sizeof(REPORT_PREFIX_ASK_PASSWORD) - 1, state->interaction_param);
+    }
+    /* no special prefix -> forward to log if applicable
+     * note that callback may take ownership of buf by returning NULL */
+    else if (state->logging_callback)
+    {
+        g_autofree char *logged = state->logging_callback(g_strdup(msg), state->logging_param);
+    }
+
+    if (response)
+    {
+        size_t len = strlen(response);
+        response[len++] = '\n';
+
+        if (libreport_full_write(in_fd, response, len) != len)
+        {
+            if (state->error_callback)
+                state->error_callback("<WRITE ERROR>", state->error_param);
+            else
+                perror_msg_and_die("Can't write %zu bytes to child's stdin", len);
+        }
+    }
+}
+
+/* Returns exit code of the command, or nonzero return value of
+ * post_run_callback.
+ */
+static int command_retval(struct run_event_state *state, int status, const char *dump_dir_name)
+{
+    int retval = WEXITSTATUS(status);
+    if (WIFSIGNALED(status))
+        retval = WTERMSIG(status) + 128;
+
+    if (retval == 0 && state->post_run_callback)
+        retval = state->post_run_callback(dump_dir_name, state->post_run_param);
+
+    return retval;
+}
+
 int consume_event_command_output(struct run_event_state *state, const char *dump_dir_name)
 {
-    int r = 0;
-    char buf[256];
+    ssize_t r = 0;
+    char buf[16 * 1024];
     errno = 0;
     GString *cmd_output = state->command_output;
-    while ((r = libreport_safe_read(state->command_out_fd, buf, sizeof(buf) - 1)) > 0)
+    while ((r = libreport_safe_read(state->command_out_fd, buf, sizeof(buf))) > 0)
     {
+        char *raw = buf;
+        char *const end = buf + r;
         char *newline;
-        char *raw;
-        buf[r] = '\0';
-        raw = buf;
 
-        while ((newline = strchr(raw, '\n')) != NULL)
+        /* Only the new data are scanned. Lines read whole are processed
+         * in place, without copying.
+         */
+        while ((newline = memchr(raw, '\n', end - raw)) != NULL)
         {
             *newline = '\0';
-            g_string_append(cmd_output, raw);
-            char *msg = cmd_output->str;
-
-            g_autofree char *response = NULL;
-
-            /* just cut off prefix, no waiting */
-            if (g_str_has_prefix(msg, REPORT_PREFIX_ALERT))
+            if (cmd_output->len == 0)
+                process_command_line(state, state->command_in_fd, raw);
+            else
             {
-                state->alert_callback(msg + sizeof(REPORT_PREFIX_ALERT) - 1 , state->interaction_param);
+                g_string_append(cmd_output, raw);
+                process_command_line(state, state->command_in_fd, cmd_output->str);
+                g_string_erase(cmd_output, 0, -1);
             }
-            /* wait for y/N/f response on the same line */
-            else if (g_str_has_prefix(msg, REPORT_PREFIX_ASK_YES_NO_YESFOREVER))
-            {
-                /* example:
-                 *   ASK_YES_NO_YESFOREVER ask_before_delete Do you want to delete selected files?
-                 */
-                char *key = msg + sizeof(REPORT_PREFIX_ASK_YES_NO_YESFOREVER) - 1;
-                char *key_end = strchr(key, ' ');
 
-                bool ans = false;
+            /* jump to next line */
+            raw = newline + 1;
+        }
 
-                if (!key_end)
-                {   /* example:
-                     *  ASK_YES_NO_YESFOREVER Continue?
-                     *
-                     * Print a wraning only and do not scary users with error messages.
-                     */
-                    log_warning("invalid input format (missing option name), using simple ask yes/no");
+        /* beginning of next line. the line continues by next read() */
+        g_string_append_len(cmd_output, raw, end - raw);
+    }
 
-                    /* can't simply use 'goto ask_yes_no' because of different lenght of prefixes */
-                    ans = state->ask_yes_no_callback(key, state->interaction_param);
-                }
-                else
-                {
-                    key_end[0] = '\0'; /* split 'key msg' to 'key' and 'msg' */
-                    ans = state->ask_yes_no_yesforever_callback(key, key + strlen(key) + 1, state->interaction_param);
-                    key_end[0] = ' '; /* restore original message, not sure if it is necessary */
-                }
+    /* Hope that child's stdout fd was set to O_NONBLOCK */
+    if (r == -1 && errno == EAGAIN)
+        return -1;
 
-                response = g_strdup(ans ? "y" : "N");
-            }
-            /* wait for y/N/f/e response on the same line */
-            else if (g_str_has_prefix(msg, REPORT_PREFIX_ASK_YES_NO_SAVE_RESULT))
-            {
-                /* example:
-                 *   ASK_YES_NO_SAVE_RESULT ask_before_delete Do you want to delete selected files?
-                 */
-                char *key = msg + sizeof(REPORT_PREFIX_ASK_YES_NO_SAVE_RESULT) - 1;
-                char *key_end = strchr(key, ' ');
+    g_string_erase(cmd_output, 0, -1);
 
-                bool ans = false;
+    /* Wait for child to actually exit, collect status */
+    libreport_safe_waitpid(state->command_pid, &(state->process_status), 0);
 
-                if (!key_end)
-                {   /* example:
-                     *  ASK_YES_NO_YESFOREVER Continue?
-                     *
-                     * Print a wraning only and do not scary users with error messages.
-                     */
-                    log_warning("invalid input format (missing option name), using simple ask yes/no");
+    return command_retval(state, state->process_status, dump_dir_name);
+}
 
-                    /* can't simply use 'goto ask_yes_no' because of different lenght of prefixes */
-                    ans = state->ask_yes_no_callback(key, state->interaction_param);
-                }
-                else
-                {
-                    key_end[0] = '\0'; /* split 'key msg' to 'key' and 'msg' */
-                    ans = state->ask_yes_no_save_result_callback(key, key + strlen(key) + 1, state->interaction_param);
-                    key_end[0] = ' '; /* restore original message, not sure if it is necessary */
-                }
+/* Event loop */
 
-                response = g_strdup(ans ? "y" : "N");
-            }
-            /* wait for y/N response on the same line */
-            else if (g_str_has_prefix(msg, REPORT_PREFIX_ASK_YES_NO))
-            {
-                const bool ans = state->ask_yes_no_callback(msg + sizeof(REPORT_PREFIX_ASK_YES_NO) - 1, state->interaction_param);
-                response = g_strdup(ans ? "y" : "N");
-            }
-            /* wait for the string on the same line */
-            else if (g_str_has_prefix(msg, REPORT_PREFIX_ASK))
+struct run_event_loop_entry
+{
+    struct run_event_state *state;
+    char *dump_dir_name;
+    char *event;
+    run_event_loop_done_callback done;
+    void *param;
+};
+
+struct run_event_loop
+{
+    int epoll_fd;
+    /* Entries with a running command */
+    GList *entries;
+};
+
+struct run_event_loop *new_run_event_loop(void)
+{
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+    {
+        perror_msg("epoll_create1");
+        return NULL;
+    }
+
+    struct run_event_loop *loop = g_new0(struct run_event_loop, 1);
+    loop->epoll_fd = epoll_fd;
+    return loop;
+}
+
+static void close_command_fds(struct run_event_state *state)
+{
+    if (state->command_out_fd >= 0)
+        close(state->command_out_fd);
+    if (state->command_in_fd >= 0)
+        close(state->command_in_fd);
+    state->command_out_fd = -1;
+    state->command_in_fd = -1;
+}
+
+static void free_run_event_loop_entry(struct run_event_loop_entry *entry)
+{
+    g_free(entry->dump_dir_name);
+    g_free(entry->event);
+    g_free(entry);
+}
+
+void free_run_event_loop(struct run_event_loop *loop)
+{
+    if (loop == NULL)
+        return;
+
+    for (GList *e = loop->entries; e != NULL; e = g_list_next(e))
+    {
+        struct run_event_loop_entry *entry = e->data;
+        close_command_fds(entry->state);
+        free_commands(entry->state);
+        free_run_event_loop_entry(entry);
+    }
+    g_list_free(loop->entries);
+
+    close(loop->epoll_fd);
+    g_free(loop);
+}
+
+int run_event_loop_get_fd(struct run_event_loop *loop)
+{
+    return loop->epoll_fd;
+}
+
+static int watch_command_output(struct run_event_loop *loop, struct run_event_loop_entry *entry)
+{
+    struct run_event_state *state = entry->state;
+    libreport_ndelay_on(state->command_out_fd);
+
+    struct epoll_event ev = {
+        .events = EPOLLIN,
+        .data.ptr = entry,
+    };
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, state->command_out_fd, &ev) != 0)
+    {
+        perror_msg("Can't watch output of command");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void dispatch_command_output(struct run_event_loop *loop, struct run_event_loop_entry *entry);
+
+int run_event_loop_add(struct run_event_loop *loop,
+                struct run_event_state *state,
+                const char *dump_dir_name,
+                const char *event,
+                run_event_loop_done_callback done,
+                void *param
+) {
+    prepare_commands(state);
+    if (spawn_next_command(state, dump_dir_name, event, /*execflags:*/ 0) < 0)
+    {
+        free_commands(state);
+        return -1;
+    }
+
+    struct run_event_loop_entry *entry = g_new0(struct run_event_loop_entry, 1);
+    entry->state = state;
+    entry->dump_dir_name = g_strdup(dump_dir_name);
+    entry->event = g_strdup(event);
+    entry->done = done;
+    entry->param = param;
+    loop->entries = g_list_prepend(loop->entries, entry);
+
+    if (watch_command_output(loop, entry) != 0)
+    {
+        /* Run the event synchronously then */
+        libreport_ndelay_off(state->command_out_fd);
+        dispatch_command_output(loop, entry);
+    }
+
+    return 0;
+}
+
+/* Consumes available output of the entry's command, starts the next command
+ * if the command finished successfully.
+ */
+static void dispatch_command_output(struct run_event_loop *loop, struct run_event_loop_entry *entry)
+{
+    struct run_event_state *state = entry->state;
+    int retval;
+
+    for (;;)
+    {
+        retval = consume_event_command_output(state, entry->dump_dir_name);
+        if (retval < 0 && errno == EAGAIN)
+            return;
+
+        /* Removed explicitly, close() does not do it while a child
+         * spawned later holds a copy of the descriptor.
+         */
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, state->command_out_fd, NULL);
+        close_command_fds(state);
+
+        if (retval != 0
+         || spawn_next_command(state, entry->dump_dir_name, entry->event, /*execflags:*/ 0) < 0)
+        {
+            break;
+        }
+
+        if (watch_command_output(loop, entry) == 0)
+            return;
+
+        /* Read the output blocking */
+        libreport_ndelay_off(state->command_out_fd);
+    }
+
+    loop->entries = g_list_remove(loop->entries, entry);
+    free_commands(state);
+
+    if (entry->done)
+        entry->done(state, retval, entry->param);
+    free_run_event_loop_entry(entry);
+}
+
+int run_event_loop_dispatch(struct run_event_loop *loop, int timeout)
+{
+    struct epoll_event events[16];
+    const int count = epoll_wait(loop->epoll_fd, events, G_N_ELEMENTS(events), timeout);
+    if (count < 0 && errno != EINTR)
+        perror_msg("epoll_wait");
+
+    for (int i = 0; i < count; ++i)
+        dispatch_command_output(loop, events[i].data.ptr);
+
+    return g_list_length(loop->entries);
+}
+
+static void store_run_event_retval(struct run_event_state *state, int retval, void *param)
+{
+    *(int *)param = retval;
+}
+
+/* A command run by run_commands_in_parallel() */
+struct parallel_command
+{
+    pid_t pid;
+    /* -1 once the command closed its output */
+    int out_fd;
+    int in_fd;
+    int status;
+    bool parallel;
+    /* The line continues by next read() */
+    GString *partial_line;
+    /* Complete lines waiting for their turn */
+    GQueue lines;
+};
+
+static struct parallel_command *start_parallel_command(struct run_event_state *state,
+                char *cmd,
+                bool parallel,
+                const char *dump_dir_name,
+                const char *event
+) {
+    struct parallel_command *command = g_new0(struct parallel_command, 1);
+
+    int pipefds[2];
+    command->pid = spawn_command(state, cmd, dump_dir_name, event, /*execflags:*/ 0, pipefds);
+    command->out_fd = pipefds[0];
+    command->in_fd = pipefds[1];
+    /* Commands started later must not hold the pipes */
+    libreport_close_on_exec_on(command->out_fd);
+    libreport_close_on_exec_on(command->in_fd);
+
+    command->parallel = parallel;
+    command->partial_line = g_string_new(NULL);
+    g_queue_init(&command->lines);
+
+    return command;
+}
+
+static void read_parallel_command(struct parallel_command *command)
+{
+    char buf[4096];
+    const ssize_t r = libreport_safe_read(command->out_fd, buf, sizeof(buf));
+    if (r > 0)
+    {
+        const char *raw = buf;
+        const char *const end = buf + r;
+        const char *newline;
+        while ((newline = memchr(raw, '\n', end - raw)) != NULL)
+        {
+            g_string_append_len(command->partial_line, raw, newline - raw);
+            g_queue_push_tail(&command->lines, g_string_free(command->partial_line, FALSE));
+            command->partial_line = g_string_new(NULL);
+            raw = newline + 1;
+        }
+        g_string_append_len(command->partial_line, raw, end - raw);
+        return;
+    }
+
+    /* EOF or error, an unterminated last line is dropped as in
+     * consume_event_command_output()
+     */
+    close(command->out_fd);
+    command->out_fd = -1;
+    libreport_safe_waitpid(command->pid, &command->status, 0);
+}
+
+static void free_parallel_command(struct parallel_command *command)
+{
+    if (command->out_fd >= 0)
+        close(command->out_fd);
+    close(command->in_fd);
+
+    char *line;
+    while ((line = g_queue_pop_head(&command->lines)) != NULL)
+        g_free(line);
+
+    g_string_free(command->partial_line, TRUE);
+    g_free(command);
+}
+
+/* How often run_commands_in_parallel() checks whether the dump dir has been
+ * unlocked
+ */
+#define DEFERRED_SELECTION_TIMEOUT_MS 100
+
+/* Runs commands of rules annotated by PARALLEL=yes concurrently, at most
+ * state->max_parallel_commands at once. Other commands run alone, once all
+ * previously started commands finished.
+ *
+ * Output lines are processed in the order the commands were started: output
+ * of a command is buffered until all commands started before it finish.
+ * Hence logs of the commands do not interleave and only one command at a
+ * time gets its questions asked, the others wait for answers meanwhile.
+ *
+ * As in the sequential mode, no new commands are started after a failure.
+ * Returns the first nonzero return value in the start order.
+ */
+static int run_commands_in_parallel(struct run_event_state *state,
+                const char *dump_dir_name,
+                const char *event
+) {
+    GQueue running = G_QUEUE_INIT;
+    /* Selected command which must wait for the running ones */
+    char *exclusive_cmd = NULL;
+    bool no_more_commands = false;
+    int retval = 0;
+
+    g_autofree struct pollfd *pfds = g_new(struct pollfd, state->max_parallel_commands);
+    g_autofree struct parallel_command **polled = g_new(struct parallel_command *, state->max_parallel_commands);
+
+    while (1)
+    {
+        bool selection_deferred = false;
+        while (retval == 0 && running.length < state->max_parallel_commands)
+        {
+            const struct parallel_command *last = g_queue_peek_tail(&running);
+            if (last != NULL && !last->parallel)
+                break;
+
+            if (exclusive_cmd != NULL)
             {
-                response = state->ask_callback(msg + sizeof(REPORT_PREFIX_ASK) - 1, state->interaction_param);
+                if (running.length == 0)
+                {
+                    g_queue_push_tail(&running,
+                            start_parallel_command(state, exclusive_cmd, false, dump_dir_name, event));
+                    g_free(exclusive_cmd);
+                    exclusive_cmd = NULL;
+                }
+                break;
             }
-            /* set echo off and wait for password on the same line */
-            else if (g_str_has_prefix(msg, REPORT_PREFIX_ASK_PASSWORD))
+
+            if (no_more_commands)
+                break;
+
+            /* A running command can hold the lock of the dump dir while it
+             * waits for us to read its output, hence we must not wait for
+             * the lock but keep reading and try again later.
+             */
+            struct dump_dir *dd = NULL;
+            if (running.length != 0)
             {
-                response = state->ask_password_callback(msg + sizeof(REPORT_PREFIX_ASK_PASSWORD) - 1, state->interaction_param);
+                dd = dd_opendir(dump_dir_name, DD_OPEN_READONLY | DD_OPEN_SHARED_LOCK
+                                | DD_DONT_WAIT_FOR_LOCK | DD_FAIL_QUIETLY_ENOENT | DD_FAIL_QUIETLY_EACCES);
+                if (dd == NULL)
+                {
+                    selection_deferred = true;
+                    break;
+                }
             }
-            /* no special prefix -> forward to log if applicable
-             * note that callback may take ownership of buf by returning NULL */
-            else if (state->logging_callback)
+
+            bool parallel = false;
+            char *cmd = select_next_command(state, dd, dump_dir_name, event, &parallel);
+            dd_close(dd);
+            if (cmd == NULL)
             {
-                g_autofree char *logged = state->logging_callback(g_strdup(msg), state->logging_param);
+                no_more_commands = true;
+                break;
             }
 
-            if (response)
+            if (!parallel && running.length != 0)
             {
-                size_t len = strlen(response);
-                response[len++] = '\n';
-
-                if (libreport_full_write(state->command_in_fd, response, len) != len)
-                {
-                    if (state->error_callback)
-                        state->error_callback("<WRITE ERROR>", state->error_param);
-                    else
-                        perror_msg_and_die("Can't write %zu bytes to child's stdin", len);
-                }
+                exclusive_cmd = cmd;
+                break;
             }
 
-            g_string_erase(cmd_output, 0, -1);
-
-            /* jump to next line */
-            raw = newline + 1;
+            g_queue_push_tail(&running, start_parallel_command(state, cmd, parallel, dump_dir_name, event));
+            g_free(cmd);
         }
 
-        /* beginning of next line. the line continues by next read() */
-        g_string_append(cmd_output, raw);
-    }
+        struct parallel_command *oldest = g_queue_peek_head(&running);
+        if (oldest == NULL)
+            break;
 
-    /* Hope that child's stdout fd was set to O_NONBLOCK */
-    if (r == -1 && errno == EAGAIN)
-        return -1;
+        char *line;
+        while ((line = g_queue_pop_head(&oldest->lines)) != NULL)
+        {
+            process_command_line(state, oldest->in_fd, line);
+            g_free(line);
+        }
 
-    g_string_erase(cmd_output, 0, -1);
+        if (oldest->out_fd < 0)
+        {
+            g_queue_pop_head(&running);
+            const int r = command_retval(state, oldest->status, dump_dir_name);
+            if (retval == 0)
+                retval = r;
+            free_parallel_command(oldest);
+            continue;
+        }
 
-    /* Wait for child to actually exit, collect status */
-    libreport_safe_waitpid(state->command_pid, &(state->process_status), 0);
+        nfds_t count = 0;
+        for (GList *c = running.head; c != NULL; c = g_list_next(c))
+        {
+            struct parallel_command *command = c->data;
+            if (command->out_fd < 0)
+                continue;
+
+            pfds[count].fd = command->out_fd;
+            pfds[count].events = POLLIN;
+            pfds[count].revents = 0;
+            polled[count++] = command;
+        }
 
-    int retval = WEXITSTATUS(state->process_status);
-    if (WIFSIGNALED(state->process_status))
-        retval = WTERMSIG(state->process_status) + 128;
+        if (poll(pfds, count, selection_deferred ? DEFERRED_SELECTION_TIMEOUT_MS : -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror_msg_and_die("poll");
+        }
 
-    if (retval == 0 && state->post_run_callback)
-        retval = state->post_run_callback(dump_dir_name, state->post_run_param);
+        for (nfds_t i = 0; i < count; ++i)
+        {
+            if (pfds[i].revents != 0)
+                read_parallel_command(polled[i]);
+        }
+    }
+
+    g_free(exclusive_cmd);
 
     return retval;
 }
@@ -708,16 +1569,26 @@ int run_event_on_dir_name(struct run_event_state *state,
                 const char *dump_dir_name,
                 const char *event
 ) {
-    prepare_commands(state);
-
     /* Execute every command in shell */
 
     int retval = 0;
-    while (spawn_next_command(state, dump_dir_name, event, /*execflags:*/ 0) >= 0)
+    if (state->max_parallel_commands > 1)
     {
-        retval = consume_event_command_output(state, dump_dir_name);
-        if (retval != 0)
-            break;
+        prepare_commands(state);
+        retval = run_commands_in_parallel(state, dump_dir_name, event);
+    }
+    else
+    {
+        struct run_event_loop *loop = new_run_event_loop();
+        if (loop == NULL)
+            return -1;
+
+        if (run_event_loop_add(loop, state, dump_dir_name, event, store_run_event_retval, &retval) == 0)
+        {
+            while (run_event_loop_dispatch(loop, /*timeout:*/ -1) > 0)
+                continue;
+        }
+        free_run_event_loop(loop);
     }
 
     free_commands(state);
@@ -753,7 +1624,8 @@ static char *_list_possible_events(struct dump_dir **dd, problem_data_t *pd, con
 {
     GString *result = g_string_new(NULL);
 
-    GList *rule_list = load_rule_list(NULL, CONF_DIR"/report_event.conf", /*recursion_depth:*/ 0);
+    struct rule_set *set = load_rule_set(report_event_conf_path());
+    GList *rule_list = get_rule_set_rules(set, /*event*/NULL);
 
     unsigned pfx_len = strlen(pfx);
     for (;;)
@@ -762,6 +1634,7 @@ static char *_list_possible_events(struct dump_dir **dd, problem_data_t *pd, con
         g_autofree char *event_name = NULL;
         g_autofree char *cmd = pop_next_command(&rule_list,
                 &event_name,       /* return event_name */
+                NULL,              /* don't return parallel */
                 dd,                /* match this dd... */
                 pd,                /* no problem data */
                 dump_dir_name,     /* ...or if NULL, this dirname */
@@ -769,7 +1642,7 @@ static char *_list_possible_events(struct dump_dir **dd, problem_data_t *pd, con
         );
         if (!cmd)
         {
-            free_rule_list(rule_list);
+            g_list_free(rule_list);
             break;
         }
 
@@ -792,6 +1665,8 @@ static char *_list_possible_events(struct dump_dir **dd, problem_data_t *pd, con
         }
     }
 
+    unref_rule_set(set);
+
     return g_string_free(result, FALSE);
 }
 
@@ -808,7 +1683,7 @@ char *list_possible_events_problem_data(problem_data_t *pd, const char *dump_dir
 GList *list_possible_events_glist(const char *problem_dir_name,
                                   const char *pfx)
 {
-    struct dump_dir *dd = dd_opendir(problem_dir_name, DD_OPEN_READONLY);
+    struct dump_dir *dd = dd_opendir(problem_dir_name, DD_OPEN_READONLY | DD_OPEN_SHARED_LOCK);
     g_autofree char *events = list_possible_events(dd, problem_dir_name, pfx);
     GList *l = libreport_parse_delimited_list(events, "\n");
     dd_close(dd);
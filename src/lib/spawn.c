@@ -20,6 +20,7 @@
  */
 #include <glib/gstdio.h>
 #include <glib-unix.h>
+#include <spawn.h>
 #include "internal_libreport.h"
 
 static char *concat_str_vector(char **strings)
@@ -45,6 +46,140 @@ static char *concat_str_vector(char **strings)
 	return result;
 }
 
+/* posix_spawn() runs the child in the memory of the parent until exec,
+ * which spares copying page tables of big processes. Changing credentials
+ * of the child is not supported by it, nor is changing its directory by old
+ * libcs.
+ */
+static bool can_posix_spawn(int flags, const char *dir)
+{
+	if (flags & EXECFLG_SETGUID)
+		return false;
+#ifndef POSIX_SPAWN_SETSID
+	if (flags & EXECFLG_SETSID)
+		return false;
+#endif
+#ifndef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP
+	if (dir)
+		return false;
+#endif
+	return true;
+}
+
+/* Applies env_vec to a copy of our environment, the same way
+ * putenv() applies it to the environment of the forked child.
+ */
+static char **make_child_environ(char **env_vec)
+{
+	char **envp = g_get_environ();
+	for (; *env_vec; env_vec++) {
+		const char *eq = strchr(*env_vec, '=');
+		if (!eq) {
+			envp = g_environ_unsetenv(envp, *env_vec);
+			continue;
+		}
+		g_autofree char *name = g_strndup(*env_vec, eq - *env_vec);
+		envp = g_environ_setenv(envp, name, eq + 1, TRUE);
+	}
+	return envp;
+}
+
+/* Returns pid, or -1 if the child can't be spawned this way */
+static pid_t posix_spawn_execv(int flags,
+		char **argv,
+		int *pipefds,
+		char **env_vec,
+		const char *dir,
+		const char *prog_as_string)
+{
+	/* Reminder: [0] is read end, [1] is write end */
+	int pipe_to_child[2];
+	int pipe_fm_child[2];
+	pid_t child = -1;
+
+	/* The ends we keep are closed in the child by exec */
+	if (flags & EXECFLG_INPUT)
+		g_unix_open_pipe(pipe_to_child, FD_CLOEXEC, NULL);
+	if (flags & EXECFLG_OUTPUT)
+		g_unix_open_pipe(pipe_fm_child, FD_CLOEXEC, NULL);
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawnattr_t attr;
+	posix_spawnattr_init(&attr);
+
+	short attr_flags = 0;
+#ifdef POSIX_SPAWN_SETSID
+	if (flags & EXECFLG_SETSID)
+		attr_flags |= POSIX_SPAWN_SETSID;
+#endif
+	if (flags & EXECFLG_SETPGID)
+		attr_flags |= POSIX_SPAWN_SETPGROUP;
+	/* pgroup 0 means the child's pid, as setpgid(0, 0) */
+	posix_spawnattr_setflags(&attr, attr_flags);
+
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP
+	if (dir)
+		posix_spawn_file_actions_addchdir_np(&actions, dir);
+#endif
+
+	/* dup2() of a descriptor onto itself clears its FD_CLOEXEC */
+	if (flags & EXECFLG_INPUT)
+		posix_spawn_file_actions_adddup2(&actions, pipe_to_child[0], STDIN_FILENO);
+	else if (flags & EXECFLG_INPUT_NUL)
+		posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDWR, 0);
+	if (flags & EXECFLG_OUTPUT)
+		posix_spawn_file_actions_adddup2(&actions, pipe_fm_child[1], STDOUT_FILENO);
+	else if (flags & EXECFLG_OUTPUT_NUL)
+		posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_RDWR, 0);
+
+	if (flags & EXECFLG_ERR2OUT)
+		posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+	else if (flags & EXECFLG_ERR_NUL)
+		posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_RDWR, 0);
+
+	g_auto(GStrv) envp = env_vec ? make_child_environ(env_vec) : NULL;
+
+	log_info("Executing: %s", prog_as_string);
+	int err = posix_spawnp(&child, argv[0], &actions, &attr, argv, envp ? envp : environ);
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+
+	if (err != 0) {
+		log_info("Can't spawn '%s': %s", argv[0], strerror(err));
+		child = -1;
+	}
+
+	if (flags & EXECFLG_INPUT) {
+		close(pipe_to_child[0]);
+		if (child > 0)
+			pipefds[1] = pipe_to_child[1];
+		else
+			close(pipe_to_child[1]);
+	}
+	if (flags & EXECFLG_OUTPUT) {
+		close(pipe_fm_child[1]);
+		if (child > 0)
+			pipefds[0] = pipe_fm_child[0];
+		else
+			close(pipe_fm_child[0]);
+	}
+
+	return child;
+}
+
+/* Like libreport_xmove_fd(), but the result survives exec also if the
+ * descriptors are the same.
+ */
+static void move_fd_to_stdio(int from, int to)
+{
+	if (from == to)
+		fcntl(to, F_SETFD, 0);
+	else
+		libreport_xmove_fd(from, to);
+}
+
 /* Returns pid */
 pid_t libreport_fork_execv_on_steroids(int flags,
 		char **argv,
@@ -62,14 +197,27 @@ pid_t libreport_fork_execv_on_steroids(int flags,
 	if (!pipefds)
 		flags &= ~(EXECFLG_INPUT | EXECFLG_OUTPUT);
 
-	if (flags & EXECFLG_INPUT)
-		g_unix_open_pipe(pipe_to_child, 0, NULL);
-	if (flags & EXECFLG_OUTPUT)
-		g_unix_open_pipe(pipe_fm_child, 0, NULL);
-
 	/* Prepare it before fork, to avoid thread-unsafe malloc there */
 	g_autofree char *prog_as_string = NULL;
 	prog_as_string = concat_str_vector(argv);
+
+	if (can_posix_spawn(flags, dir)) {
+		child = posix_spawn_execv(flags, argv, pipefds, env_vec, dir, prog_as_string);
+		if (child > 0)
+			return child;
+		/* Fork then, a child which fails to exec reports the error
+		 * and exits with 127 as callers expect.
+		 */
+	}
+
+	/* The ends we keep must not leak into children spawned later, they
+	 * would keep the pipes open after we close them.
+	 */
+	if (flags & EXECFLG_INPUT)
+		g_unix_open_pipe(pipe_to_child, FD_CLOEXEC, NULL);
+	if (flags & EXECFLG_OUTPUT)
+		g_unix_open_pipe(pipe_fm_child, FD_CLOEXEC, NULL);
+
 	gid_t gid;
 	if (flags & EXECFLG_SETGUID) {
 		struct passwd* pw = getpwuid(uid);
@@ -106,13 +254,13 @@ pid_t libreport_fork_execv_on_steroids(int flags,
 			 * pipe_to_child[1] may be equal to STDIN_FILENO
 			 */
 			close(pipe_to_child[1]);
-			libreport_xmove_fd(pipe_to_child[0], STDIN_FILENO);
+			move_fd_to_stdio(pipe_to_child[0], STDIN_FILENO);
 		} else if (flags & EXECFLG_INPUT_NUL) {
 			libreport_xmove_fd(g_open("/dev/null", O_RDWR), STDIN_FILENO);
 		}
 		if (flags & EXECFLG_OUTPUT) {
 			close(pipe_fm_child[0]);
-			libreport_xmove_fd(pipe_fm_child[1], STDOUT_FILENO);
+			move_fd_to_stdio(pipe_fm_child[1], STDOUT_FILENO);
 		} else if (flags & EXECFLG_OUTPUT_NUL) {
 			libreport_xmove_fd(g_open("/dev/null", O_RDWR), STDOUT_FILENO);
 		}
@@ -604,7 +604,7 @@ libreport_ureport_from_dump_dir_ext(const char *dump_dir_path, const struct urep
 
     if (preferences != NULL && preferences->urp_auth_items != NULL)
     {
-        struct dump_dir *dd = dd_opendir(dump_dir_path, DD_OPEN_READONLY);
+        struct dump_dir *dd = dd_opendir(dump_dir_path, DD_OPEN_READONLY | DD_OPEN_SHARED_LOCK);
         if (!dd)
             libreport_xfunc_die(); /* dd_opendir() already printed an error message */
 
@@ -659,7 +659,6 @@ libreport_ureport_do_post(const char *json, struct ureport_server_config *config
     const char *headers[] =
     {
         "Accept: application/json",
-        "Connection: close",
         NULL,
     };
     g_autofree char *dest_url = g_build_filename(config->ur_url ? config->ur_url : "", url_sfx, NULL);
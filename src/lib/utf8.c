@@ -18,17 +18,102 @@
 */
 #include "internal_libreport.h"
 
-char *libreport_sanitize_utf8(const char *src, uint32_t control_chars_to_sanitize)
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* The smallest code point which needs the given number of Bytes. Anything
+ * below is an overlong encoding.
+ */
+static const unsigned utf8_min_code_point[] = {
+    0, 0, 0x80, 0x800, 0x10000, 0x200000, 0x4000000
+};
+
+/* Returns the length of the leading run of printable ASCII chars. Such chars
+ * need neither sanitizing nor the text heuristics.
+ */
+static size_t printable_ascii_run(const unsigned char *src, size_t len)
 {
-    const char *initial_src = src;
-    char *sanitized = NULL;
-    unsigned sanitized_pos = 0;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i del = _mm_set1_epi8(0x7f);
+    for (; i + 16 <= len; i += 16)
+    {
+        const __m128i chunk = _mm_loadu_si128((const __m128i *)(src + i));
+        /* Signed comparison, so Bytes >= 0x80 are less than ' ' too */
+        const __m128i special = _mm_or_si128(_mm_cmplt_epi8(chunk, space),
+                                             _mm_cmpeq_epi8(chunk, del));
+        const int mask = _mm_movemask_epi8(special);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#endif
 
-    while (*src)
+    while (i < len && src[i] >= ' ' && src[i] < 0x7f)
+        ++i;
+
+    return i;
+}
+
+/* Feeds the text heuristics with len Bytes. Returns false at the first
+ * control char other than white space.
+ */
+static bool update_text_stats(struct libreport_text_stats *stats, bool *prev_was_unicode,
+        const unsigned char *src, size_t len)
+{
+    for (size_t i = 0; i < len; ++i)
     {
+        const unsigned char c = src[i];
+        if (c < ' ' && (c < '\t' || c > '\r'))
+        {
+            stats->control_chars++;
+            return false;
+        }
+
+        if (c == 0x7f)
+            stats->bad_chars++;
+        else if (c > 0x7f)
+        {
+            /* We test two possible bad cases with one comparison:
+             * (1) prev byte was unicode AND cur byte is 11xxxxxx:
+             * BAD - unicode start byte can't be in the middle of unicode char
+             * (2) prev byte wasnt unicode AND cur byte is 10xxxxxx:
+             * BAD - unicode continuation byte can't start unicode char
+             */
+            if (*prev_was_unicode == ((c & 0x40) == 0x40))
+                stats->bad_chars++;
+        }
+        *prev_was_unicode = (c > 0x7f);
+    }
+
+    return true;
+}
+
+char *libreport_sanitize_utf8_ext(const char *src, size_t len,
+        uint32_t control_chars_to_sanitize, struct libreport_text_stats *stats)
+{
+    const unsigned char *const bytes_src = (const unsigned char *)src;
+    GString *sanitized = NULL;
+    /* Bytes in front of this position are in sanitized already */
+    size_t copied = 0;
+    size_t pos = 0;
+    bool prev_was_unicode = false;
+
+    while (pos < len)
+    {
+        const size_t run = printable_ascii_run(bytes_src + pos, len - pos);
+        if (run != 0)
+        {
+            pos += run;
+            prev_was_unicode = false;
+            continue;
+        }
+
         int bytes = 0;
 
-        unsigned c = (unsigned char) *src;
+        unsigned c = bytes_src[pos];
         if (c <= 0x7f)
         {
             if (c < 32 && (((uint32_t)1 << c) & control_chars_to_sanitize))
@@ -54,59 +139,64 @@ char *libreport_sanitize_utf8(const char *src, uint32_t control_chars_to_sanitiz
         }
 
         c = (uint8_t)(c) >> bytes;
+        for (int i = 1; i < bytes; ++i)
         {
-            const char *pp = src;
-            int cnt = bytes;
-            while (--cnt)
-            {
-                unsigned ch = (unsigned char) *++pp;
-                if ((ch & 0xc0) != 0x80) /* Missing "continuation" byte. Example: e0 80 */
-                {
-                    goto bad_byte;
-                }
-                c = (c << 6) + (ch & 0x3f);
-            }
+            if (pos + i >= len)
+                goto bad_byte;
+
+            unsigned ch = bytes_src[pos + i];
+            if ((ch & 0xc0) != 0x80) /* Missing "continuation" byte. Example: e0 80 */
+                goto bad_byte;
+
+            c = (c << 6) + (ch & 0x3f);
         }
-        /* TODO */
-        /* Need to check that c isn't produced by overlong encoding */
-        /* Example: 11000000 10000000 converts to NUL */
-        /* 11110000 10000000 10000100 10000000 converts to 0x100 */
-        /* correct encoding: 11000100 10000000 */
-        if (c <= 0x7f) /* crude check: only catches bad encodings which map to chars <= 7f */
-        {
+
+        /* Overlong encoding. Examples:
+         * 11000000 10000000 converts to NUL
+         * 11110000 10000000 10000100 10000000 converts to 0x100,
+         * correct encoding: 11000100 10000000
+         */
+        if (c < utf8_min_code_point[bytes])
             goto bad_byte;
-        }
 
  good_byte:
-        while (--bytes >= 0)
-        {
-            c = (unsigned char) *src++;
-            if (sanitized)
-            {
-                sanitized = (char*) g_realloc(sanitized, sanitized_pos + 2);
-                sanitized[sanitized_pos++] = c;
-                sanitized[sanitized_pos] = '\0';
-            }
-        }
+        if (stats && !update_text_stats(stats, &prev_was_unicode, bytes_src + pos, bytes))
+            goto control_char;
+        pos += bytes;
         continue;
 
  bad_byte:
+        if (stats && !update_text_stats(stats, &prev_was_unicode, bytes_src + pos, 1))
+            goto control_char;
+
         if (!sanitized)
-        {
-            sanitized_pos = src - initial_src;
-            sanitized = g_strndup(initial_src, sanitized_pos);
-        }
-        sanitized = (char*) g_realloc(sanitized, sanitized_pos + 5);
-        sanitized[sanitized_pos++] = '[';
-        c = (unsigned char) *src++;
-        sanitized[sanitized_pos++] = "0123456789ABCDEF"[c >> 4];
-        sanitized[sanitized_pos++] = "0123456789ABCDEF"[c & 0xf];
-        sanitized[sanitized_pos++] = ']';
-        sanitized[sanitized_pos] = '\0';
+            sanitized = g_string_sized_new(len + 16);
+        g_string_append_len(sanitized, src + copied, pos - copied);
+
+        c = bytes_src[pos++];
+        const char hex[] = {
+            '[', "0123456789ABCDEF"[c >> 4], "0123456789ABCDEF"[c & 0xf], ']'
+        };
+        g_string_append_len(sanitized, hex, sizeof(hex));
+        copied = pos;
     }
 
+    if (!sanitized)
+        return NULL; /* usually NULL: the whole string is ok */
+
+    g_string_append_len(sanitized, src + copied, len - copied);
+    log_info("note: bad utf8, converted '%.*s' -> '%s'", (int)len, src, sanitized->str);
+
+    return g_string_free(sanitized, FALSE);
+
+ control_char:
     if (sanitized)
-        log_info("note: bad utf8, converted '%s' -> '%s'", initial_src, sanitized);
+        g_string_free(sanitized, TRUE);
+
+    return NULL;
+}
 
-    return sanitized; /* usually NULL: the whole string is ok */
+char *libreport_sanitize_utf8(const char *src, uint32_t control_chars_to_sanitize)
+{
+    return libreport_sanitize_utf8_ext(src, strlen(src), control_chars_to_sanitize, NULL);
 }
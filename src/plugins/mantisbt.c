@@ -110,6 +110,104 @@ mantisbt_issue_info_free(mantisbt_issue_info_t *info)
     free(info);
 }
 
+/*
+ * Query cache
+ */
+
+/* id, dup_id, best_bt_rating, status, resolution, reporter, project, notes,
+ * attachments
+ */
+#define ISSUE_INFO_CACHE_TYPE "(iiumsmsmsmsasas)"
+/* The same with the lists built as GVariants */
+#define ISSUE_INFO_CACHE_FORMAT "(iiumsmsmsms@as@as)"
+
+static char *
+search_cache_group(const mantisbt_settings_t *settings, const char *abrt_hash)
+{
+    return g_strdup_printf("mantisbt %s abrt_hash %s", settings->m_mantisbt_url, abrt_hash);
+}
+
+static char *
+issue_cache_group(const mantisbt_settings_t *settings, const char *issue_id)
+{
+    return g_strdup_printf("mantisbt %s issue %s", settings->m_mantisbt_url, issue_id);
+}
+
+/* Called after the issue was changed */
+static void
+drop_cached_issue(const mantisbt_settings_t *settings, const char *issue_id)
+{
+    g_autofree char *group = issue_cache_group(settings, issue_id);
+    libreport_drop_query_cache(group);
+}
+
+static GVariant *
+list_to_variant(GList *strings)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_STRING_ARRAY);
+    for (GList *l = strings; l != NULL; l = l->next)
+        g_variant_builder_add(&builder, "s", (const char *)l->data);
+
+    return g_variant_builder_end(&builder);
+}
+
+static GList *
+list_from_iter(GVariantIter *iter)
+{
+    GList *strings = NULL;
+    char *string;
+    while (g_variant_iter_next(iter, "s", &string))
+        strings = g_list_prepend(strings, string);
+    g_variant_iter_free(iter);
+
+    return g_list_reverse(strings);
+}
+
+static GVariant *
+issue_info_to_variant(const mantisbt_issue_info_t *issue_info)
+{
+    return g_variant_new(ISSUE_INFO_CACHE_FORMAT,
+            issue_info->mii_id, issue_info->mii_dup_id, issue_info->mii_best_bt_rating,
+            issue_info->mii_status, issue_info->mii_resolution, issue_info->mii_reporter,
+            issue_info->mii_project, list_to_variant(issue_info->mii_notes),
+            list_to_variant(issue_info->mii_attachments));
+}
+
+static mantisbt_issue_info_t *
+issue_info_from_variant(GVariant *cached)
+{
+    mantisbt_issue_info_t *issue_info = mantisbt_issue_info_new();
+    GVariantIter *notes, *attachments;
+    g_variant_get(cached, ISSUE_INFO_CACHE_TYPE, &issue_info->mii_id, &issue_info->mii_dup_id,
+                  &issue_info->mii_best_bt_rating, &issue_info->mii_status,
+                  &issue_info->mii_resolution, &issue_info->mii_reporter,
+                  &issue_info->mii_project, &notes, &attachments);
+    issue_info->mii_notes = list_from_iter(notes);
+    issue_info->mii_attachments = list_from_iter(attachments);
+
+    return issue_info;
+}
+
+/* Returns the search result saved for key or NULL */
+static GVariant *
+load_cached_search(const mantisbt_settings_t *settings, const char *abrt_hash, const char *key)
+{
+    g_autofree char *group = search_cache_group(settings, abrt_hash);
+    return libreport_load_query_cache(group, key, G_VARIANT_TYPE_STRING_ARRAY,
+                                      settings->m_cache_ttl, settings->m_negative_cache_ttl);
+}
+
+static void
+save_cached_search(const mantisbt_settings_t *settings, const char *abrt_hash, const char *key, GList *ids)
+{
+    if (settings->m_cache_ttl == 0 && settings->m_negative_cache_ttl == 0)
+        return;
+
+    g_autofree char *group = search_cache_group(settings, abrt_hash);
+    libreport_save_query_cache(group, key, list_to_variant(ids));
+}
+
 mantisbt_issue_info_t *
 mantisbt_find_origin_bug_closed_duplicate(mantisbt_settings_t *settings, mantisbt_issue_info_t *info)
 {
@@ -364,49 +462,142 @@ soap_request_to_str(const soap_request_t *req)
     return ret;
 }
 
-static bool
-reader_move_reader_if_node_type_is_element_with_name_and_verify_its_value(xmlTextReaderPtr reader, const char *name)
+/* A value looked up in a SOAP response by response_find_values() */
+struct response_value
 {
-    /* is not element node */
-    if (xmlTextReaderNodeType(reader) != XML_ELEMENT_NODE)
-        return false;
-
-    /* is not required name */
-    if (xmlStrcmp(xmlTextReaderConstName(reader), BAD_CAST name) != 0)
-        return false;
-
-    /* read next node */
-    if (xmlTextReaderRead(reader) != 1)
-        return false;
+    /* Local names of the element and of its closest ancestors separated by
+     * '/', e.g. "status/name" for <name> of <status>
+     */
+    const char *path;
+    /* Depth of the element, the envelope is at 0; -1 for any */
+    int depth;
+    /* Only the first text is kept */
+    bool first;
+    /* Path of the enclosing element, e.g. "relationships/item" for an array;
+     * if set, there is exactly one value, possibly NULL, for each such element
+     * so values of the same element are at the same position in the lists
+     */
+    const char *item;
+    /* Texts of the matching elements, in document order */
+    GList *values;
+};
 
-    /* no value node */
-    if (xmlTextReaderHasValue(reader) == 0)
+static bool
+response_path_matches(GPtrArray *elements, char **path)
+{
+    const unsigned path_len = g_strv_length(path);
+    if (path_len > elements->len)
         return false;
 
-    /* no text node */
-    if (xmlTextReaderNodeType(reader) != XML_TEXT_NODE)
-        return false;
+    for (unsigned i = 1; i <= path_len; ++i)
+    {
+        if (strcmp(path[path_len - i], g_ptr_array_index(elements, elements->len - i)) != 0)
+            return false;
+    }
 
     return true;
 }
 
+/* Finds all values in one pass through the response. The reader streams the
+ * text, no tree of the document is built.
+ */
 static void
-reader_find_element_by_name(xmlTextReaderPtr reader, const char *name)
+response_find_values(const char *xml, struct response_value *values, size_t count)
 {
-    while (xmlTextReaderRead(reader) == 1)
+    if (xml == NULL)
+        error_msg_and_die(_("SOAP: Failed to parse xml."));
+
+    xmlTextReaderPtr reader = xmlReaderForMemory(xml, strlen(xml), NULL, NULL, XML_PARSE_NONET);
+    if (reader == NULL)
+        error_msg_and_die(_("SOAP: Failed to create xml text reader."));
+
+    char ***paths = g_new(char **, count);
+    char ***item_paths = g_new0(char **, count);
+    for (size_t i = 0; i < count; ++i)
     {
-        /* is not element node */
-        if (xmlTextReaderNodeType(reader) != XML_ELEMENT_NODE)
+        paths[i] = g_strsplit(values[i].path, "/", -1);
+        if (values[i].item != NULL)
+            item_paths[i] = g_strsplit(values[i].item, "/", -1);
+    }
+
+    /* Local names of the open elements */
+    GPtrArray *elements = g_ptr_array_new_with_free_func(g_free);
+
+    int ret;
+    while ((ret = xmlTextReaderRead(reader)) == 1)
+    {
+        const int type = xmlTextReaderNodeType(reader);
+        if (type != XML_READER_TYPE_ELEMENT && type != XML_READER_TYPE_TEXT)
             continue;
 
-        /* is not required name */
-        if (xmlStrcmp(xmlTextReaderConstName(reader), BAD_CAST name) != 0)
+        /* drop the elements closed since the previous node */
+        g_ptr_array_set_size(elements, xmlTextReaderDepth(reader));
+
+        if (type == XML_READER_TYPE_ELEMENT)
+        {
+            g_ptr_array_add(elements, g_strdup((const char *) xmlTextReaderConstLocalName(reader)));
+
+            /* an empty slot for the value of the new item */
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (item_paths[i] != NULL && response_path_matches(elements, item_paths[i]))
+                    values[i].values = g_list_prepend(values[i].values, NULL);
+            }
             continue;
+        }
 
-        break;
+        const int depth = (int)elements->len - 1;
+        for (size_t i = 0; i < count; ++i)
+        {
+            struct response_value *value = &values[i];
+            if (value->first && value->values != NULL)
+                continue;
+
+            /* is not right depth */
+            if (value->depth != -1 && value->depth != depth)
+                continue;
+
+            if (!response_path_matches(elements, paths[i]))
+                continue;
+
+            const xmlChar *text = xmlTextReaderConstValue(reader);
+            if (text == NULL)
+                continue;
+
+            if (value->item == NULL)
+                value->values = g_list_prepend(value->values, g_strdup((const char *) text));
+            /* only the first text of an item */
+            else if (value->values != NULL && value->values->data == NULL)
+                value->values->data = g_strdup((const char *) text);
+        }
     }
 
-    return;
+    for (size_t i = 0; i < count; ++i)
+    {
+        values[i].values = g_list_reverse(values[i].values);
+        g_strfreev(paths[i]);
+        g_strfreev(item_paths[i]);
+    }
+    g_free(paths);
+    g_free(item_paths);
+    g_ptr_array_free(elements, TRUE);
+    xmlFreeTextReader(reader);
+
+    if (ret != 0)
+        error_msg_and_die(_("SOAP: Failed to parse xml."));
+}
+
+/* Returns the first value and frees the others */
+static char *
+response_values_steal_first(GList *values)
+{
+    if (values == NULL)
+        return NULL;
+
+    char *first = values->data;
+    g_list_free_full(g_list_delete_link(values, values), free);
+
+    return first;
 }
 
 /* It is not possible to search only by name because the response contains
@@ -428,120 +619,19 @@ reader_find_element_by_name(xmlTextReaderPtr reader, const char *name)
 static GList *
 response_values_at_depth_by_name(const char *xml, const char *name, int depth)
 {
-    xmlDocPtr doc = xmlParseDoc(BAD_CAST xml);
-    if (doc == NULL)
-        error_msg_and_die(_("SOAP: Failed to parse xml (searching value at depth by name)."));
-
-    xmlTextReaderPtr reader = xmlReaderWalker(doc);
-    if (reader == NULL)
-        error_msg_and_die(_("SOAP: Failed to create xml text reader."));
+    struct response_value value = { .path = name, .depth = depth };
+    response_find_values(xml, &value, 1);
 
-    GList *result = NULL;
-
-    const xmlChar *value;
-    while (xmlTextReaderRead(reader) == 1)
-    {
-        /* is not right depth */
-        if (depth != -1 && xmlTextReaderDepth(reader) != depth)
-            continue;
-
-        if (reader_move_reader_if_node_type_is_element_with_name_and_verify_its_value(reader, name) == false)
-            continue;
-
-        if ((value = xmlTextReaderConstValue(reader)) != NULL)
-            result = g_list_append(result, g_strdup((const char *) value));
-    }
-    xmlFreeTextReader(reader);
-
-    return result;
+    return value.values;
 }
 
-/*
- * Finds an element named 'elem' and returns a text of a child named 'name'
- *
- * Example:
- *  For
- *  <elem>
- *      <id>1</id>
- *      <name>foo</name>
- *  </elem>
- *
- *  returns "foo"
- */
 static char *
-response_get_name_value_of_element(const char *xml, const char *element)
-{
-    xmlDocPtr doc = xmlParseDoc(BAD_CAST xml);
-    if (doc == NULL)
-        error_msg_and_die(_("SOAP: Failed to parse xml."));
-
-    xmlTextReaderPtr reader = xmlReaderWalker(doc);
-    if (reader == NULL)
-        error_msg_and_die(_("SOAP: Failed to create xml text reader."));
-
-    const xmlChar *value = NULL;
-
-    reader_find_element_by_name(reader, element);
-
-    /* find 'name' element and return its text */
-    while (xmlTextReaderRead(reader) == 1)
-    {
-        if (reader_move_reader_if_node_type_is_element_with_name_and_verify_its_value(reader, "name") == false)
-            continue;
-
-        if ((value = xmlTextReaderConstValue(reader)) != NULL)
-            break;
-    }
-    xmlFreeTextReader(reader);
-
-    return (char *) value;
-}
-
-static int
-response_get_id_of_relatedto_issue(const char *xml)
+response_first_value_at_depth_by_name(const char *xml, const char *name, int depth)
 {
-    xmlDocPtr doc = xmlParseDoc(BAD_CAST xml);
-    if (doc == NULL)
-        error_msg_and_die(_("SOAP: Failed to parse xml (get related to issue)."));
-
-    xmlTextReaderPtr reader = xmlReaderWalker(doc);
-    if (reader == NULL)
-        error_msg_and_die(_("SOAP: Failed to create xml text reader."));
-
-    const xmlChar *value = NULL;
-    const xmlChar *id = NULL;
-
-    /* find relationships section */
-    reader_find_element_by_name(reader, "relationships");
-
-    /* find "name" value of 'name' element */
-    while (xmlTextReaderRead(reader) == 1)
-    {
-        /* find type of relattionship */
-        if (reader_move_reader_if_node_type_is_element_with_name_and_verify_its_value(reader, "name") == false)
-            continue;
-
-        if ((value = xmlTextReaderConstValue(reader)) == NULL)
-            continue;
-
-        /* we need 'duplicate of' realtionship type */
-        if (xmlStrcmp(value, BAD_CAST "duplicate of") != 0)
-            continue;
+    struct response_value value = { .path = name, .depth = depth, .first = true };
+    response_find_values(xml, &value, 1);
 
-        /* find id of duplicate issues */
-        reader_find_element_by_name(reader, "target_id");
-
-        /* verify target_id node */
-        if (reader_move_reader_if_node_type_is_element_with_name_and_verify_its_value(reader, "target_id") == false)
-            continue;
-
-        /* get its value */
-        if ((id = xmlTextReaderConstValue(reader)) != NULL)
-            break;
-    }
-    xmlFreeTextReader(reader);
-
-    return (id == NULL) ? -1 : atoi((const char *) id);
+    return response_values_steal_first(value.values);
 }
 
 GList *
@@ -553,36 +643,27 @@ response_get_main_ids_list(const char *xml)
 int
 response_get_main_id(const char *xml)
 {
-    GList *l = response_values_at_depth_by_name(xml, "id", 5);
-    return (l != NULL) ? atoi(l->data) : -1;
+    g_autofree char *id = response_first_value_at_depth_by_name(xml, "id", 5);
+    return (id != NULL) ? atoi(id) : -1;
 }
 
 static int
 response_get_return_value(const char *xml)
 {
-    GList *l = response_values_at_depth_by_name(xml, "return", 3);
-    return (l != NULL) ? atoi(l->data) : -1;
+    g_autofree char *value = response_first_value_at_depth_by_name(xml, "return", 3);
+    return (value != NULL) ? atoi(value) : -1;
 }
 
 static char*
 response_get_return_value_as_string(const char *xml)
 {
-    GList *l = response_values_at_depth_by_name(xml, "return", 3);
-    return (l != NULL) ? l->data : NULL;
+    return response_first_value_at_depth_by_name(xml, "return", 3);
 }
 
 static char *
 response_get_error_msg(const char *xml)
 {
-    GList *l = response_values_at_depth_by_name(xml, "faultstring", 3);
-    return (l != NULL) ? g_strdup(l->data) : NULL;
-}
-
-static char *
-response_get_additioanl_information(const char *xml)
-{
-    GList *l = response_values_at_depth_by_name(xml, "additional_information", -1);
-    return (l != NULL) ? g_strdup(l->data) : NULL;
+    return response_first_value_at_depth_by_name(xml, "faultstring", 3);
 }
 
 void
@@ -719,6 +800,7 @@ mantisbt_attach_data(const mantisbt_settings_t *settings, const char *bug_id,
     int id = response_get_return_value(result->mr_body);
 
     mantisbt_result_free(result);
+    drop_cached_issue(settings, bug_id);
 
     return id;
 }
@@ -771,6 +853,14 @@ mantisbt_attach_file(const mantisbt_settings_t *settings, const char *bug_id,
         close(fd);
         return 0;
     }
+    /* Dump dir elements may be stored compressed */
+    fd = libreport_uncompressed_element_fd(fd);
+    if (fd < 0)
+    {
+        errno = -fd;
+        perror_msg(_("Can't open '%s'"), path);
+        return 0;
+    }
     log_debug("attaching '%s' as file", att_name);
     int ret = mantisbt_attach_fd(settings, bug_id, att_name, fd);
     close(fd);
@@ -805,6 +895,14 @@ soap_filter_custom_fields_add_new_item(xmlNodePtr filter_node, const char *custo
 GList *
 mantisbt_search_by_abrt_hash(mantisbt_settings_t *settings, const char *abrt_hash)
 {
+    GVariant *cached = load_cached_search(settings, abrt_hash, "");
+    if (cached != NULL)
+    {
+        GVariantIter *iter = g_variant_iter_new(cached);
+        g_variant_unref(cached);
+        return list_from_iter(iter);
+    }
+
     soap_request_t *req = soap_request_new_for_method("mc_filter_search_issues");
     soap_request_add_credentials_parameter(req, settings);
 
@@ -835,6 +933,8 @@ mantisbt_search_by_abrt_hash(mantisbt_settings_t *settings, const char *abrt_has
     GList *ids = response_get_main_ids_list(result->mr_body);
     mantisbt_result_free(result);
 
+    save_cached_search(settings, abrt_hash, "", ids);
+
     return ids;
 }
 
@@ -842,6 +942,16 @@ GList *
 mantisbt_search_duplicate_issues(mantisbt_settings_t *settings, const char *category,
                                      const char *version, const char *abrt_hash)
 {
+    g_autofree char *key = g_strdup_printf("%s\n%s\n%s", settings->m_project_id,
+                                           category, version ? version : "");
+    GVariant *cached = load_cached_search(settings, abrt_hash, key);
+    if (cached != NULL)
+    {
+        GVariantIter *iter = g_variant_iter_new(cached);
+        g_variant_unref(cached);
+        return list_from_iter(iter);
+    }
+
     soap_request_t *req = soap_request_new_for_method("mc_filter_search_issues");
     soap_request_add_credentials_parameter(req, settings);
 
@@ -880,6 +990,8 @@ mantisbt_search_duplicate_issues(mantisbt_settings_t *settings, const char *cate
     GList *ids = response_get_main_ids_list(result->mr_body);
     mantisbt_result_free(result);
 
+    save_cached_search(settings, abrt_hash, key, ids);
+
     return ids;
 }
 
@@ -925,8 +1037,13 @@ mantisbt_get_custom_fields(const mantisbt_settings_t *settings, mantisbt_custom_
     if (result->mr_http_resp_code != 200)
         error_msg_and_die(_("Failed to get custom fields for '%s' project"), settings->m_project);
 
-    GList *ids = response_values_at_depth_by_name(result->mr_body, "id", -1);
-    GList *names = response_values_at_depth_by_name(result->mr_body, "name", -1);
+    struct response_value values[] = {
+        { .path = "id", .depth = -1 },
+        { .path = "name", .depth = -1 },
+    };
+    response_find_values(result->mr_body, values, G_N_ELEMENTS(values));
+    GList *ids = values[0].values;
+    GList *names = values[1].values;
 
     mantisbt_result_free(result);
 
@@ -974,16 +1091,34 @@ mantisbt_create_new_issue(const mantisbt_settings_t *settings,
     int id = response_get_return_value(result->mr_body);
 
     mantisbt_result_free(result);
+
+    /* Searches for the duphash have a new result */
+    if (duphash != NULL)
+    {
+        g_autofree char *group = search_cache_group(settings, duphash);
+        libreport_drop_query_cache(group);
+    }
+
     return id;
 }
 
 mantisbt_issue_info_t *
 mantisbt_get_issue_info(const mantisbt_settings_t *settings, int issue_id)
 {
+    g_autofree char *issue_id_str = g_strdup_printf("%d", issue_id);
+    g_autofree char *group = issue_cache_group(settings, issue_id_str);
+    GVariant *cached = libreport_load_query_cache(group, "", G_VARIANT_TYPE(ISSUE_INFO_CACHE_TYPE),
+                                                  settings->m_cache_ttl, /*negative_ttl_secs*/0);
+    if (cached != NULL)
+    {
+        mantisbt_issue_info_t *issue_info = issue_info_from_variant(cached);
+        g_variant_unref(cached);
+        return issue_info;
+    }
+
     soap_request_t *req = soap_request_new_for_method("mc_issue_get");
     soap_request_add_credentials_parameter(req, settings);
 
-    g_autofree char *issue_id_str = g_strdup_printf("%d", issue_id);
     soap_request_add_method_parameter(req, "issue_id", SOAP_INTEGER, issue_id_str);
 
     mantisbt_result_t *result = mantisbt_soap_call(settings, req);
@@ -998,16 +1133,57 @@ mantisbt_get_issue_info(const mantisbt_settings_t *settings, int issue_id)
 
     mantisbt_issue_info_t *issue_info = mantisbt_issue_info_new();
 
+    enum {
+        STATUS,
+        RESOLUTION,
+        REPORTER,
+        PROJECT,
+        RELATIONSHIP_TYPES,
+        RELATIONSHIP_TARGETS,
+        NOTES,
+        ADDITIONAL_INFORMATION,
+        ATTACHMENTS,
+        ISSUE_VALUES_COUNT
+    };
+    struct response_value values[ISSUE_VALUES_COUNT] = {
+        [STATUS] = { .path = "status/name", .depth = -1, .first = true },
+        [RESOLUTION] = { .path = "resolution/name", .depth = -1, .first = true },
+        [REPORTER] = { .path = "reporter/name", .depth = -1, .first = true },
+        [PROJECT] = { .path = "project/name", .depth = -1, .first = true },
+        /* a type and a target for each relationship, NULL if it is missing */
+        [RELATIONSHIP_TYPES] = { .path = "relationships/item/type/name", .depth = -1,
+                                 .item = "relationships/item" },
+        [RELATIONSHIP_TARGETS] = { .path = "relationships/item/target_id", .depth = -1,
+                                   .item = "relationships/item" },
+        /* notes are stored in <text> element */
+        [NOTES] = { .path = "text", .depth = -1 },
+        /* looking for bt rating in additional information too */
+        [ADDITIONAL_INFORMATION] = { .path = "additional_information", .depth = -1, .first = true },
+        [ATTACHMENTS] = { .path = "filename", .depth = -1 },
+    };
+    response_find_values(result->mr_body, values, ISSUE_VALUES_COUNT);
+
     issue_info->mii_id = issue_id;
-    issue_info->mii_status = response_get_name_value_of_element(result->mr_body, "status");
-    issue_info->mii_resolution = response_get_name_value_of_element(result->mr_body, "resolution");
-    issue_info->mii_reporter = response_get_name_value_of_element(result->mr_body, "reporter");
-    issue_info->mii_project = response_get_name_value_of_element(result->mr_body, "project");
+    issue_info->mii_status = response_values_steal_first(values[STATUS].values);
+    issue_info->mii_resolution = response_values_steal_first(values[RESOLUTION].values);
+    issue_info->mii_reporter = response_values_steal_first(values[REPORTER].values);
+    issue_info->mii_project = response_values_steal_first(values[PROJECT].values);
 
     if (strcmp(issue_info->mii_status, "closed") == 0 && !issue_info->mii_resolution)
         error_msg(_("Issue %i is CLOSED, but it has no RESOLUTION"), issue_info->mii_id);
 
-    issue_info->mii_dup_id = response_get_id_of_relatedto_issue(result->mr_body);
+    /* we need 'duplicate of' relationship type */
+    GList *target = values[RELATIONSHIP_TARGETS].values;
+    for (GList *type = values[RELATIONSHIP_TYPES].values; type && target; type = g_list_next(type), target = g_list_next(target))
+    {
+        if (type->data != NULL && target->data != NULL && strcmp(type->data, "duplicate of") == 0)
+        {
+            issue_info->mii_dup_id = atoi(target->data);
+            break;
+        }
+    }
+    response_values_free(values[RELATIONSHIP_TYPES].values);
+    response_values_free(values[RELATIONSHIP_TARGETS].values);
 
     if (strcmp(issue_info->mii_status, "closed") == 0
         && (issue_info->mii_resolution != NULL && strcmp(issue_info->mii_resolution, "duplicate") == 0)
@@ -1017,17 +1193,20 @@ mantisbt_get_issue_info(const mantisbt_settings_t *settings, int issue_id)
                             issue_info->mii_id);
     }
 
-    /* notes are stored in <text> element */
-    issue_info->mii_notes = response_values_at_depth_by_name(result->mr_body, "text", -1);
-
-    /* looking for bt rating in additional information too */
-    char *add_info = response_get_additioanl_information(result->mr_body);
+    issue_info->mii_notes = values[NOTES].values;
+    char *add_info = response_values_steal_first(values[ADDITIONAL_INFORMATION].values);
     if (add_info != NULL)
         issue_info->mii_notes = g_list_append (issue_info->mii_notes, add_info);
-    issue_info->mii_attachments = response_values_at_depth_by_name(result->mr_body, "filename", -1);
+    issue_info->mii_attachments = values[ATTACHMENTS].values;
     issue_info->mii_best_bt_rating = libreport_comments_find_best_bt_rating(issue_info->mii_notes);
 
     mantisbt_result_free(result);
+
+    if (settings->m_cache_ttl > 0)
+    {
+        libreport_save_query_cache(group, "", issue_info_to_variant(issue_info));
+    }
+
     return issue_info;
 }
 
@@ -1056,6 +1235,7 @@ mantisbt_add_issue_note(const mantisbt_settings_t *settings, int issue_id, const
     int id = response_get_return_value(result->mr_body);
 
     mantisbt_result_free(result);
+    drop_cached_issue(settings, issue_id_str);
     return id;
 }
 
@@ -63,6 +63,10 @@ typedef struct mantisbt_settings
     const char *m_DontMatchComponents;
     int         m_ssl_verify;
     int         m_create_private;
+    /* Seconds for which searches and issue info are reused, 0 turns it off */
+    unsigned    m_cache_ttl;
+    /* The same for searches which found nothing */
+    unsigned    m_negative_cache_ttl;
 } mantisbt_settings_t;
 
 typedef struct mantisbt_result
@@ -19,6 +19,7 @@
 #include "internal_libreport.h"
 #include "problem_report.h"
 #include "client.h"
+#include "libreport_curl.h"
 #include "abrt_xmlrpc.h"
 #include "rhbz.h"
 
@@ -26,6 +27,10 @@
 
 #define DEFAULT_BUGZILLA_PRODUCT "Fedora"
 
+/* Seconds for which results of searches and bug data are reused */
+#define DEFAULT_CACHE_TTL_SECS (10 * 60)
+#define DEFAULT_NEGATIVE_CACHE_TTL_SECS 60
+
 static
 int attach_text_item(struct abrt_xmlrpc *ax, const char *bug_id,
                 const char *item_name, struct problem_item *item)
@@ -33,8 +38,10 @@ int attach_text_item(struct abrt_xmlrpc *ax, const char *bug_id,
     if (!(item->flags & CD_FLAG_TXT))
         return 0;
     log_debug("attaching '%s' as text", item_name);
+    unsigned long size = 0;
+    problem_item_get_size(item, &size);
     int r = rhbz_attach_blob(ax, bug_id,
-                item_name, item->content, strlen(item->content),
+                item_name, item->content, size,
                 RHBZ_MINOR_UPDATE
     );
     return (r == 0);
@@ -42,15 +49,16 @@ int attach_text_item(struct abrt_xmlrpc *ax, const char *bug_id,
 
 static
 int attach_file_item(struct abrt_xmlrpc *ax, const char *bug_id,
-                const char *item_name, struct problem_item *item)
+                const char *item_name, struct problem_item *item, int flags)
 {
     if (!(item->flags & CD_FLAG_BIN))
         return 0;
 
     char *filename = item->content;
-    int fd = open(filename, O_RDONLY);
+    int fd = problem_item_open_file(item);
     if (fd < 0)
     {
+        errno = -fd;
         perror_msg("Can't open '%s'", filename);
         return 0;
     }
@@ -63,7 +71,7 @@ int attach_file_item(struct abrt_xmlrpc *ax, const char *bug_id,
         return 0;
     }
     log_debug("attaching '%s' as file", item_name);
-    int flag = RHBZ_MINOR_UPDATE;
+    int flag = flags | RHBZ_MINOR_UPDATE;
     if (!(item->flags & CD_FLAG_BIGTXT))
         flag |= RHBZ_BINARY_ATTACHMENT;
     int r = rhbz_attach_fd(ax, bug_id, item_name, fd, flag);
@@ -83,9 +91,29 @@ struct bugzilla_struct {
     const char *b_DontMatchComponents;
     int         b_ssl_verify;
     int         b_create_private;
+    int         b_attachment_flags;
+    unsigned    b_cache_ttl;
+    unsigned    b_negative_cache_ttl;
     GList       *b_private_groups;
 };
 
+static unsigned parse_seconds(const char *name, const char *value, unsigned default_secs)
+{
+    if (!value || !value[0])
+        return default_secs;
+
+    char *end;
+    errno = 0;
+    const unsigned long long secs = g_ascii_strtoull(value, &end, 10);
+    if (errno || *end || value[0] == '-' || secs > UINT_MAX)
+    {
+        error_msg(_("Invalid %s '%s', using %u"), name, value, default_secs);
+        return default_secs;
+    }
+
+    return secs;
+}
+
 static void set_default_settings(GHashTable *osinfo, GHashTable *settings)
 {
     g_autofree char *default_BugzillaURL = NULL;
@@ -163,6 +191,24 @@ static void set_settings(struct bugzilla_struct *b, GHashTable *settings)
         environ = g_hash_table_lookup(settings, "DontMatchComponents");
     b->b_DontMatchComponents = environ ? environ : "";
 
+    environ = getenv("Bugzilla_AttachmentAPI");
+    if (!environ)
+        environ = g_hash_table_lookup(settings, "AttachmentAPI");
+    if (environ && strcmp(environ, "rest") == 0)
+        b->b_attachment_flags = RHBZ_REST_ATTACHMENT;
+    else if (environ && environ[0] && strcmp(environ, "xmlrpc") != 0)
+        error_msg(_("Unknown attachment API '%s', using XML-RPC"), environ);
+
+    environ = getenv("Bugzilla_CacheTTL");
+    if (!environ)
+        environ = g_hash_table_lookup(settings, "CacheTTL");
+    b->b_cache_ttl = parse_seconds("CacheTTL", environ, DEFAULT_CACHE_TTL_SECS);
+
+    environ = getenv("Bugzilla_NegativeCacheTTL");
+    if (!environ)
+        environ = g_hash_table_lookup(settings, "NegativeCacheTTL");
+    b->b_negative_cache_ttl = parse_seconds("NegativeCacheTTL", environ, DEFAULT_NEGATIVE_CACHE_TTL_SECS);
+
     b->b_create_private = libreport_get_global_create_private_ticket();
 
     if (!b->b_create_private)
@@ -387,6 +433,7 @@ int main(int argc, char **argv)
 
     struct abrt_xmlrpc *client;
     client = abrt_xmlrpc_new_redhat_client(rhbz.b_bugzilla_xmlrpc, rhbz.b_ssl_verify, rhbz.b_api_key);
+    rhbz_set_cache_ttl(rhbz.b_cache_ttl, rhbz.b_negative_cache_ttl);
     unsigned rhbz_ver = rhbz_version(client);
 
     if (abrt_hash)
@@ -532,7 +579,7 @@ int main(int argc, char **argv)
                     continue;
                 }
 
-                rhbz_attach_fd(client, ticket_no, filename, fd, /*flags*/ 0);
+                rhbz_attach_fd(client, ticket_no, filename, fd, rhbz.b_attachment_flags);
                 close(fd);
             }
         }
@@ -802,7 +849,7 @@ int main(int argc, char **argv)
                 else if (item->flags & CD_FLAG_TXT)
                     attach_text_item(client, new_id_str, item_name, item);
                 else if (item->flags & CD_FLAG_BIN)
-                    attach_file_item(client, new_id_str, item_name, item);
+                    attach_file_item(client, new_id_str, item_name, item, rhbz.b_attachment_flags);
             }
 
             bz = new_bug_info();
@@ -952,6 +999,7 @@ int main(int argc, char **argv)
     free(rhbz.b_product_version);
     free_bug_info(bz);
     abrt_xmlrpc_free_client(client);
+    post_retry_log_stats(NULL);
 
     return 0;
 }
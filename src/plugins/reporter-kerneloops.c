@@ -73,7 +73,8 @@ static void report_to_kerneloops(
                 const char *dump_dir_name,
                 GHashTable *settings)
 {
-    g_autoptr(problem_data_t) problem_data = create_problem_data_for_reporting(dump_dir_name);
+    /* Only the backtrace is sent, it is loaded on access */
+    g_autoptr(problem_data_t) problem_data = create_problem_data_for_reporting_ext(dump_dir_name, PD_LOAD_LAZY);
     if (!problem_data)
         libreport_xfunc_die(); /* create_problem_data_for_reporting already emitted error msg */
 
@@ -19,9 +19,14 @@
 
 #include "internal_libreport.h"
 #include "client.h"
+#include "libreport_curl.h"
 #include "mantisbt.h"
 #include "problem_report.h"
 
+/* Seconds for which results of searches and issue info are reused */
+#define DEFAULT_CACHE_TTL_SECS (10 * 60)
+#define DEFAULT_NEGATIVE_CACHE_TTL_SECS 60
+
 static void
 parse_osinfo_for_mantisbt(GHashTable *osinfo, char** project, char** version)
 {
@@ -117,6 +122,23 @@ verify_credentials(mantisbt_settings_t *settings)
         ask_mantisbt_credentials(settings, _("Invalid password or login."));
     }
 }
+static unsigned
+parse_seconds(const char *name, const char *value, unsigned default_secs)
+{
+    if (value == NULL || value[0] == '\0')
+        return default_secs;
+
+    char *end;
+    errno = 0;
+    const unsigned long long secs = g_ascii_strtoull(value, &end, 10);
+    if (errno != 0 || *end != '\0' || value[0] == '-' || secs > UINT_MAX)
+    {
+        error_msg(_("Invalid %s '%s', using %u"), name, value, default_secs);
+        return default_secs;
+    }
+
+    return secs;
+}
 
 static void
 set_settings(mantisbt_settings_t *m, GHashTable *settings, struct dump_dir *dd)
@@ -192,6 +214,16 @@ set_settings(mantisbt_settings_t *m, GHashTable *settings, struct dump_dir *dd)
         environ = g_hash_table_lookup(settings, "DontMatchComponents");
     m->m_DontMatchComponents = environ ? environ : "";
 
+    environ = getenv("Mantisbt_CacheTTL");
+    if (!environ)
+        environ = g_hash_table_lookup(settings, "CacheTTL");
+    m->m_cache_ttl = parse_seconds("CacheTTL", environ, DEFAULT_CACHE_TTL_SECS);
+
+    environ = getenv("Mantisbt_NegativeCacheTTL");
+    if (!environ)
+        environ = g_hash_table_lookup(settings, "NegativeCacheTTL");
+    m->m_negative_cache_ttl = parse_seconds("NegativeCacheTTL", environ, DEFAULT_NEGATIVE_CACHE_TTL_SECS);
+
     m->m_create_private = libreport_get_global_create_private_ticket();
 
     if (!m->m_create_private)
@@ -728,5 +760,6 @@ finish:
     }
 
     mantisbt_settings_free(&mbt_settings);
+    post_retry_log_stats(NULL);
     return 0;
 }
@@ -32,7 +32,12 @@ static char *ask_url(const char *message)
     return url;
 }
 
-static int interactive_upload_file(const char *url, const char *file_name,
+/* Uploads the data of fd if it is not negative, otherwise the file file_name.
+ *
+ * Returns 0 on success, -1 if uploading of fd was denied or the server needs
+ * to know its size in advance, and 1 on other errors.
+ */
+static int interactive_upload_file(const char *url, const char *file_name, int fd,
                                    GHashTable *settings, char **remote_name)
 {
     post_state_t *state = new_post_state(POST_WANT_ERROR_MSG);
@@ -62,7 +67,18 @@ static int interactive_upload_file(const char *url, const char *file_name,
     if (state->client_ssh_private_keyfile != NULL)
         log_debug("Using SSH private key '%s'", state->client_ssh_private_keyfile);
 
-    char *tmp = libreport_upload_file_ext(state, url, file_name, UPLOAD_FILE_HANDLE_ACCESS_DENIALS);
+    char *tmp = (fd < 0)
+        ? libreport_upload_file_ext(state, url, file_name, UPLOAD_FILE_HANDLE_ACCESS_DENIALS)
+        : libreport_upload_fd(state, url, file_name, fd);
+
+    int result = (tmp == NULL);
+    /* The stream can't be uploaded again with other credentials or with
+     * Content-Length
+     */
+    if (tmp == NULL && fd >= 0
+        && (state->curl_result == CURLE_LOGIN_DENIED || state->curl_result == CURLE_REMOTE_ACCESS_DENIED
+            || state->http_resp_code == 411 || state->http_resp_code == 501))
+        result = -1;
 
     if (remote_name)
         *remote_name = tmp;
@@ -71,8 +87,68 @@ static int interactive_upload_file(const char *url, const char *file_name,
 
     free_post_state(state);
 
-    /* return 0 on success */
-    return tmp == NULL;
+    return result;
+}
+
+/* Compresses the problem directory in a child process and uploads the
+ * archive while it is being created, without a temporary file. The child
+ * keeps the directory locked only until it has opened the elements.
+ *
+ * Returns the same values as interactive_upload_file().
+ */
+static int stream_and_upload_archive(const char *dump_dir_name,
+                const char *archive_name,
+                const char *url,
+                GHashTable *settings,
+                const_string_vector_const_ptr_t exclude_from_report,
+                char **remote_name)
+{
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) != 0)
+    {
+        perror_msg("pipe");
+        return 1;
+    }
+
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror_msg("fork");
+        close(pipefd[0]);
+        close(pipefd[1]);
+        return 1;
+    }
+
+    if (pid == 0) /* child */
+    {
+        close(pipefd[0]);
+        struct dump_dir *dd = dd_opendir(dump_dir_name, /*flags:*/ DD_OPEN_READONLY | DD_OPEN_SHARED_LOCK);
+        if (!dd)
+            _exit(1);
+        int r = dd_create_archive_fd(dd, pipefd[1], dd_archive_type_for_name(archive_name),
+                exclude_from_report, DD_ARCHIVE_UNLOCK);
+        dd_close(dd);
+        _exit(r != 0);
+    }
+
+    close(pipefd[1]);
+    int result = interactive_upload_file(url, archive_name, pipefd[0], settings, remote_name);
+
+    /* Stops the child if the upload failed before the archive was complete */
+    close(pipefd[0]);
+
+    int status;
+    libreport_safe_waitpid(pid, &status, 0);
+    if (result == 0 && (!WIFEXITED(status) || WEXITSTATUS(status) != 0))
+    {
+        /* EOF from the failed child finished the upload of a truncated archive */
+        error_msg(_("Can't create archive of '%s'"), dump_dir_name);
+        g_clear_pointer(remote_name, g_free);
+        result = 1;
+    }
+
+    return result;
 }
 
 static int create_and_upload_archive(
@@ -93,10 +169,43 @@ static int create_and_upload_archive(
 
     string_vector_ptr_t exclude_from_report = libreport_get_global_always_excluded_elements();
 
-    struct dump_dir *dd = dd_opendir(dump_dir_name, /*flags:*/ 0);
+    /* Let others read the problem directory while we compress it */
+    struct dump_dir *dd = dd_opendir(dump_dir_name, /*flags:*/ DD_OPEN_READONLY | DD_OPEN_SHARED_LOCK);
     if (!dd)
         libreport_xfunc_die(); /* error msg is already logged by dd_opendir */
 
+    /* Upload from /tmp to /tmp + deletion -> BAD, exclude this possibility */
+    const bool upload = url && url[0] && strcmp(url, "file://"LARGE_DATA_TMP_DIR"/") != 0;
+
+    /* SCP must know the size of the file before the upload starts */
+    if (upload && g_ascii_strncasecmp(url, "scp:", strlen("scp:")) != 0)
+    {
+        /* The child opens the directory on its own, the upload can take
+         * long and the directory must not be locked meanwhile
+         */
+        dd_close(dd);
+        dd = NULL;
+
+        log_warning(_("Compressing and uploading data"));
+        result = stream_and_upload_archive(dump_dir_name, strrchr(tempfile, '/') + 1, url, settings,
+                (const_string_vector_const_ptr_t)exclude_from_report, remote_name);
+        if (result >= 0)
+        {
+            /* No temporary file to remove */
+            g_clear_pointer(&tempfile, g_free);
+            goto ret;
+        }
+
+        /* Asking for other credentials and servers which need to know the
+         * size need an archive which can be uploaded again
+         */
+        result = 1;
+
+        dd = dd_opendir(dump_dir_name, /*flags:*/ DD_OPEN_READONLY | DD_OPEN_SHARED_LOCK);
+        if (!dd)
+            goto ret;
+    }
+
     /* Compressing e.g. 0.5gig coredump takes a while. Let client know what we are doing */
     log_warning(_("Compressing data"));
     if (dd_create_archive(dd, tempfile, (const_string_vector_const_ptr_t)exclude_from_report, 0) != 0)
@@ -109,9 +218,8 @@ static int create_and_upload_archive(
     dd = NULL;
 
     /* Upload the archive */
-    /* Upload from /tmp to /tmp + deletion -> BAD, exclude this possibility */
-    if (url && url[0] && strcmp(url, "file://"LARGE_DATA_TMP_DIR"/") != 0)
-        result = interactive_upload_file(url, tempfile, settings, remote_name);
+    if (upload)
+        result = interactive_upload_file(url, tempfile, /*fd*/-1, settings, remote_name);
     else
     {
         result = 0; /* success */
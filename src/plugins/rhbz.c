@@ -25,6 +25,7 @@
  */
 
 #include "internal_libreport.h"
+#include "libreport_curl.h"
 #include "rhbz.h"
 
 #define MAX_HOPS            5
@@ -68,6 +69,145 @@ void free_bug_info(struct bug_info *bi)
     g_free(bi);
 }
 
+/*
+ * Query cache
+ */
+
+/* id, dup_id, best_bt_rating, status, resolution, reporter, product, platform,
+ * cc_list, comments
+ */
+#define BUG_INFO_CACHE_TYPE "(iitmsmsmsmsmsasas)"
+/* The same with the lists built as GVariants */
+#define BUG_INFO_CACHE_FORMAT "(iitmsmsmsmsms@as@as)"
+
+static unsigned cache_ttl_secs;
+static unsigned cache_negative_ttl_secs;
+
+void rhbz_set_cache_ttl(unsigned ttl_secs, unsigned negative_ttl_secs)
+{
+    cache_ttl_secs = ttl_secs;
+    cache_negative_ttl_secs = negative_ttl_secs;
+}
+
+static char *search_cache_group(struct abrt_xmlrpc *ax, const char *duphash)
+{
+    return g_strdup_printf("bugzilla %s duphash %s", ax->ax_url, duphash);
+}
+
+static char *bug_cache_group(struct abrt_xmlrpc *ax, int bug_id)
+{
+    return g_strdup_printf("bugzilla %s bug %d", ax->ax_url, bug_id);
+}
+
+/* Called after the bug was changed */
+static void drop_cached_bug(struct abrt_xmlrpc *ax, int bug_id)
+{
+    g_autofree char *group = bug_cache_group(ax, bug_id);
+    libreport_drop_query_cache(group);
+}
+
+static GVariant *list_to_variant(GList *strings)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_STRING_ARRAY);
+    for (GList *l = strings; l; l = l->next)
+        g_variant_builder_add(&builder, "s", (const char *)l->data);
+
+    return g_variant_builder_end(&builder);
+}
+
+static GList *list_from_iter(GVariantIter *iter)
+{
+    GList *strings = NULL;
+    char *string;
+    while (g_variant_iter_next(iter, "s", &string))
+        strings = g_list_prepend(strings, string);
+    g_variant_iter_free(iter);
+
+    return g_list_reverse(strings);
+}
+
+static GVariant *bug_info_to_variant(const struct bug_info *bz)
+{
+    return g_variant_new(BUG_INFO_CACHE_FORMAT, bz->bi_id, bz->bi_dup_id,
+                         (guint64)bz->bi_best_bt_rating, bz->bi_status,
+                         bz->bi_resolution, bz->bi_reporter, bz->bi_product,
+                         bz->bi_platform, list_to_variant(bz->bi_cc_list),
+                         list_to_variant(bz->bi_comments));
+}
+
+static struct bug_info *bug_info_from_variant(GVariant *cached)
+{
+    struct bug_info *bz = new_bug_info();
+    GVariantIter *cc_list, *comments;
+    g_variant_get(cached, BUG_INFO_CACHE_TYPE, &bz->bi_id, &bz->bi_dup_id,
+                  &bz->bi_best_bt_rating, &bz->bi_status, &bz->bi_resolution,
+                  &bz->bi_reporter, &bz->bi_product, &bz->bi_platform,
+                  &cc_list, &comments);
+    bz->bi_cc_list = list_from_iter(cc_list);
+    bz->bi_comments = list_from_iter(comments);
+
+    return bz;
+}
+
+/* Returns ids of the bugs in the Bug.search result or NULL if any is missing */
+static GVariant *bug_ids_to_variant(xmlrpc_value *bugs)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("ai"));
+
+    const unsigned count = rhbz_array_size(bugs);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        xmlrpc_value *item = rhbz_array_item_at(bugs, i);
+        int *id = rhbz_bug_read_item("id", item, RHBZ_READ_INT);
+        if (!id)
+            id = rhbz_bug_read_item("bug_id", item, RHBZ_READ_INT);
+        xmlrpc_DECREF(item);
+
+        if (!id)
+        {
+            g_variant_builder_clear(&builder);
+            return NULL;
+        }
+
+        g_variant_builder_add(&builder, "i", *id);
+        g_free(id);
+    }
+
+    return g_variant_builder_end(&builder);
+}
+
+/* Builds the Bug.search result, the id is in both members which
+ * rhbz_get_bug_id_from_array0() reads for old and new Bugzilla versions.
+ */
+static xmlrpc_value *bug_ids_from_variant(GVariant *cached)
+{
+    xmlrpc_env env;
+    xmlrpc_env_init(&env);
+
+    xmlrpc_value *bugs = xmlrpc_array_new(&env);
+    if (env.fault_occurred)
+        abrt_xmlrpc_die(&env);
+
+    GVariantIter iter;
+    g_variant_iter_init(&iter, cached);
+    gint32 id;
+    while (g_variant_iter_next(&iter, "i", &id))
+    {
+        xmlrpc_value *item = xmlrpc_build_value(&env, "{s:i,s:i}", "id", id, "bug_id", id);
+        if (env.fault_occurred)
+            abrt_xmlrpc_die(&env);
+
+        xmlrpc_array_append_item(&env, bugs, item);
+        xmlrpc_DECREF(item);
+        if (env.fault_occurred)
+            abrt_xmlrpc_die(&env);
+    }
+
+    return bugs;
+}
+
 static GList *rhbz_comments(struct abrt_xmlrpc *ax, int bug_id)
 {
     func_entry();
@@ -443,6 +583,16 @@ struct bug_info *rhbz_bug_info(struct abrt_xmlrpc *ax, int bug_id)
 {
     func_entry();
 
+    g_autofree char *group = bug_cache_group(ax, bug_id);
+    GVariant *cached = libreport_load_query_cache(group, "", G_VARIANT_TYPE(BUG_INFO_CACHE_TYPE),
+                                                  cache_ttl_secs, /*negative_ttl_secs*/0);
+    if (cached)
+    {
+        struct bug_info *bz = bug_info_from_variant(cached);
+        g_variant_unref(cached);
+        return bz;
+    }
+
     struct bug_info *bz = new_bug_info();
 
     /* http://www.bugzilla.org/docs/4.2/en/html/api/Bugzilla/WebService/Bug.html#get
@@ -501,6 +651,9 @@ struct bug_info *rhbz_bug_info(struct abrt_xmlrpc *ax, int bug_id)
     xmlrpc_DECREF(bug_item);
     xmlrpc_DECREF(xml_bug_response);
 
+    if (cache_ttl_secs)
+        libreport_save_query_cache(group, "", bug_info_to_variant(bz));
+
     return bz;
 }
 
@@ -626,9 +779,19 @@ int rhbz_new_bug(struct abrt_xmlrpc *ax,
     int new_bug_id = *r;
 
     log_warning(_("New bug id: %i"), new_bug_id);
+
+    /* Searches for the duphash have a new result */
+    g_autofree char *search_group = search_cache_group(ax, duphash);
+    libreport_drop_query_cache(search_group);
+
     return new_bug_id;
 }
 
+/* The fault of a change which conflicted with another user/bot changing the
+ * same bug, it is worth retrying
+ */
+#define RHBZ_CONFLICT_FAULT "query serialization error"
+
 /* suppress mail notify by {s:i} (minor_update:1) (driven by flag) */
 int rhbz_attach_blob(struct abrt_xmlrpc *ax, const char *bug_id,
                 const char *filename, const char *data, int data_len, int flags)
@@ -656,7 +819,7 @@ int rhbz_attach_blob(struct abrt_xmlrpc *ax, const char *bug_id,
      *
      * Retry if another user/bot attempted to change the same data.
      */
-    result = abrt_xmlrpc_call_with_retry("query serialization error", ax, "Bug.add_attachment", "{s:(s),s:s,s:s,s:s,s:6,s:i}",
+    result = abrt_xmlrpc_call_with_retry(RHBZ_CONFLICT_FAULT, ax, "Bug.add_attachment", "{s:(s),s:s,s:s,s:s,s:6,s:i}",
                 "ids", bug_id,
                 "summary", fn,
                 "file_name", filename,
@@ -677,46 +840,161 @@ int rhbz_attach_blob(struct abrt_xmlrpc *ax, const char *bug_id,
         return -1;
 
     xmlrpc_DECREF(result);
+    drop_cached_bug(ax, atoi(bug_id));
 
     return 0;
 }
 
+/* Bug.add_attachment params without "data" */
+static xmlrpc_value *rhbz_attachment_params(const char *bug_id, const char *att_name, int flags)
+{
+    g_autofree char *fn = g_strdup_printf("File: %s", att_name);
+    int minor_update = !!IS_MINOR_UPDATE(flags);
+
+    xmlrpc_env env;
+    xmlrpc_env_init(&env);
+    xmlrpc_value *params = xmlrpc_build_value(&env, "{s:(s),s:s,s:s,s:s,s:i}",
+                "ids", bug_id,
+                "summary", fn,
+                "file_name", att_name,
+                "content_type", (flags & RHBZ_BINARY_ATTACHMENT) ? "application/octet-stream" : "text/plain",
+                "minor_update", minor_update
+    );
+    if (env.fault_occurred)
+        abrt_xmlrpc_die(&env);
+
+    return params;
+}
+
+static void rhbz_attach_fd_xmlrpc(xmlrpc_env *env, struct abrt_xmlrpc *ax, const char *bug_id,
+                const char *att_name, int fd, int flags)
+{
+    xmlrpc_value *params = rhbz_attachment_params(bug_id, att_name, flags);
+
+    /* "data" is added and encoded to base64 while it is being sent */
+    xmlrpc_value *result = abrt_xmlrpc_call_with_fd(env, ax, "Bug.add_attachment", params, "data", fd,
+                                                    RHBZ_CONFLICT_FAULT);
+    xmlrpc_DECREF(params);
+
+    if (result)
+        xmlrpc_DECREF(result);
+}
+
+static void append_json_string(GString *json, const char *str)
+{
+    g_string_append_c(json, '"');
+    for (; *str; ++str)
+    {
+        if (*str == '"' || *str == '\\')
+            g_string_append_printf(json, "\\%c", *str);
+        else if ((unsigned char)*str < 0x20)
+            g_string_append_printf(json, "\\u%04x", (unsigned char)*str);
+        else
+            g_string_append_c(json, *str);
+    }
+    g_string_append_c(json, '"');
+}
+
+/* https://bugzilla.readthedocs.io/en/latest/api/core/v1/attachment.html#create-attachment
+ *
+ * The REST API is served next to xmlrpc.cgi and accepts the same credentials
+ * in HTTP headers.
+ */
+static void rhbz_attach_fd_rest(xmlrpc_env *env, struct abrt_xmlrpc *ax, const char *bug_id,
+                const char *att_name, int fd, int flags)
+{
+    xmlrpc_env_init(env);
+
+    g_autofree char *base_url = g_path_get_dirname(ax->ax_url);
+    g_autofree char *url = g_strdup_printf("%s/rest/bug/%s/attachment", base_url, bug_id);
+    g_autofree char *fn = g_strdup_printf("File: %s", att_name);
+
+    GString *prefix = g_string_new("{\"ids\":[");
+    append_json_string(prefix, bug_id);
+    g_string_append(prefix, "],\"summary\":");
+    append_json_string(prefix, fn);
+    g_string_append(prefix, ",\"file_name\":");
+    append_json_string(prefix, att_name);
+    g_string_append(prefix, ",\"content_type\":");
+    append_json_string(prefix, (flags & RHBZ_BINARY_ATTACHMENT) ? "application/octet-stream" : "text/plain");
+    g_string_append_printf(prefix, ",\"minor_update\":%s,\"data\":\"", IS_MINOR_UPDATE(flags) ? "true" : "false");
+
+    g_autofree char *api_key = abrt_xmlrpc_client_get_session_param_string(ax, "Bugzilla_api_key");
+    g_autofree char *token = abrt_xmlrpc_client_get_session_param_string(ax, "Bugzilla_token");
+    g_autofree char *api_key_header = NULL;
+    g_autofree char *token_header = NULL;
+    g_autofree char *authorization = NULL;
+    const char *headers[4] = { NULL };
+    unsigned header_count = 0;
+    if (api_key)
+        headers[header_count++] = api_key_header = g_strdup_printf("X-BUGZILLA-API-KEY: %s", api_key);
+    if (token)
+        headers[header_count++] = token_header = g_strdup_printf("X-BUGZILLA-TOKEN: %s", token);
+    if (ax->ax_api_key)
+        headers[header_count++] = authorization = g_strdup_printf("Authorization: Bearer %s", ax->ax_api_key);
+
+    post_state_t *state = new_post_state(POST_WANT_BODY | POST_WANT_ERROR_MSG
+                                         | (ax->ax_ssl_verify ? POST_WANT_SSL_VERIFY : 0));
+    state->retry_body_substring = RHBZ_CONFLICT_FAULT;
+    post_base64_fd(state, url, "application/json", headers, prefix->str, fd, "\"}");
+    g_string_free(prefix, TRUE);
+
+    if (state->curl_result != 0)
+    {
+        xmlrpc_env_set_fault_formatted(env, XMLRPC_NETWORK_ERROR, "Can't send the attachment: %s",
+                                       state->curl_error_msg ? state->curl_error_msg : "unknown error");
+    }
+    else if (state->http_resp_code != 200 && state->http_resp_code != 201)
+    {
+        /* The body is a JSON object with the error message */
+        xmlrpc_env_set_fault_formatted(env, XMLRPC_NETWORK_ERROR, "HTTP response code is %d: %s",
+                                       state->http_resp_code, state->body ? state->body : "");
+    }
+
+    free_post_state(state);
+}
+
 int rhbz_attach_fd(struct abrt_xmlrpc *ax, const char *bug_id,
                 const char *att_name, int fd, int flags)
 {
     func_entry();
 
-    off_t size = lseek(fd, 0, SEEK_END);
-    if (size < 0)
+    struct stat st;
+    if (fstat(fd, &st) != 0)
     {
-        perror_msg("Can't lseek '%s'", att_name);
+        perror_msg("Can't stat '%s'", att_name);
         return -1;
     }
 
-    /* bugzilla limit is 20MB
-     * attaching more then bugzilla's limit could cause that xmlrpc-c fails
-     * somewhere inside itself.
-     * https://bugzilla.redhat.com/show_bug.cgi?id=741980
-     */
-    if (size >= (20 * 1024 * 1024))
+    if (st.st_size == 0)
     {
-        error_msg("Can't upload '%s', it's too large (%llu bytes)", att_name, (long long)size);
-        return -1;
+        log_notice("not attaching an empty file: '%s'", att_name);
+        /* Return SUCCESS */
+        return 0;
     }
-    lseek(fd, 0, SEEK_SET);
 
-//TODO: need to have a method of attaching huge files (IOW: 1Gb read isn't good).
+    /* The file is encoded while it is being sent, it is never loaded into
+     * memory. Bugzilla refuses files over its own limit (20MB by default)
+     * with a fault.
+     *
+     * Conflicts with another user/bot changing the same bug are retried
+     * while sending.
+     */
+    xmlrpc_env env;
+    if (flags & RHBZ_REST_ATTACHMENT)
+        rhbz_attach_fd_rest(&env, ax, bug_id, att_name, fd, flags);
+    else
+        rhbz_attach_fd_xmlrpc(&env, ax, bug_id, att_name, fd, flags);
 
-    g_autofree char *data = g_malloc(size);
-    ssize_t r = libreport_full_read(fd, data, size);
-    if (r < 0)
+    if (!env.fault_occurred)
     {
-        perror_msg("Can't read '%s'", att_name);
-        return -1;
+        drop_cached_bug(ax, atoi(bug_id));
+        return 0;
     }
 
-    int res = rhbz_attach_blob(ax, bug_id, att_name, data, size, flags);
-    return res;
+    error_msg(_("Can't attach '%s': %s"), att_name, env.fault_string);
+    xmlrpc_env_clean(&env);
+    return -1;
 }
 
 void rhbz_logout(struct abrt_xmlrpc *ax)
@@ -776,6 +1054,7 @@ void rhbz_mail_to_cc(struct abrt_xmlrpc *ax, int bug_id, const char *mail, int f
     );
     if (result)
         xmlrpc_DECREF(result);
+    drop_cached_bug(ax, bug_id);
 
     /* TODO: check that result does indicate that CC was updated.
      * The structure I see from Bugzilla 4.2:
@@ -812,6 +1091,7 @@ void rhbz_add_comment(struct abrt_xmlrpc *ax, int bug_id, const char *comment,
 
     if (result)
         xmlrpc_DECREF(result);
+    drop_cached_bug(ax, bug_id);
 }
 
 void rhbz_set_url(struct abrt_xmlrpc *ax, int bug_id, const char *url, int flags)
@@ -832,6 +1112,7 @@ void rhbz_set_url(struct abrt_xmlrpc *ax, int bug_id, const char *url, int flags
 
     if (result)
         xmlrpc_DECREF(result);
+    drop_cached_bug(ax, bug_id);
 }
 
 void rhbz_close_as_duplicate(struct abrt_xmlrpc *ax, int bug_id,
@@ -856,6 +1137,7 @@ void rhbz_close_as_duplicate(struct abrt_xmlrpc *ax, int bug_id,
 
     if (result)
         xmlrpc_DECREF(result);
+    drop_cached_bug(ax, bug_id);
 }
 
 xmlrpc_value *rhbz_search_duphash(struct abrt_xmlrpc *ax,
@@ -864,6 +1146,19 @@ xmlrpc_value *rhbz_search_duphash(struct abrt_xmlrpc *ax,
                         const char *component,
                         const char *duphash)
 {
+    g_autofree char *group = search_cache_group(ax, duphash);
+    g_autofree char *key = g_strdup_printf("%s\n%s\n%s", product ? product : "",
+                                           version ? version : "",
+                                           component ? component : "");
+    GVariant *cached = libreport_load_query_cache(group, key, G_VARIANT_TYPE("ai"),
+                                                  cache_ttl_secs, cache_negative_ttl_secs);
+    if (cached)
+    {
+        xmlrpc_value *bugs = bug_ids_from_variant(cached);
+        g_variant_unref(cached);
+        return bugs;
+    }
+
     GString *query = g_string_new(NULL);
 
     g_string_append_printf(query, "ALL whiteboard:\"%s\"", duphash);
@@ -887,6 +1182,13 @@ xmlrpc_value *rhbz_search_duphash(struct abrt_xmlrpc *ax,
     if (!bugs)
         error_msg_and_die(_("Bug.search(quicksearch) return value did not contain member 'bugs'"));
 
+    if (cache_ttl_secs || cache_negative_ttl_secs)
+    {
+        GVariant *ids = bug_ids_to_variant(bugs);
+        if (ids)
+            libreport_save_query_cache(group, key, ids);
+    }
+
     return bugs;
 }
 
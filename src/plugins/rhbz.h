@@ -39,6 +39,8 @@ enum {
     RHBZ_MINOR_UPDATE        = (1 << 3),
     RHBZ_PRIVATE             = (1 << 4),
     RHBZ_BINARY_ATTACHMENT   = (1 << 5),
+    /* rhbz_attach_fd() uses the REST API instead of XML-RPC */
+    RHBZ_REST_ATTACHMENT     = (1 << 6),
 };
 
 #define IS_MANDATORY(flags) ((flags) & RHBZ_MANDATORY_MEMB)
@@ -65,6 +67,13 @@ struct bug_info {
 struct bug_info *new_bug_info();
 void free_bug_info(struct bug_info *bz);
 
+/* Results of searches and bug data are kept in the query cache for ttl_secs,
+ * searches which found nothing for negative_ttl_secs. Changes made by these
+ * functions drop the data they make out of date. 0 disables the cache, which
+ * is the default.
+ */
+void rhbz_set_cache_ttl(unsigned ttl_secs, unsigned negative_ttl_secs);
+
 bool rhbz_login(struct abrt_xmlrpc *ax, const char *login, const char *password);
 
 bool rhbz_add_session_api_key(struct abrt_xmlrpc *ax, const char *api_key);
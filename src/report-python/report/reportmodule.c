@@ -101,6 +101,7 @@ MOD_INIT
     PyModule_AddObject(m, "DD_FAIL_QUIETLY_EACCES"             , Py_BuildValue("i", DD_FAIL_QUIETLY_EACCES             ));
     PyModule_AddObject(m, "DD_OPEN_READONLY"                   , Py_BuildValue("i", DD_OPEN_READONLY                   ));
     PyModule_AddObject(m, "DD_LOAD_TEXT_RETURN_NULL_ON_FAILURE", Py_BuildValue("i", DD_LOAD_TEXT_RETURN_NULL_ON_FAILURE));
+    PyModule_AddObject(m, "DD_OPEN_SHARED_LOCK"                , Py_BuildValue("i", DD_OPEN_SHARED_LOCK                ));
     /* for include/report/run_event.h */
     Py_INCREF(&p_run_event_state_type);
     PyModule_AddObject(m, "run_event_state", (PyObject *)&p_run_event_state_type);
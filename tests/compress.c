@@ -1,5 +1,7 @@
 #include <glib.h>
 #include <internal_libreport.h>
+#include <archive.h>
+#include <archive_entry.h>
 #include <stdlib.h>
 #include <unistd.h>
 
@@ -54,6 +56,106 @@ test_decompression(const void *user_data)
     unlink(template);
 }
 
+/* Mostly zeros with some data, like a coredump */
+static GByteArray *
+new_sample_core(size_t size)
+{
+    GByteArray *core = g_byte_array_sized_new(size);
+    g_byte_array_set_size(core, size);
+    memset(core->data, 0, size);
+
+    GRand *rand = g_rand_new_with_seed(42);
+    for (size_t page = 0; page + 4096 <= size; page += 16 * 4096)
+    {
+        for (size_t i = 0; i < 4096; i += 4)
+            *(guint32 *)(core->data + page + i) = g_rand_int_range(rand, 0, 256);
+    }
+    g_rand_free(rand);
+
+    return core;
+}
+
+static int
+compress_to_fd(GByteArray *data, const char *filter)
+{
+    char template[] = "/tmp/libreport-test_compressed-XXXXXX";
+    int fd = mkstemp(template);
+    g_assert_cmpint(fd, !=, -1);
+    unlink(template);
+
+    struct archive *archive = archive_write_new();
+    g_assert_cmpint(archive_write_add_filter_by_name(archive, filter), ==, ARCHIVE_OK);
+    g_assert_cmpint(archive_write_set_format_raw(archive), ==, ARCHIVE_OK);
+    g_assert_cmpint(archive_write_open_fd(archive, fd), ==, ARCHIVE_OK);
+
+    struct archive_entry *entry = archive_entry_new();
+    archive_entry_set_filetype(entry, AE_IFREG);
+    g_assert_cmpint(archive_write_header(archive, entry), ==, ARCHIVE_OK);
+    g_assert_cmpint(archive_write_data(archive, data->data, data->len), ==, data->len);
+    archive_entry_free(entry);
+
+    g_assert_cmpint(archive_write_close(archive), ==, ARCHIVE_OK);
+    archive_write_free(archive);
+
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+static void
+test_sparse_decompression(void)
+{
+    g_autoptr(GByteArray) core = new_sample_core(8 * 1024 * 1024);
+    int in_fd = compress_to_fd(core, "zstd");
+
+    char template[] = "/tmp/libreport-test_decompression-XXXXXX";
+    int out_fd = mkstemp(template);
+    g_assert_cmpint(out_fd, !=, -1);
+
+    g_assert_cmpint(libreport_decompress_fd(in_fd, out_fd), ==, 0);
+    close(in_fd);
+
+    struct stat st;
+    g_assert_cmpint(fstat(out_fd, &st), ==, 0);
+    g_assert_cmpint(st.st_size, ==, core->len);
+    /* Only the pages with data are allocated */
+    g_assert_cmpint(st.st_blocks * 512, <, core->len / 2);
+
+    g_autofree char *content = g_malloc(core->len);
+    g_assert_cmpint(pread(out_fd, content, core->len, 0), ==, core->len);
+    g_assert_cmpmem(content, core->len, core->data, core->len);
+
+    close(out_fd);
+    unlink(template);
+}
+
+/* Run with -m perf */
+static void
+test_decompression_throughput(const void *user_data)
+{
+    if (!g_test_perf())
+    {
+        g_test_skip("performance test");
+        return;
+    }
+
+    g_autoptr(GByteArray) core = new_sample_core(512 * 1024 * 1024);
+    int in_fd = compress_to_fd(core, user_data);
+
+    char template[] = "/tmp/libreport-test_decompression-XXXXXX";
+    int out_fd = mkstemp(template);
+    g_assert_cmpint(out_fd, !=, -1);
+    unlink(template);
+
+    g_test_timer_start();
+    g_assert_cmpint(libreport_decompress_fd(in_fd, out_fd), ==, 0);
+    const double secs = g_test_timer_elapsed();
+    g_test_maximized_result(core->len / secs / (1024 * 1024),
+                            "%s: %.1f MB/s", (const char *)user_data, core->len / secs / (1024 * 1024));
+
+    close(in_fd);
+    close(out_fd);
+}
+
 int
 main(int    argc,
      char **argv)
@@ -63,6 +165,9 @@ main(int    argc,
     g_test_add_data_func("/decompression/lz4", "data/compressed-file.lz4", test_decompression);
     g_test_add_data_func("/decompression/lzma", "data/compressed-file.xz", test_decompression);
     g_test_add_data_func("/decompression/zstd", "data/compressed-file.zst", test_decompression);
+    g_test_add_func("/decompression/sparse", test_sparse_decompression);
+    g_test_add_data_func("/decompression/throughput/zstd", "zstd", test_decompression_throughput);
+    g_test_add_data_func("/decompression/throughput/xz", "xz", test_decompression_throughput);
 
     return g_test_run();
 }
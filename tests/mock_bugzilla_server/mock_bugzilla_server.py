@@ -3,6 +3,7 @@
 import json
 import re
 from typing import Any, Dict, List, Union
+from xmlrpc.client import Fault
 from xmlrpc.server import SimpleXMLRPCServer, SimpleXMLRPCRequestHandler
 
 
@@ -35,6 +36,9 @@ COMMENT_ID_GEN = id_generator()
 ATTACH_ID_GEN = id_generator()
 BUGS = []
 USER = []
+# Attachments whose first attempt fails as if another change of the bug
+# was committed at the same time
+CONFLICTED_ATTACHMENTS = set()
 
 # retrieve specified fields (and subfields) from a dict hierarchy
 def populate_struct(dest: dict, src: dict, keys: List[str]):
@@ -137,6 +141,10 @@ with MyXMLRPCServer(('', 8080), requestHandler=RequestHandler) as server:
             else:
                 assert 'content_type' in args.keys(), "Missing required key 'summary'"
 
+            if args['file_name'].startswith('conflict') and args['file_name'] not in CONFLICTED_ATTACHMENTS:
+                CONFLICTED_ATTACHMENTS.add(args['file_name'])
+                raise Fault(32000, 'DBD::Pg::db do failed: query serialization error')
+
             private = False
             if 'is_private' in args.keys() and args['is_private'] == True:
                 private = True
@@ -0,0 +1,174 @@
+#include <glib.h>
+#include <internal_libreport.h>
+#include <stdlib.h>
+
+#define TEXT_SANITIZE (SANITIZE_ALL & ~SANITIZE_LF & ~SANITIZE_TAB)
+
+static void
+test_sanitize_valid(void)
+{
+    g_assert_null(libreport_sanitize_utf8("", TEXT_SANITIZE));
+    g_assert_null(libreport_sanitize_utf8("plain ASCII text\n\twith tab", TEXT_SANITIZE));
+    g_assert_null(libreport_sanitize_utf8("Schr\xc3\xb6" "dinger's Cat", TEXT_SANITIZE));
+    g_assert_null(libreport_sanitize_utf8("\xe2\x82\xac \xf0\x9f\x90\x88", TEXT_SANITIZE));
+    g_assert_null(libreport_sanitize_utf8("DEL \x7f is not a control char", TEXT_SANITIZE));
+}
+
+static void
+test_sanitize_invalid(void)
+{
+    static const struct
+    {
+        const char *input;
+        const char *expected;
+    } cases[] = {
+        { "bell\a", "bell[07]" },
+        { "cr\rlf\n", "cr[0D]lf\n" },
+        { "bare \x80 continuation", "bare [80] continuation" },
+        { "missing \xe0\x80", "missing [E0][80]" },
+        /* Overlong encodings */
+        { "nul \xc0\x80", "nul [C0][80]" },
+        { "slash \xe0\x80\xaf", "slash [E0][80][AF]" },
+        { "0x100 \xf0\x80\x84\x80", "0x100 [F0][80][84][80]" },
+        { "long enough to take the vectorized path \xff and more", "long enough to take the vectorized path [FF] and more" },
+    };
+
+    for (size_t i = 0; i < G_N_ELEMENTS(cases); ++i)
+    {
+        g_autofree char *sanitized = libreport_sanitize_utf8(cases[i].input, TEXT_SANITIZE);
+        g_assert_cmpstr(sanitized, ==, cases[i].expected);
+    }
+}
+
+static void
+test_sanitize_length(void)
+{
+    /* The sequence is cut by the length */
+    g_autofree char *sanitized = libreport_sanitize_utf8_ext("cut \xc3\xb6", 5, TEXT_SANITIZE, NULL);
+    g_assert_cmpstr(sanitized, ==, "cut [C3]");
+}
+
+static void
+test_text_stats(void)
+{
+    struct libreport_text_stats stats = { 0 };
+    const char text[] = "Schr\xc3\xb6" "dinger's \x7f Cat\n";
+    g_assert_null(libreport_sanitize_utf8_ext(text, strlen(text), TEXT_SANITIZE, &stats));
+    g_assert_cmpuint(stats.control_chars, ==, 0);
+    g_assert_cmpuint(stats.bad_chars, ==, 1);
+
+    /* Scanning stops at NUL */
+    const char binary[] = "ELF\0\xff\xff\xff";
+    memset(&stats, 0, sizeof(stats));
+    g_assert_null(libreport_sanitize_utf8_ext(binary, sizeof(binary) - 1, TEXT_SANITIZE, &stats));
+    g_assert_cmpuint(stats.control_chars, ==, 1);
+    g_assert_cmpuint(stats.bad_chars, ==, 0);
+}
+
+static void
+test_sanitize_garbage(void)
+{
+    /* Every Byte is sanitized, the output grows to four times the input */
+    const size_t size = 1024 * 1024;
+    g_autofree char *garbage = g_malloc(size + 1);
+    memset(garbage, 0xff, size);
+    garbage[size] = '\0';
+
+    g_autofree char *sanitized = libreport_sanitize_utf8(garbage, TEXT_SANITIZE);
+    g_assert_nonnull(sanitized);
+    g_assert_cmpuint(strlen(sanitized), ==, 4 * size);
+    g_assert_cmpmem(sanitized, 8, "[FF][FF]", 8);
+}
+
+/* Concatenates the text elements of the sample problems until the buffer
+ * has at least size Bytes.
+ */
+static char *
+load_sample_problems(size_t size)
+{
+    GString *samples = g_string_new(NULL);
+
+    for (int i = 1; i <= 3; ++i)
+    {
+        g_autofree char *problem = g_strdup_printf("%d", i);
+        g_autofree char *dir_name = g_test_build_filename(G_TEST_DIST, "sample_problems", problem, NULL);
+        g_autoptr(GDir) dir = g_dir_open(dir_name, 0, NULL);
+        g_assert_nonnull(dir);
+
+        const char *name;
+        while ((name = g_dir_read_name(dir)) != NULL)
+        {
+            g_autofree char *path = g_build_filename(dir_name, name, NULL);
+            g_autofree char *content = NULL;
+            g_assert_true(g_file_get_contents(path, &content, NULL, NULL));
+            g_string_append(samples, content);
+        }
+    }
+
+    g_assert_cmpuint(samples->len, >, 0);
+
+    const size_t sample_len = samples->len;
+    while (samples->len < size)
+        g_string_append_len(samples, samples->str, MIN(sample_len, size - samples->len));
+
+    return g_string_free(samples, FALSE);
+}
+
+static void
+benchmark_sanitize(const char *what, const char *buffer, size_t size)
+{
+    const int rounds = 20;
+
+    g_test_timer_start();
+    for (int i = 0; i < rounds; ++i)
+    {
+        struct libreport_text_stats stats = { 0 };
+        g_autofree char *sanitized = libreport_sanitize_utf8_ext(buffer, size, TEXT_SANITIZE, &stats);
+    }
+    const double elapsed = g_test_timer_elapsed();
+
+    g_test_minimized_result(elapsed / rounds, "%s: %.1f MiB/s",
+            what, (size * rounds) / elapsed / (1024 * 1024));
+}
+
+static void
+test_benchmark(void)
+{
+    const size_t size = 16 * 1024 * 1024;
+
+    g_autofree char *samples = load_sample_problems(size);
+    benchmark_sanitize("sample problems", samples, size);
+
+    /* Valid but not ASCII */
+    g_autofree char *unicode = g_malloc(size);
+    for (size_t i = 0; i + 1 < size; i += 2)
+        memcpy(unicode + i, "\xc3\xb6", 2);
+    benchmark_sanitize("two Byte sequences", unicode, size);
+
+    /* Every 64th Byte is invalid */
+    g_autofree char *garbage = g_strdup(samples);
+    for (size_t i = 63; i < size; i += 64)
+        garbage[i] = '\xff';
+    benchmark_sanitize("sparse garbage", garbage, size);
+}
+
+int
+main(int    argc,
+     char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    libreport_g_verbose = 0;
+
+    g_test_add_func("/sanitize_utf8/valid", test_sanitize_valid);
+    g_test_add_func("/sanitize_utf8/invalid", test_sanitize_invalid);
+    g_test_add_func("/sanitize_utf8/length", test_sanitize_length);
+    g_test_add_func("/sanitize_utf8/text_stats", test_text_stats);
+    g_test_add_func("/sanitize_utf8/garbage", test_sanitize_garbage);
+
+    /* Run by: ./sanitize_utf8 -m perf */
+    if (g_test_perf())
+        g_test_add_func("/sanitize_utf8/benchmark", test_benchmark);
+
+    return g_test_run();
+}